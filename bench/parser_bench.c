@@ -0,0 +1,161 @@
+/* cc -O2 -I. -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+      bench/parser_bench.c cluster.c control.c dueset.c handoff.c job.c
+      logger.c mail.c parser.c reboot.c scheduler.c spawner.c status.c
+      tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wordexp.h>
+
+#include "lykron.h"
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+
+static atomic_size_t NUM_ALLOCS = 0;
+
+void *
+__wrap_malloc (size_t size)
+{
+  atomic_fetch_add_explicit (&NUM_ALLOCS, 1, memory_order_relaxed);
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t nmemb, size_t size)
+{
+  atomic_fetch_add_explicit (&NUM_ALLOCS, 1, memory_order_relaxed);
+  return __real_calloc (nmemb, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+  atomic_fetch_add_explicit (&NUM_ALLOCS, 1, memory_order_relaxed);
+  return __real_realloc (ptr, size);
+}
+
+static const char *const BENCH_LINES[] = {
+  "*/5 * * * * /usr/bin/true\n",
+  "0 3 * * mon-fri /usr/local/bin/backup --full\n",
+  "15,45 8-18 * jan,apr,jul,oct * /bin/echo quarterly\n",
+  "30 2 1-7 * sun /usr/sbin/logrotate /etc/logrotate.conf\n",
+  "0 0 1 1 * /bin/echo new year\n",
+  "*/10 */2 * * * /bin/sh -c 'date >> /tmp/ticks'\n",
+  "*/15 9-17 * * 1-5 /usr/bin/poll-queue\n",
+  "@hourly /usr/bin/updatedb\n",
+  "@daily /usr/bin/tmpreaper 7d /tmp\n",
+  "@every 90s /usr/bin/heartbeat\n",
+  "MAILTO=ops@example.org\n",
+  "PATH=/usr/local/bin:/usr/bin:/bin\n",
+  "BACKUP_DIR=${HOME}/backups/$BENCH_HOST\n",
+  "# comment line that the lexer must skip\n",
+  "\n",
+};
+
+#define NUM_BENCH_LINES (sizeof (BENCH_LINES) / sizeof (BENCH_LINES[0]))
+
+static char *
+benchGenerate (size_t num_lines, size_t *text_len)
+{
+  char *text = NULL;
+  FILE *fstream = open_memstream (&text, text_len);
+
+  for (size_t i = 0; i < num_lines; i++)
+    fputs (BENCH_LINES[(i * 7 + i / NUM_BENCH_LINES) % NUM_BENCH_LINES],
+           fstream);
+
+  fclose (fstream);
+  return text;
+}
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *const BENCH_VALUES[] = {
+  "/usr/local/bin:/usr/bin:/bin",
+  "ops@example.org",
+  "${HOME}/backups/$BENCH_HOST",
+  "~/bin:$PATH",
+  "\"quoted value with $BENCH_HOST inside\"",
+  "'single quoted $NOT_EXPANDED'",
+  "$BENCH_UNDEFINED/kept/as/written",
+};
+
+#define NUM_BENCH_VALUES (sizeof (BENCH_VALUES) / sizeof (BENCH_VALUES[0]))
+
+static void
+benchExpand (Symtbl *stab, size_t num_values)
+{
+  double start = benchNow ();
+  for (size_t i = 0; i < num_values; i++)
+    {
+      const char *value = BENCH_VALUES[i % NUM_BENCH_VALUES];
+      free (parserExpandValue (stab, value, strlen (value)));
+    }
+  double builtin = benchNow () - start;
+
+  start = benchNow ();
+  for (size_t i = 0; i < num_values; i++)
+    {
+      wordexp_t wxp;
+      if (wordexp (BENCH_VALUES[i % NUM_BENCH_VALUES], &wxp,
+                   WRDE_NOCMD | WRDE_UNDEF)
+          == 0)
+        wordfree (&wxp);
+    }
+  double libc = benchNow () - start;
+
+  printf ("\n%10s %14s %14s\n", "values", "builtin/sec", "wordexp/sec");
+  printf ("%10zu %14.0f %14.0f\n", num_values, num_values / builtin,
+          num_values / libc);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t max_lines = argc > 1 ? strtoul (argv[1], NULL, 10) : 1000000;
+  struct passwd *pwd = getpwuid (getuid ());
+  setenv ("BENCH_HOST", "bench.example.org", 1);
+
+  printf ("%10s %12s %14s %12s\n", "lines", "seconds", "lines/sec",
+          "allocs/line");
+
+  for (size_t num_lines = 10; num_lines <= max_lines; num_lines *= 10)
+    {
+      size_t text_len = 0;
+      char *text = benchGenerate (num_lines, &text_len);
+      FILE *fstream = fmemopen (text, text_len, "r");
+      CronTab *ct = crontabNewDetached ("/dev/null", pwd->pw_name, false);
+
+      size_t allocs_before = atomic_load (&NUM_ALLOCS);
+      double start = benchNow ();
+      parserParseStream (ct, fstream);
+      double elapsed = benchNow () - start;
+      size_t num_allocs = atomic_load (&NUM_ALLOCS) - allocs_before;
+
+      printf ("%10zu %12.6f %14.0f %12.2f\n", num_lines, elapsed,
+              num_lines / elapsed, (double)num_allocs / num_lines);
+
+      fclose (fstream);
+      crontabDelete (ct);
+      free (text);
+    }
+
+  CronTab *ct = crontabNewDetached ("/dev/null", pwd->pw_name, false);
+  benchExpand (ct->stab, 100000);
+  crontabDelete (ct);
+
+  return EXIT_SUCCESS;
+}
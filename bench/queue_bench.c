@@ -0,0 +1,328 @@
+/* cc -O2 -I. bench/queue_bench.c cluster.c control.c dueset.c handoff.c
+      job.c logger.c mail.c parser.c reboot.c scheduler.c spawner.c
+      status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* Hold-model churn on the calendar queue with the notices kept in each
+   bucket as a sorted array of (time, notice) slots, and with the earlier
+   layout of one individually allocated, doubly linked notice per entry.
+   The list queue here uses the same bucket arithmetic and re-bucketing
+   as the scheduler, so only the storage differs.  Cache misses come from
+   perf when the kernel allows it.  */
+
+#define BENCH_HORIZON (24 * 60 * 60)
+#define BENCH_CHURN_OPS 2000000
+
+typedef struct BenchNode
+{
+  EventNotice evt;
+  struct BenchNode *prev, *next;
+  size_t bucket_idx;
+} BenchNode;
+
+typedef struct BenchBucket
+{
+  BenchNode anchor;
+  size_t num_nodes;
+} BenchBucket;
+
+typedef struct BenchList
+{
+  BenchBucket *buckets;
+  size_t num_buckets;
+  size_t curr_bucket;
+  size_t num_queued;
+  size_t resize_at;
+  time_t lower_bound;
+  time_t interval_width;
+} BenchList;
+
+static void
+benchListReset (BenchList *lq, size_t num_buckets, time_t lower_bound,
+                time_t interval_width)
+{
+  if (lq->buckets != NULL)
+    memDeallocSafe (lq->buckets);
+  lq->buckets = memAllocBlockSafe (num_buckets, sizeof (BenchBucket));
+  for (size_t i = 0; i < num_buckets; i++)
+    lq->buckets[i].anchor.prev = lq->buckets[i].anchor.next
+        = &lq->buckets[i].anchor;
+
+  lq->num_buckets = num_buckets;
+  lq->curr_bucket = 0;
+  lq->num_queued = 0;
+  lq->lower_bound = lower_bound;
+  lq->interval_width = interval_width;
+}
+
+static void
+benchListLinkAfter (BenchNode *cursor, BenchNode *node)
+{
+  node->prev = cursor;
+  node->next = cursor->next;
+  cursor->next->prev = node;
+  cursor->next = node;
+}
+
+static int
+benchCompareNodes (const void *a, const void *b)
+{
+  time_t ta = (*(BenchNode *const *)a)->evt.time;
+  time_t tb = (*(BenchNode *const *)b)->evt.time;
+  return (ta > tb) - (ta < tb);
+}
+
+static void
+benchListRebuild (BenchList *lq)
+{
+  size_t num_all = lq->num_queued, n = 0;
+  lq->resize_at = num_all > NLIM / 2 ? num_all << 1 : NLIM;
+  if (num_all == 0)
+    return;
+
+  BenchNode **all = memAllocBlockSafe (num_all, sizeof (BenchNode *));
+  for (size_t i = 0; i < lq->num_buckets; i++)
+    {
+      BenchNode *anchor = &lq->buckets[i].anchor;
+      for (BenchNode *node = anchor->next; node != anchor; node = node->next)
+        all[n++] = node;
+    }
+  qsort (all, num_all, sizeof (BenchNode *), benchCompareNodes);
+
+  time_t min_time = all[0]->evt.time, max_time = all[num_all - 1]->evt.time;
+  size_t num_buckets = num_all / (NLIM / 2) + 1;
+  if (num_buckets < INIT_NUM_BUCKETS)
+    num_buckets = INIT_NUM_BUCKETS;
+  time_t width = (max_time - min_time) / num_buckets + 1;
+  if (width > 60)
+    width = (width + 59) / 60 * 60;
+  benchListReset (lq, num_buckets, min_time, width);
+
+  for (size_t i = 0; i < num_all; i++)
+    {
+      size_t idx = (all[i]->evt.time - min_time) / width;
+      BenchBucket *b = &lq->buckets[idx];
+      benchListLinkAfter (b->anchor.prev, all[i]);
+      all[i]->bucket_idx = idx;
+      b->num_nodes++;
+    }
+  lq->num_queued = num_all;
+
+  memDeallocSafe (all);
+}
+
+static void
+benchListInsert (BenchList *lq, BenchNode *node)
+{
+  time_t new_t = node->evt.time;
+  time_t rel = (new_t - lq->lower_bound) / lq->interval_width;
+  size_t offst = rel > 0 ? rel : 0;
+  size_t idx = (lq->curr_bucket + offst) % lq->num_buckets;
+
+  BenchBucket *b = &lq->buckets[idx];
+  BenchNode *cursor = &b->anchor;
+  while (cursor->next != &b->anchor && cursor->next->evt.time <= new_t)
+    cursor = cursor->next;
+
+  benchListLinkAfter (cursor, node);
+  node->bucket_idx = idx;
+  b->num_nodes++;
+
+  if (++lq->num_queued > lq->resize_at
+      || (b->num_nodes > NLIM && offst >= lq->num_buckets
+          && b->anchor.prev->evt.time - b->anchor.next->evt.time
+                 >= lq->interval_width))
+    benchListRebuild (lq);
+}
+
+static BenchNode *
+benchListRemoveMin (BenchList *lq)
+{
+  for (size_t i = 0; i < lq->num_buckets; i++)
+    {
+      size_t idx = (lq->curr_bucket + i) % lq->num_buckets;
+      time_t window_end = lq->lower_bound + (i + 1) * lq->interval_width;
+      BenchBucket *b = &lq->buckets[idx];
+      BenchNode *node = b->anchor.next;
+      if (node == &b->anchor || node->evt.time >= window_end)
+        continue;
+
+      node->prev->next = node->next;
+      node->next->prev = node->prev;
+      b->num_nodes--;
+      lq->num_queued--;
+      lq->curr_bucket = idx;
+      lq->lower_bound += i * lq->interval_width;
+
+      return node;
+    }
+
+  benchListRebuild (lq);
+  return lq->num_queued > 0 ? benchListRemoveMin (lq) : NULL;
+}
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+benchOpenMisses (void)
+{
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+benchStartMisses (int perf_fd)
+{
+  if (perf_fd < 0)
+    return;
+  ioctl (perf_fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl (perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static double
+benchStopMisses (int perf_fd, size_t num_ops)
+{
+  long long misses = 0;
+  if (perf_fd < 0)
+    return -1.0;
+  ioctl (perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (read (perf_fd, &misses, sizeof (misses)) != sizeof (misses))
+    return -1.0;
+  return (double)misses / num_ops;
+}
+
+/* Times are drawn from one seed for both queues, so each pops the same
+   sequence; the sums must match.  */
+static time_t
+benchArray (size_t num_notices, time_t start, int perf_fd, double *ns,
+            double *misses)
+{
+  EventNotice *notices = memAllocBlockSafe (num_notices, sizeof (EventNotice));
+  Scheduler *sched = schedulerNew ();
+
+  srand (num_notices);
+  for (size_t i = 0; i < num_notices; i++)
+    {
+      notices[i].time = start + rand () % BENCH_HORIZON;
+      notices[i].bucket_idx = -1;
+      schedulerInsert (sched, &notices[i]);
+    }
+
+  time_t sum = 0;
+  benchStartMisses (perf_fd);
+  double begin = benchNow ();
+  for (size_t i = 0; i < BENCH_CHURN_OPS; i++)
+    {
+      EventNotice *evt = schedulerRemoveMin (sched);
+      sum += evt->time;
+      evt->time += 1 + rand () % BENCH_HORIZON;
+      schedulerInsert (sched, evt);
+    }
+  *ns = (benchNow () - begin) / BENCH_CHURN_OPS * 1e9;
+  *misses = benchStopMisses (perf_fd, BENCH_CHURN_OPS);
+
+  while (schedulerRemoveMin (sched) != NULL)
+    ;
+  schedulerDelete (sched);
+  memDeallocSafe (notices);
+  return sum;
+}
+
+static time_t
+benchList (size_t num_notices, time_t start, int perf_fd, double *ns,
+           double *misses)
+{
+  BenchList lq = { 0 };
+  benchListReset (&lq, INIT_NUM_BUCKETS, start, INIT_INTERVAL_WIDTH);
+  lq.resize_at = NLIM;
+
+  BenchNode **nodes = memAllocBlockSafe (num_notices, sizeof (BenchNode *));
+  srand (num_notices);
+  for (size_t i = 0; i < num_notices; i++)
+    {
+      nodes[i] = memAllocBlockSafe (1, sizeof (BenchNode));
+      nodes[i]->evt.time = start + rand () % BENCH_HORIZON;
+      benchListInsert (&lq, nodes[i]);
+    }
+
+  time_t sum = 0;
+  benchStartMisses (perf_fd);
+  double begin = benchNow ();
+  for (size_t i = 0; i < BENCH_CHURN_OPS; i++)
+    {
+      BenchNode *node = benchListRemoveMin (&lq);
+      sum += node->evt.time;
+      node->evt.time += 1 + rand () % BENCH_HORIZON;
+      benchListInsert (&lq, node);
+    }
+  *ns = (benchNow () - begin) / BENCH_CHURN_OPS * 1e9;
+  *misses = benchStopMisses (perf_fd, BENCH_CHURN_OPS);
+
+  for (size_t i = 0; i < num_notices; i++)
+    memDeallocSafe (nodes[i]);
+  memDeallocSafe (nodes);
+  memDeallocSafe (lq.buckets);
+  return sum;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t max_notices = argc > 1 ? strtoul (argv[1], NULL, 10) : 1000000;
+  time_t start = (time (NULL) / 60 + 1) * 60;
+  int perf_fd = benchOpenMisses ();
+
+  if (perf_fd < 0)
+    fputs ("perf_event_open failed, cache misses not measured\n", stderr);
+
+  printf ("%10s %12s %12s %14s %14s %6s\n", "notices", "list ns/op",
+          "array ns/op", "list miss/op", "array miss/op", "same");
+
+  for (size_t num_notices = 1000; num_notices <= max_notices;
+       num_notices *= 10)
+    {
+      double list_ns, array_ns, list_misses, array_misses;
+      time_t list_sum
+          = benchList (num_notices, start, perf_fd, &list_ns, &list_misses);
+      time_t array_sum = benchArray (num_notices, start, perf_fd, &array_ns,
+                                     &array_misses);
+
+      char list_col[32] = "n/a", array_col[32] = "n/a";
+      if (list_misses >= 0.0)
+        snprintf (&list_col[0], sizeof (list_col), "%.2f", list_misses);
+      if (array_misses >= 0.0)
+        snprintf (&array_col[0], sizeof (array_col), "%.2f", array_misses);
+
+      printf ("%10zu %12.1f %12.1f %14s %14s %6s\n", num_notices, list_ns,
+              array_ns, &list_col[0], &array_col[0],
+              list_sum == array_sum ? "yes" : "NO");
+      fflush (stdout);
+    }
+
+  if (perf_fd >= 0)
+    close (perf_fd);
+  return EXIT_SUCCESS;
+}
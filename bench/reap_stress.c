@@ -0,0 +1,115 @@
+/* cc -O2 -I. -DLOG_FILE='"/tmp/reap_stress.log"' bench/reap_stress.c
+      cluster.c control.c dueset.c handoff.c job.c logger.c mail.c
+      parser.c reboot.c scheduler.c spawner.c status.c tab.c -lpthread
+      -lz  */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+#define STRESS_PID_MAX (4 * 1024 * 1024)
+
+/* Spawns /bin/true through the shards while the reaper runs, then checks
+   the log holds exactly one exit line per spawned child.  */
+
+static double
+stressNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+stressReaper (void *arg)
+{
+  loggerReapChildren (arg);
+  return NULL;
+}
+
+static bool
+stressCountExits (off_t offset, size_t num_spawned)
+{
+  FILE *fstream = fopen (LOG_FILE, "r");
+  if (fstream == NULL || fseeko (fstream, offset, SEEK_SET) < 0)
+    _err_out ("fopen");
+
+  size_t *seen = memAllocBlockSafe (STRESS_PID_MAX, sizeof (size_t));
+  size_t num_exits = 0, num_twice = 0;
+  char line[MAX_LOG_LINE];
+  while (fgets (&line[0], sizeof (line), fstream) != NULL)
+    {
+      int pid = 0;
+      char *paren = strchr (&line[0], '(');
+      if (paren == NULL || strstr (paren, ") exit: ") == NULL
+          || sscanf (paren, "(%d)", &pid) != 1 || pid <= 0
+          || pid >= STRESS_PID_MAX)
+        continue;
+
+      num_exits++;
+      if (seen[pid]++ == 1)
+        num_twice++;
+    }
+
+  fclose (fstream);
+  memDeallocSafe (seen);
+
+  if (num_twice > 0)
+    fprintf (stderr, "%zu pids logged more than once\n", num_twice);
+  if (num_exits != num_spawned)
+    fprintf (stderr, "%zu exits logged for %zu spawns\n", num_exits,
+             num_spawned);
+
+  return num_twice == 0 && num_exits == num_spawned;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char text[] = "* * * * * /bin/true\n";
+  size_t num_spawns = argc > 1 ? strtoul (argv[1], NULL, 10) : 10000;
+
+  sigset_t mask;
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGCHLD);
+  sigaddset (&mask, SIGQUIT);
+  pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+  struct stat st = { 0 };
+  off_t offset = stat (LOG_FILE, &st) == 0 ? st.st_size : 0;
+
+  CronTab *ct = crontabNew ("/stress", getpwuid (getuid ())->pw_name, false);
+  ct->logger->block_on_full = true;
+  FILE *fstream = fmemopen ((void *)text, sizeof (text) - 1, "r");
+  parserParseStream (ct, fstream);
+  fclose (fstream);
+
+  pthread_t reaper;
+  pthread_create (&reaper, NULL, stressReaper, ct->logger);
+  shardsetStart (shardsetGet ());
+
+  double begin = stressNow ();
+  for (size_t i = 0; i < num_spawns; i++)
+    schedulerPost (ct->sched, &ct->store.jobs[0], true);
+
+  while (shardsetFires (shardsetGet ()) < num_spawns
+         || atomic_load (&ct->refs) > 0)
+    usleep (1000);
+  double elapsed = stressNow () - begin;
+
+  loggerQuiesce ();
+  bool passed = stressCountExits (offset, num_spawns);
+  printf ("%zu spawns reaped in %.3fs (%.0f/s): %s\n", num_spawns, elapsed,
+          num_spawns / elapsed, passed ? "each exit logged once" : "FAIL");
+
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,233 @@
+/* cc -O2 -march=native -I. bench/sched_bench.c cluster.c control.c
+      dueset.c handoff.c job.c logger.c mail.c parser.c reboot.c
+      scheduler.c spawner.c status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lykron.h"
+
+#define BENCH_HORIZON (24 * 60 * 60)
+#define BENCH_CHURN_OPS 1000000
+
+static const int BENCH_STEPS[] = { 1, 2, 5, 10, 15, 30, 60 };
+
+#define NUM_BENCH_STEPS (sizeof (BENCH_STEPS) / sizeof (BENCH_STEPS[0]))
+
+struct BenchFire
+{
+  EventNotice *evt;
+  time_t next;
+};
+
+static void
+benchTimeset (Timeset *ts, size_t seed)
+{
+  memset (ts, 0, sizeof (Timeset));
+  srand (seed);
+
+  int step = BENCH_STEPS[rand () % NUM_BENCH_STEPS];
+  int offset = rand () % step;
+  for (int i = offset; i < NUM_Mins; i += step)
+    ts->mins[i] = true;
+
+  int first_hour = rand () % 4 == 0 ? rand () % NUM_Hours : 0;
+  int last_hour = first_hour + rand () % (NUM_Hours - first_hour);
+  for (int i = first_hour; i <= last_hour; i++)
+    ts->hours[i] = true;
+
+  ts->secs[0] = true;
+  memset (&ts->dom[1], true, NUM_DoM - 1);
+  memset (&ts->month[1], true, NUM_Month - 1);
+  memset (&ts->dow[0], true, NUM_DoW);
+  ts->mins[rand () % NUM_Mins] = true;
+  ts->hours[rand () % NUM_Hours] = true;
+}
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+benchSeed (Scheduler *sched, Schedule **schedules, size_t num_schedules,
+           time_t start)
+{
+  for (size_t i = 0; i < num_schedules; i++)
+    {
+      EventNotice *evt = &schedules[i]->notice;
+      evt->time = timesetComputeNextOccurence (&schedules[i]->timeset, start);
+      schedulerInsert (sched, evt);
+    }
+}
+
+/* Runs the horizon once to record every fire and its re-arm time, then
+   replays the trace twice: queue operations alone, and next-time
+   computation alone.  Both backends compute the next time of a fired
+   schedule, so only the queue operations compare with the due set.  */
+static size_t
+benchQueue (Schedule **schedules, size_t num_schedules, time_t start,
+            double *queue_elapsed, double *next_elapsed)
+{
+  size_t num_fires = 0, max_fires = num_schedules * 64;
+  struct BenchFire *trace
+      = memAllocBlockSafe (max_fires, sizeof (struct BenchFire));
+
+  Scheduler *sched = schedulerNew ();
+  benchSeed (sched, schedules, num_schedules, start);
+  EventNotice *evt = NULL;
+  while ((evt = schedulerRemoveMin (sched)) != NULL
+         && evt->time < start + BENCH_HORIZON)
+    {
+      if (num_fires == max_fires)
+        {
+          trace = memReallocSafe (trace, max_fires, max_fires << 1,
+                                  sizeof (struct BenchFire));
+          max_fires <<= 1;
+        }
+      time_t next = timesetComputeNextOccurence (&evt->schedule->timeset,
+                                                 evt->time + 1);
+      trace[num_fires].evt = evt;
+      trace[num_fires++].next = next;
+      evt->time = next;
+      schedulerInsert (sched, evt);
+    }
+  schedulerDelete (sched);
+
+  sched = schedulerNew ();
+  benchSeed (sched, schedules, num_schedules, start);
+  double begin = benchNow ();
+  for (size_t i = 0; i < num_fires; i++)
+    {
+      evt = schedulerRemoveMin (sched);
+      evt->time = trace[i].next;
+      schedulerInsert (sched, evt);
+    }
+  *queue_elapsed = benchNow () - begin;
+  schedulerDelete (sched);
+
+  time_t sink = 0;
+  begin = benchNow ();
+  for (size_t i = 0; i < num_fires; i++)
+    sink ^= timesetComputeNextOccurence (&trace[i].evt->schedule->timeset,
+                                         trace[i].next);
+  *next_elapsed = benchNow () - begin;
+  if (sink == 1)
+    putchar ('\0');
+
+  memDeallocSafe (trace);
+  return num_fires;
+}
+
+static double
+benchChurn (Schedule **schedules, size_t num_schedules, time_t start)
+{
+  Scheduler *sched = schedulerNew ();
+  EventNotice **evts
+      = memAllocBlockSafe (num_schedules, sizeof (EventNotice *));
+
+  srand (num_schedules);
+  for (size_t i = 0; i < num_schedules; i++)
+    {
+      evts[i] = &schedules[i]->notice;
+      evts[i]->time = start + rand () % BENCH_HORIZON;
+    }
+  schedulerBulkLoad (sched, evts, num_schedules);
+
+  double begin = benchNow ();
+  for (size_t i = 0; i < BENCH_CHURN_OPS; i++)
+    {
+      EventNotice *evt = schedulerRemoveMin (sched);
+      evt->time += 1 + rand () % BENCH_HORIZON;
+      schedulerInsert (sched, evt);
+    }
+  double elapsed = benchNow () - begin;
+
+  memDeallocSafe (evts);
+  schedulerDelete (sched);
+  return elapsed / BENCH_CHURN_OPS * 1e9;
+}
+
+static size_t
+benchDueset (Schedule **schedules, size_t num_schedules, time_t start,
+             double *elapsed)
+{
+  DueSet *ds = duesetNew ();
+  size_t num_fires = 0;
+  double begin = benchNow ();
+
+  for (size_t i = 0; i < num_schedules; i++)
+    duesetAdd (ds, schedules[i]);
+
+  ds->last_tick = start - 1;
+  time_t tick = duesetNextTick (ds);
+  while (tick < start + BENCH_HORIZON)
+    {
+      num_fires += duesetCollect (ds, tick);
+      ds->last_tick = tick;
+      tick = duesetNextTick (ds);
+    }
+
+  *elapsed = benchNow () - begin;
+  duesetDelete (ds);
+  return num_fires;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t max_schedules = argc > 1 ? strtoul (argv[1], NULL, 10) : 16384;
+  time_t start = (time (NULL) / 60 + 1) * 60;
+  SchedulePool *pool = schedpoolNew ();
+
+  printf ("%10s %12s %12s %12s %12s %8s %12s\n", "schedules", "fires/day",
+          "queue", "next", "dueset", "winner", "churn ns/op");
+
+  for (size_t num_schedules = 16; num_schedules <= max_schedules;
+       num_schedules <<= 2)
+    {
+      Schedule **schedules
+          = memAllocBlockSafe (num_schedules, sizeof (Schedule *));
+      for (size_t i = 0, seed = 1; i < num_schedules; i++)
+        {
+          Timeset ts;
+          do
+            {
+              if (schedules[i] != NULL)
+                schedpoolRelease (schedules[i]);
+              benchTimeset (&ts, seed++);
+              schedules[i] = schedpoolIntern (pool, &ts);
+            }
+          while (schedules[i]->refs > 1);
+        }
+
+      double queue_elapsed = 0.0, next_elapsed = 0.0, dueset_elapsed = 0.0;
+      size_t queue_fires = benchQueue (schedules, num_schedules, start,
+                                       &queue_elapsed, &next_elapsed);
+      size_t dueset_fires
+          = benchDueset (schedules, num_schedules, start, &dueset_elapsed);
+
+      double churn_ns = benchChurn (schedules, num_schedules, start);
+
+      if (queue_fires != dueset_fires)
+        fprintf (stderr, "fire count mismatch: queue=%zu dueset=%zu\n",
+                 queue_fires, dueset_fires);
+
+      printf ("%10zu %12zu %11.4fs %11.4fs %11.4fs %8s %12.1f\n",
+              num_schedules, dueset_fires, queue_elapsed, next_elapsed,
+              dueset_elapsed,
+              queue_elapsed < dueset_elapsed ? "queue" : "dueset", churn_ns);
+
+      for (size_t i = 0; i < num_schedules; i++)
+        schedpoolRelease (schedules[i]);
+      memDeallocSafe (schedules);
+    }
+
+  schedpoolDelete (pool);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/* cc -O2 -I. bench/seconds_bench.c cluster.c control.c dueset.c
+      handoff.c job.c logger.c mail.c parser.c reboot.c scheduler.c
+      spawner.c status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lykron.h"
+
+#define BENCH_HORIZON (60 * 60)
+
+static const int BENCH_MIN_STEPS[] = { 1, 2, 5, 10, 15, 30 };
+static const int BENCH_SEC_STEPS[] = { 1, 2, 5, 10, 15, 30 };
+
+#define NUM_BENCH_STEPS 6
+
+struct BenchFire
+{
+  EventNotice *evt;
+  time_t next;
+};
+
+static void
+benchTimeset (Timeset *ts, size_t seed, unsigned sec_percent)
+{
+  memset (ts, 0, sizeof (Timeset));
+  srand (seed);
+
+  int first_hour = rand () % NUM_Hours;
+  int last_hour = first_hour + rand () % (NUM_Hours - first_hour);
+  memset (&ts->hours[first_hour], true, last_hour - first_hour + 1);
+  memset (&ts->dom[1], true, NUM_DoM - 1);
+  memset (&ts->month[1], true, NUM_Month - 1);
+  memset (&ts->dow[0], true, NUM_DoW);
+
+  if ((unsigned)(rand () % 100) >= sec_percent)
+    {
+      int step = BENCH_MIN_STEPS[rand () % NUM_BENCH_STEPS];
+      for (int i = rand () % step; i < NUM_Mins; i += step)
+        ts->mins[i] = true;
+      ts->secs[rand () % NUM_Secs] = true;
+    }
+  else if (rand () % 2 == 0)
+    ts->every = 1 + rand () % 60;
+  else
+    {
+      int step = BENCH_SEC_STEPS[rand () % NUM_BENCH_STEPS];
+      for (int i = rand () % step; i < NUM_Secs; i += step)
+        ts->secs[i] = true;
+      memset (&ts->mins[0], true, NUM_Mins);
+    }
+}
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+benchSeed (Scheduler *sched, Schedule **schedules, size_t num_schedules,
+           time_t start)
+{
+  for (size_t i = 0; i < num_schedules; i++)
+    {
+      EventNotice *evt = &schedules[i]->notice;
+      evt->time = timesetComputeNextOccurence (&schedules[i]->timeset, start);
+      schedulerInsert (sched, evt);
+    }
+}
+
+/* Runs the horizon once to record every fire and its re-arm time, then
+   replays the trace twice: queue operations alone, and next-time
+   computation alone.  */
+static size_t
+benchRun (Schedule **schedules, size_t num_schedules, time_t start,
+          double *queue_ns, double *next_ns)
+{
+  size_t num_fires = 0, max_fires = num_schedules * 64;
+  struct BenchFire *trace
+      = memAllocBlockSafe (max_fires, sizeof (struct BenchFire));
+
+  Scheduler *sched = schedulerNew ();
+  benchSeed (sched, schedules, num_schedules, start);
+  EventNotice *evt = NULL;
+  while ((evt = schedulerRemoveMin (sched)) != NULL
+         && evt->time < start + BENCH_HORIZON)
+    {
+      if (num_fires == max_fires)
+        {
+          trace = memReallocSafe (trace, max_fires, max_fires << 1,
+                                  sizeof (struct BenchFire));
+          max_fires <<= 1;
+        }
+      time_t next = timesetComputeNextOccurence (&evt->schedule->timeset,
+                                                 evt->time + 1);
+      trace[num_fires].evt = evt;
+      trace[num_fires++].next = next;
+      evt->time = next;
+      schedulerInsert (sched, evt);
+    }
+  schedulerDelete (sched);
+
+  sched = schedulerNew ();
+  benchSeed (sched, schedules, num_schedules, start);
+  double begin = benchNow ();
+  for (size_t i = 0; i < num_fires; i++)
+    {
+      evt = schedulerRemoveMin (sched);
+      evt->time = trace[i].next;
+      schedulerInsert (sched, evt);
+    }
+  *queue_ns = (benchNow () - begin) / num_fires * 1e9;
+  schedulerDelete (sched);
+
+  time_t sink = 0;
+  begin = benchNow ();
+  for (size_t i = 0; i < num_fires; i++)
+    sink ^= timesetComputeNextOccurence (&trace[i].evt->schedule->timeset,
+                                         trace[i].next);
+  *next_ns = (benchNow () - begin) / num_fires * 1e9;
+  if (sink == 1)
+    putchar ('\0');
+
+  memDeallocSafe (trace);
+  return num_fires;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t num_schedules = argc > 1 ? strtoul (argv[1], NULL, 10) : 4096;
+  time_t start = (time (NULL) / 60 + 1) * 60;
+  static const unsigned sec_percents[] = { 0, 1, 10, 50, 100 };
+
+  printf ("%10s %8s %12s %14s %14s\n", "schedules", "% secs", "fires/hour",
+          "queue ns/fire", "next ns/fire");
+
+  for (size_t p = 0; p < sizeof (sec_percents) / sizeof (sec_percents[0]);
+       p++)
+    {
+      SchedulePool *pool = schedpoolNew ();
+      Schedule **schedules
+          = memAllocBlockSafe (num_schedules, sizeof (Schedule *));
+      for (size_t i = 0, seed = 1; i < num_schedules; i++)
+        {
+          Timeset ts;
+          do
+            {
+              if (schedules[i] != NULL)
+                schedpoolRelease (schedules[i]);
+              benchTimeset (&ts, seed++, sec_percents[p]);
+              schedules[i] = schedpoolIntern (pool, &ts);
+            }
+          while (schedules[i]->refs > 1);
+        }
+
+      double queue_ns = 0.0, next_ns = 0.0;
+      size_t num_fires
+          = benchRun (schedules, num_schedules, start, &queue_ns, &next_ns);
+      printf ("%10zu %8u %12zu %14.1f %14.1f\n", num_schedules,
+              sec_percents[p], num_fires, queue_ns, next_ns);
+
+      for (size_t i = 0; i < num_schedules; i++)
+        schedpoolRelease (schedules[i]);
+      memDeallocSafe (schedules);
+      schedpoolDelete (pool);
+    }
+
+  return EXIT_SUCCESS;
+}
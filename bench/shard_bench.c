@@ -0,0 +1,114 @@
+/* cc -O2 -I. -DLOG_FILE='"/dev/null"' bench/shard_bench.c cluster.c
+      control.c dueset.c handoff.c job.c logger.c mail.c parser.c
+      reboot.c scheduler.c spawner.c status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+static const size_t BENCH_SHARDS[] = { 1, 2, 4, 8 };
+
+#define NUM_BENCH_SHARDS (sizeof (BENCH_SHARDS) / sizeof (BENCH_SHARDS[0]))
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+benchReaper (void *arg)
+{
+  loggerReapChildren (arg);
+  return NULL;
+}
+
+static CronTab *
+benchTab (Scheduler *sched, size_t idx)
+{
+  static const char text[] = "* * * * * /bin/true\n";
+  char path[PATH_MAX + 1] = { 0 };
+  snprintf (&path[0], PATH_MAX, "/bench/shard%zu", idx);
+
+  CronTab *ct = crontabNew (&path[0], getpwuid (getuid ())->pw_name, false);
+  ct->sched = sched;
+  FILE *fstream = fmemopen ((void *)text, sizeof (text) - 1, "r");
+  parserParseStream (ct, fstream);
+  fclose (fstream);
+
+  return ct;
+}
+
+/* Runs in its own process so every shard count starts with fresh
+   spawners and an empty child table.  */
+static void
+benchShards (size_t num_shards, size_t num_fires)
+{
+  sigset_t mask;
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGCHLD);
+  sigaddset (&mask, SIGQUIT);
+  pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+  ShardSet *ss = shardsetNew (num_shards);
+  CronTab **tabs = memAllocBlockSafe (num_shards, sizeof (CronTab *));
+  for (size_t i = 0; i < num_shards; i++)
+    tabs[i] = benchTab (ss->shards[i], i);
+
+  pthread_t reaper;
+  pthread_create (&reaper, NULL, benchReaper, tabs[0]->logger);
+  shardsetStart (ss);
+
+  double begin = benchNow ();
+  for (size_t i = 0; i < num_fires; i++)
+    schedulerPost (ss->shards[i % num_shards],
+                   &tabs[i % num_shards]->store.jobs[0], true);
+
+  size_t num_live = 0;
+  do
+    {
+      usleep (1000);
+      num_live = 0;
+      for (size_t i = 0; i < num_shards; i++)
+        num_live += atomic_load (&tabs[i]->refs);
+    }
+  while (shardsetFires (ss) < num_fires || num_live > 0);
+  double elapsed = benchNow () - begin;
+
+  printf ("%8zu %10zu %12.0f %10zu\n", num_shards, num_fires,
+          num_fires / elapsed,
+          atomic_load (&ss->admission.num_contended));
+  fflush (stdout);
+  _exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t num_fires = argc > 1 ? strtoul (argv[1], NULL, 10) : 4096;
+
+  printf ("%8s %10s %12s %10s\n", "shards", "fires", "fires/s",
+          "contended");
+  fflush (stdout);
+
+  for (size_t i = 0; i < NUM_BENCH_SHARDS; i++)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        benchShards (BENCH_SHARDS[i], num_fires);
+      waitpid (pid, NULL, 0);
+    }
+
+  return EXIT_SUCCESS;
+}
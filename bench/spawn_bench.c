@@ -0,0 +1,87 @@
+/* cc -O2 -I. bench/spawn_bench.c cluster.c control.c dueset.c handoff.c
+      job.c logger.c mail.c parser.c reboot.c scheduler.c spawner.c
+      status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* Spawns /bin/true through the zygote and through a plain fork of the
+   daemon, whose cost grows with the daemon's resident set.  */
+
+static const size_t BENCH_RSS_MB[] = { 0, 64, 256, 1024 };
+
+#define NUM_BENCH_RSS (sizeof (BENCH_RSS_MB) / sizeof (BENCH_RSS_MB[0]))
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+benchSpawn (Spawner *spw, CronJob *cj, int out_fd, int err_fd,
+            size_t num_spawns)
+{
+  double begin = benchNow ();
+  for (size_t i = 0; i < num_spawns; i++)
+    {
+      pid_t pid = spawnerSpawn (spw, cj, out_fd, err_fd);
+      if (pid < 0)
+        _err_out ("spawnerSpawn");
+      waitpid (pid, NULL, 0);
+    }
+
+  return num_spawns / (benchNow () - begin);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char text[] = "* * * * * /bin/true\n";
+  size_t num_spawns = argc > 1 ? strtoul (argv[1], NULL, 10) : 2000;
+
+  CronTab *ct = crontabNew ("/bench/spawn", getpwuid (getuid ())->pw_name,
+                            false);
+  FILE *fstream = fmemopen ((void *)text, sizeof (text) - 1, "r");
+  parserParseStream (ct, fstream);
+  fclose (fstream);
+  CronJob *cj = &ct->store.jobs[0];
+
+  int out_fd = spawnerOpenCapture ();
+  int err_fd = spawnerOpenCapture ();
+  if (out_fd < 0 || err_fd < 0)
+    _err_out ("spawnerOpenCapture");
+
+  Spawner *spw = spawnerStart ();
+
+  printf ("%8s %10s %12s %12s\n", "rss MB", "spawns", "zygote/s",
+          "fork/s");
+
+  for (size_t i = 0; i < NUM_BENCH_RSS; i++)
+    {
+      size_t rss = BENCH_RSS_MB[i] << 20;
+      char *ballast = rss > 0 ? memAllocSafe (rss) : NULL;
+      if (ballast != NULL)
+        memset (ballast, 1, rss);
+
+      double zygote_rate = benchSpawn (spw, cj, out_fd, err_fd, num_spawns);
+      double fork_rate = benchSpawn (NULL, cj, out_fd, err_fd, num_spawns);
+      printf ("%8zu %10zu %12.0f %12.0f\n", BENCH_RSS_MB[i], num_spawns,
+              zygote_rate, fork_rate);
+
+      if (ballast != NULL)
+        memDeallocSafe (ballast);
+    }
+
+  spawnerStop (spw);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+/* cc -O2 -I. bench/startup_bench.c cluster.c control.c dueset.c
+      handoff.c job.c logger.c mail.c parser.c reboot.c scheduler.c
+      spawner.c status.c tab.c -lpthread -lz  */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lykron.h"
+
+/* Startup cost of a table of N jobs: computing each job's first fire,
+   then queueing the notices one insert at a time or in one bulk load.
+   Both queues must then hand the notices back in the same order.  */
+
+#define BENCH_NUM_TIMESETS 4096
+
+static const int BENCH_STEPS[] = { 1, 2, 5, 10, 15, 30, 60 };
+
+#define NUM_BENCH_STEPS (sizeof (BENCH_STEPS) / sizeof (BENCH_STEPS[0]))
+
+static void
+benchTimeset (Timeset *ts, size_t seed)
+{
+  memset (ts, 0, sizeof (Timeset));
+  srand (seed);
+
+  int step = BENCH_STEPS[rand () % NUM_BENCH_STEPS];
+  for (int i = rand () % step; i < NUM_Mins; i += step)
+    ts->mins[i] = true;
+
+  if (rand () % 4 == 0)
+    ts->hours[rand () % NUM_Hours] = true;
+  else
+    memset (&ts->hours[0], true, NUM_Hours);
+
+  ts->secs[0] = true;
+  memset (&ts->dom[1], true, NUM_DoM - 1);
+  memset (&ts->month[1], true, NUM_Month - 1);
+  memset (&ts->dow[0], true, NUM_DoW);
+}
+
+static double
+benchNow (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool
+benchDrain (Scheduler *sched, time_t *order, size_t num_jobs)
+{
+  bool same = true;
+  for (size_t i = 0; i < num_jobs; i++)
+    {
+      EventNotice *evt = schedulerRemoveMin (sched);
+      if (evt == NULL)
+        return false;
+      if (order[i] == TIME_UNSPEC)
+        order[i] = evt->time;
+      else if (order[i] != evt->time)
+        same = false;
+    }
+
+  return same && schedulerRemoveMin (sched) == NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t max_jobs = argc > 1 ? strtoul (argv[1], NULL, 10) : 1000000;
+  time_t start = (time (NULL) / 60 + 1) * 60;
+
+  Timeset *timesets = memAllocBlockSafe (BENCH_NUM_TIMESETS, sizeof (Timeset));
+  for (size_t i = 0; i < BENCH_NUM_TIMESETS; i++)
+    benchTimeset (&timesets[i], i + 1);
+
+  printf ("%10s %12s %12s %12s %10s\n", "jobs", "next ns/job", "insert s",
+          "bulk s", "same order");
+
+  for (size_t num_jobs = 10000; num_jobs <= max_jobs; num_jobs *= 10)
+    {
+      EventNotice *notices
+          = memAllocBlockSafe (num_jobs, sizeof (EventNotice));
+      EventNotice **evts
+          = memAllocBlockSafe (num_jobs, sizeof (EventNotice *));
+      time_t *order = memAllocBlockSafe (num_jobs, sizeof (time_t));
+      for (size_t i = 0; i < num_jobs; i++)
+        order[i] = TIME_UNSPEC;
+
+      double begin = benchNow ();
+      for (size_t i = 0; i < num_jobs; i++)
+        {
+          notices[i].time = timesetComputeNextOccurence (
+              &timesets[i % BENCH_NUM_TIMESETS], start);
+          notices[i].bucket_idx = -1;
+          evts[i] = &notices[i];
+        }
+      double next_ns = (benchNow () - begin) / num_jobs * 1e9;
+
+      Scheduler *sched = schedulerNew ();
+      begin = benchNow ();
+      for (size_t i = 0; i < num_jobs; i++)
+        schedulerInsert (sched, evts[i]);
+      double insert_elapsed = benchNow () - begin;
+      bool same = benchDrain (sched, order, num_jobs);
+      schedulerDelete (sched);
+
+      sched = schedulerNew ();
+      begin = benchNow ();
+      schedulerBulkLoad (sched, evts, num_jobs);
+      double bulk_elapsed = benchNow () - begin;
+      same = benchDrain (sched, order, num_jobs) && same;
+      schedulerDelete (sched);
+
+      printf ("%10zu %12.1f %12.3f %12.3f %10s\n", num_jobs, next_ns,
+              insert_elapsed, bulk_elapsed, same ? "yes" : "NO");
+      fflush (stdout);
+
+      memDeallocSafe (order);
+      memDeallocSafe (evts);
+      memDeallocSafe (notices);
+    }
+
+  memDeallocSafe (timesets);
+  return EXIT_SUCCESS;
+}
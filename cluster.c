@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+static Cluster *CLUSTER = NULL;
+static pthread_once_t CLUSTER_ONCE = PTHREAD_ONCE_INIT;
+
+static uint64_t
+clusterHash (uint64_t hash, const void *data, size_t data_len)
+{
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < data_len; i++)
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+static uint64_t
+clusterMix (uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static void
+clusterAddMember (Cluster *cl, const char *name, size_t name_len,
+                  size_t *max_members)
+{
+  if (cl->num_members == *max_members)
+    {
+      size_t old_max = *max_members;
+      *max_members = old_max > 0 ? old_max << 1 : NLIM;
+      cl->members = cl->members == NULL
+                        ? memAllocBlockSafe (*max_members, sizeof (uint64_t))
+                        : memReallocSafe (cl->members, old_max,
+                                          *max_members, sizeof (uint64_t));
+    }
+
+  cl->members[cl->num_members++]
+      = clusterHash (0xcbf29ce484222325ULL, name, name_len);
+}
+
+static void
+clusterLoad (Cluster *cl)
+{
+  size_t max_members = 0;
+  memDeallocSafe (cl->members);
+  cl->members = NULL;
+  cl->num_members = 0;
+
+  /* The list may be switched between a file and a directory at any time.  */
+  struct stat st = { 0 };
+  cl->is_dir = stat (CLUSTER_MEMBERS, &st) == 0 && S_ISDIR (st.st_mode);
+  if (cl->is_dir)
+    {
+      DIR *dir = opendir (CLUSTER_MEMBERS);
+      if (dir == NULL)
+        return;
+
+      struct dirent *entry;
+      while ((entry = readdir (dir)) != NULL)
+        if (entry->d_name[0] != '.')
+          clusterAddMember (cl, entry->d_name, strlen (entry->d_name),
+                            &max_members);
+
+      closedir (dir);
+      return;
+    }
+
+  FILE *fstream = fopen (CLUSTER_MEMBERS, "r");
+  if (fstream == NULL)
+    return;
+
+  char *ln = NULL;
+  size_t ln_len = 0;
+  while (getline (&ln, &ln_len, fstream) > 0)
+    {
+      const char *name = ln;
+      SKIP_Whitespace (name);
+      size_t name_len = strcspn (name, " \t\r\n#");
+      if (name_len > 0)
+        clusterAddMember (cl, name, name_len, &max_members);
+    }
+
+  memDeallocSafe (ln);
+  fclose (fstream);
+}
+
+static void
+clusterStart (void)
+{
+  Cluster *cl = memAllocSafe (sizeof (Cluster));
+  cl->members = NULL;
+  cl->num_members = 0;
+  memset (&cl->self[0], 0, sizeof (cl->self));
+  memset (&cl->watch_dir[0], 0, sizeof (cl->watch_dir));
+
+  const char *node = getenv ("CLUSTER_NODE");
+  if (node != NULL)
+    strncpy (&cl->self[0], node, HOST_NAME_MAX);
+  else if (gethostname (&cl->self[0], HOST_NAME_MAX) < 0)
+    _err_out ("gethostname");
+  cl->self_hash
+      = clusterHash (0xcbf29ce484222325ULL, &cl->self[0], strlen (cl->self));
+
+  const char *name = strrchr (CLUSTER_MEMBERS, '/') + 1;
+  strncpy (&cl->watch_dir[0], CLUSTER_MEMBERS, name - CLUSTER_MEMBERS);
+  cl->watch_only = name;
+  snprintf (&cl->members_dir[0], PATH_MAX, "%s/", CLUSTER_MEMBERS);
+
+  clusterLoad (cl);
+  CLUSTER = cl;
+}
+
+Cluster *
+clusterGet (void)
+{
+  pthread_once (&CLUSTER_ONCE, clusterStart);
+  return CLUSTER;
+}
+
+bool
+clusterOwns (Cluster *cl, CronJob *cj)
+{
+  if (!cj->cluster_once || cl->num_members == 0)
+    return true;
+
+  uint64_t key = clusterHash (0xcbf29ce484222325ULL, &cj->tab->path[0],
+                              strlen (cj->tab->path));
+  key = clusterHash (key, cj->command, cj->command_len);
+
+  uint64_t best_member = 0, best_score = 0;
+  for (size_t i = 0; i < cl->num_members; i++)
+    {
+      uint64_t score = clusterMix (cl->members[i] ^ key);
+      if (i == 0 || score > best_score
+          || (score == best_score && cl->members[i] > best_member))
+        {
+          best_score = score;
+          best_member = cl->members[i];
+        }
+    }
+
+  return best_member == cl->self_hash;
+}
+
+void
+clusterAssignTab (Cluster *cl, CronTab *ct)
+{
+  for (size_t idx = 0; idx < ct->store.num_jobs; idx++)
+    {
+      CronJob *cj = &ct->store.jobs[idx];
+      atomic_store (&cj->owned, clusterOwns (cl, cj));
+    }
+}
+
+bool
+clusterIsMembership (Cluster *cl, const char *path)
+{
+  return !strcmp (path, CLUSTER_MEMBERS)
+         || !strncmp (path, &cl->members_dir[0], strlen (cl->members_dir));
+}
+
+void
+clusterReload (Cluster *cl, TabSet *set)
+{
+  clusterLoad (cl);
+  for (size_t i = 0; i < set->num_tabs; i++)
+    clusterAssignTab (cl, set->tabs[i]);
+}
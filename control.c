@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+Control *
+controlNew (Reloader *rld)
+{
+  Control *ctl = memAllocSafe (sizeof (Control));
+  ctl->num_clients = 0;
+  ctl->rld = rld;
+  ctl->rcu = rcuRegister (rld);
+
+  char path[PATH_MAX + 1];
+  const char *sock_path = _instance_path (CONTROL_SOCKET, &path[0]);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy (&addr.sun_path[0], sock_path, sizeof (addr.sun_path) - 1);
+
+  ctl->listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC
+                                        | SOCK_NONBLOCK, 0);
+  if (ctl->listen_fd < 0)
+    _err_out ("socket");
+
+  unlink (sock_path);
+  if (bind (ctl->listen_fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    _err_out ("bind");
+  chmod (sock_path, 0600);
+  if (listen (ctl->listen_fd, CONTROL_MAX_CLIENTS) < 0)
+    _err_out ("listen");
+
+  return ctl;
+}
+
+void
+controlDelete (Control *ctl)
+{
+  for (size_t i = 0; i < ctl->num_clients; i++)
+    close (ctl->clients[i].fd);
+
+  char path[PATH_MAX + 1];
+  close (ctl->listen_fd);
+  unlink (_instance_path (CONTROL_SOCKET, &path[0]));
+  memDeallocSafe (ctl);
+}
+
+static bool
+controlParseId (TabSet *set, const char *arg, CronTab **ctp, CronJob **cjp)
+{
+  char *endptr = NULL;
+  unsigned long tab_idx = strtoul (arg, &endptr, 10);
+
+  if (endptr == arg || tab_idx >= set->num_tabs)
+    return false;
+
+  *ctp = set->tabs[tab_idx];
+  *cjp = NULL;
+
+  if (*endptr == '\0')
+    return true;
+  if (*endptr != '.')
+    return false;
+
+  const char *jobarg = endptr + 1;
+  unsigned long job_idx = strtoul (jobarg, &endptr, 10);
+  if (endptr == jobarg || *endptr != '\0'
+      || job_idx >= (*ctp)->store.num_jobs)
+    return false;
+
+  *cjp = &(*ctp)->store.jobs[job_idx];
+  return true;
+}
+
+static void
+controlListTabs (TabSet *set, FILE *resp)
+{
+  for (size_t i = 0; i < set->num_tabs; i++)
+    fprintf (resp, "%zu %s %s jobs=%zu paused=%d\n", i, &set->tabs[i]->path[0],
+             &set->tabs[i]->user[0], set->tabs[i]->store.num_jobs,
+             atomic_load (&set->tabs[i]->paused));
+}
+
+static void
+controlListJobs (CronTab *ct, size_t tab_idx, FILE *resp)
+{
+  JobStore *store = &ct->store;
+  for (size_t i = 0; i < store->num_jobs; i++)
+    {
+      CronJob *cj = &store->jobs[i];
+      fprintf (resp, "%zu.%zu next=%ld pid=%d paused=%d label=%s %.*s\n",
+               tab_idx, i, (long)scheduleNextFire (store->schedules[i]),
+               store->pids[i], atomic_load (&store->paused[i]),
+               cj->label != NULL ? cj->label : "-", (int)cj->command_len,
+               cj->command);
+    }
+}
+
+static void
+controlNextTimes (CronJob *cj, size_t num_next, FILE *resp)
+{
+  Schedule *sc = _job_schedule (cj);
+  time_t next_time = scheduleNextFire (sc);
+  if (next_time == TIME_UNSPEC)
+    next_time = timesetComputeNextOccurence (&sc->timeset, time (NULL));
+  for (size_t i = 0; i < num_next && next_time != TIME_UNSPEC; i++)
+    {
+      fprintf (resp, "%ld\n", (long)next_time);
+      next_time = timesetComputeNextOccurence (&sc->timeset, next_time + 1);
+    }
+}
+
+static void
+controlHandleRequest (Control *ctl, int client_fd, char *req, FILE *resp)
+{
+  char *saveptr = NULL;
+  char *verb = strtok_r (req, " \t", &saveptr);
+  char *arg = strtok_r (NULL, " \t", &saveptr);
+  char *count = strtok_r (NULL, " \t", &saveptr);
+  CronTab *ct = NULL;
+  CronJob *cj = NULL;
+
+  if (verb == NULL)
+    {
+      fputs ("err empty request\n", resp);
+      return;
+    }
+
+  TabSet *set = atomic_load (&ctl->rld->current);
+
+  if (!strcmp (verb, "tabs"))
+    controlListTabs (set, resp);
+  else if (!strcmp (verb, "stats"))
+    {
+      shardsetReport (shardsetGet (), resp);
+      rebootReport (resp);
+    }
+  else if (!strcmp (verb, "reexec"))
+    {
+      handoffExec (set, client_fd);
+      fputs ("err reexec failed\n", resp);
+      return;
+    }
+  else if (arg == NULL || !controlParseId (set, arg, &ct, &cj))
+    {
+      fputs ("err bad id\n", resp);
+      return;
+    }
+  else if (!strcmp (verb, "jobs") && cj == NULL)
+    controlListJobs (ct, strtoul (arg, NULL, 10), resp);
+  else if (!strcmp (verb, "next") && cj != NULL)
+    {
+      size_t num_next = count != NULL ? strtoul (count, NULL, 10) : 1;
+      if (num_next > CONTROL_MAX_NEXT)
+        num_next = CONTROL_MAX_NEXT;
+      controlNextTimes (cj, num_next, resp);
+    }
+  else if (!strcmp (verb, "run") && cj != NULL)
+    schedulerPost (ct->sched, cj, true);
+  else if (!strcmp (verb, "pause"))
+    atomic_store (cj != NULL ? _job_paused (cj) : &ct->paused, true);
+  else if (!strcmp (verb, "resume"))
+    atomic_store (cj != NULL ? _job_paused (cj) : &ct->paused, false);
+  else
+    {
+      fputs ("err unknown request\n", resp);
+      return;
+    }
+
+  fputs ("ok\n", resp);
+}
+
+static bool
+controlServeClient (Control *ctl, struct ControlClient *cl)
+{
+  ssize_t n_read = recv (cl->fd, &cl->buf[cl->buf_len],
+                         sizeof (cl->buf) - cl->buf_len - 1, MSG_DONTWAIT);
+  if (n_read == 0 || (n_read < 0 && errno != EAGAIN && errno != EINTR))
+    return false;
+  if (n_read < 0)
+    return true;
+
+  cl->buf_len += n_read;
+  cl->buf[cl->buf_len] = '\0';
+
+  char *ln = &cl->buf[0], *eol = NULL;
+  while ((eol = memchr (ln, '\n', &cl->buf[cl->buf_len] - ln)) != NULL)
+    {
+      *eol = '\0';
+      if (eol > ln && eol[-1] == '\r')
+        eol[-1] = '\0';
+
+      char *respbuf = NULL;
+      size_t resp_len = 0;
+      FILE *resp = open_memstream (&respbuf, &resp_len);
+      controlHandleRequest (ctl, cl->fd, ln, resp);
+      fclose (resp);
+
+      bool sent = send (cl->fd, respbuf, resp_len, MSG_NOSIGNAL | MSG_DONTWAIT)
+                  == (ssize_t)resp_len;
+      memDeallocSafe (respbuf);
+      if (!sent)
+        return false;
+
+      ln = eol + 1;
+    }
+
+  cl->buf_len = &cl->buf[cl->buf_len] - ln;
+  memmove (&cl->buf[0], ln, cl->buf_len);
+
+  return cl->buf_len < sizeof (cl->buf) - 1;
+}
+
+void
+controlServe (Control *ctl)
+{
+  struct pollfd pfds[CONTROL_MAX_CLIENTS + 1];
+
+  while (true)
+    {
+      pfds[0] = (struct pollfd){ .fd = ctl->listen_fd, .events = POLLIN };
+      for (size_t i = 0; i < ctl->num_clients; i++)
+        pfds[i + 1]
+            = (struct pollfd){ .fd = ctl->clients[i].fd, .events = POLLIN };
+
+      rcuOffline (ctl->rcu);
+      int n_ready = poll (&pfds[0], ctl->num_clients + 1, -1);
+      rcuOnline (ctl->rcu);
+
+      if (n_ready < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          _err_out ("poll");
+        }
+
+      for (size_t i = ctl->num_clients; i > 0; i--)
+        {
+          if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+          struct ControlClient *cl = &ctl->clients[i - 1];
+          if (!controlServeClient (ctl, cl))
+            {
+              close (cl->fd);
+              *cl = ctl->clients[--ctl->num_clients];
+            }
+        }
+
+      if (pfds[0].revents & POLLIN)
+        {
+          int cfd = accept4 (ctl->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+          if (cfd < 0)
+            continue;
+          if (ctl->num_clients == CONTROL_MAX_CLIENTS)
+            {
+              close (cfd);
+              continue;
+            }
+
+          ctl->clients[ctl->num_clients].fd = cfd;
+          ctl->clients[ctl->num_clients].buf_len = 0;
+          ctl->num_clients++;
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lykron.h"
+
+static inline DueWord *
+duesetColumn (DueSet *ds, size_t col)
+{
+  return &ds->columns[col * ds->num_words];
+}
+
+static inline void
+duesetSetBit (DueSet *ds, size_t col, size_t bit, bool value)
+{
+  uint64_t *lanes = (uint64_t *)duesetColumn (ds, col);
+  uint64_t mask = 1ULL << (bit & 63);
+
+  if (value)
+    lanes[bit >> 6] |= mask;
+  else
+    lanes[bit >> 6] &= ~mask;
+}
+
+static inline bool
+duesetGetBit (DueSet *ds, size_t col, size_t bit)
+{
+  uint64_t *lanes = (uint64_t *)duesetColumn (ds, col);
+  return (lanes[bit >> 6] >> (bit & 63)) & 1;
+}
+
+DueSet *
+duesetNew (void)
+{
+  DueSet *ds = memAllocSafe (sizeof (DueSet));
+  ds->columns = NULL;
+  ds->num_words = 0;
+  ds->schedules = NULL;
+  ds->due = NULL;
+  ds->num_schedules = 0;
+  ds->secs_mask = 0;
+  ds->last_tick = time (NULL);
+  return ds;
+}
+
+void
+duesetDelete (DueSet *ds)
+{
+  for (size_t i = 0; i < ds->num_schedules; i++)
+    ds->schedules[i]->due_bit = -1;
+
+  memDeallocSafe (ds->columns);
+  memDeallocSafe (ds->schedules);
+  memDeallocSafe (ds->due);
+  memDeallocSafe (ds);
+}
+
+static void
+duesetGrow (DueSet *ds)
+{
+  size_t old_words = ds->num_words;
+  size_t new_words = old_words > 0 ? old_words << 1 : 1;
+  size_t col_len = new_words * sizeof (DueWord);
+
+  DueWord *columns
+      = aligned_alloc (DUESET_VECTOR_BYTES, DUECOL_NumColumns * col_len);
+  if (columns == NULL)
+    _err_out ("aligned_alloc");
+  memset (columns, 0, DUECOL_NumColumns * col_len);
+
+  for (size_t col = 0; col < DUECOL_NumColumns && old_words > 0; col++)
+    memCopySafe (&columns[col * new_words], duesetColumn (ds, col),
+                 old_words * sizeof (DueWord));
+
+  memDeallocSafe (ds->columns);
+  ds->columns = columns;
+
+  size_t old_bits = old_words * DUESET_WORD_BITS;
+  size_t new_bits = new_words * DUESET_WORD_BITS;
+  if (ds->schedules == NULL)
+    {
+      ds->schedules = memAllocBlockSafe (new_bits, sizeof (Schedule *));
+      ds->due = memAllocBlockSafe (new_bits, sizeof (Schedule *));
+    }
+  else
+    {
+      ds->schedules = memReallocSafe (ds->schedules, old_bits, new_bits,
+                                      sizeof (Schedule *));
+      ds->due = memReallocSafe (ds->due, old_bits, new_bits,
+                                sizeof (Schedule *));
+    }
+
+  ds->num_words = new_words;
+}
+
+static void
+duesetUpdateSecs (DueSet *ds)
+{
+  ds->secs_mask = 0;
+  for (size_t sec = 0; sec < NUM_Secs; sec++)
+    {
+      DueWord *col = duesetColumn (ds, DUECOL_Secs + sec);
+      for (size_t w = 0; w < ds->num_words; w++)
+        for (size_t lane = 0; lane < DUESET_WORD_LANES; lane++)
+          if (col[w][lane] != 0)
+            {
+              ds->secs_mask |= 1ULL << sec;
+              w = ds->num_words;
+              break;
+            }
+    }
+}
+
+void
+duesetAdd (DueSet *ds, Schedule *sc)
+{
+  if (ds->num_schedules == ds->num_words * DUESET_WORD_BITS)
+    duesetGrow (ds);
+
+  size_t bit = ds->num_schedules++;
+  Timeset *ts = &sc->timeset;
+  ds->schedules[bit] = sc;
+  sc->due_bit = bit;
+
+  /* duesetCollect ORs the day columns.  When one day field is '*', only
+     the other may match, as in timesetComputeNextOccurence.  */
+  bool dom_star = memchr (&ts->dom[1], false, NUM_DoM - 1) == NULL;
+  bool dow_star = memchr (&ts->dow[0], false, NUM_DoW - 1) == NULL;
+  bool use_dom = !dom_star || dow_star;
+  bool use_dow = !dow_star || dom_star;
+
+  for (size_t i = 0; i < NUM_Secs; i++)
+    duesetSetBit (ds, DUECOL_Secs + i, bit, ts->secs[i]);
+  for (size_t i = 0; i < NUM_Mins; i++)
+    duesetSetBit (ds, DUECOL_Mins + i, bit, ts->mins[i]);
+  for (size_t i = 0; i < NUM_Hours; i++)
+    duesetSetBit (ds, DUECOL_Hours + i, bit, ts->hours[i]);
+  for (size_t i = 0; i < NUM_DoM; i++)
+    duesetSetBit (ds, DUECOL_DoM + i, bit, use_dom && ts->dom[i]);
+  for (size_t i = 0; i < NUM_Month; i++)
+    duesetSetBit (ds, DUECOL_Month + i, bit, ts->month[i]);
+  for (size_t i = 0; i < NUM_DoW; i++)
+    duesetSetBit (ds, DUECOL_DoW + i, bit, use_dow && ts->dow[i]);
+  duesetSetBit (ds, DUECOL_DoW, bit, use_dow && (ts->dow[0] || ts->dow[7]));
+
+  for (size_t i = 0; i < NUM_Secs; i++)
+    if (ts->secs[i])
+      ds->secs_mask |= 1ULL << i;
+}
+
+void
+duesetRemove (DueSet *ds, Schedule *sc)
+{
+  size_t bit = sc->due_bit;
+  size_t last = --ds->num_schedules;
+
+  for (size_t col = 0; col < DUECOL_NumColumns; col++)
+    {
+      duesetSetBit (ds, col, bit, duesetGetBit (ds, col, last));
+      duesetSetBit (ds, col, last, false);
+    }
+
+  ds->schedules[bit] = ds->schedules[last];
+  ds->schedules[bit]->due_bit = bit;
+  sc->due_bit = -1;
+
+  duesetUpdateSecs (ds);
+}
+
+time_t
+duesetNextTick (DueSet *ds)
+{
+  if (ds->secs_mask == 0)
+    return TIME_UNSPEC;
+
+  time_t tick = ds->last_tick + 1;
+  while (!((ds->secs_mask >> (tick % NUM_Secs)) & 1))
+    tick++;
+
+  return tick;
+}
+
+size_t
+duesetCollect (DueSet *ds, time_t tick)
+{
+  struct tm tm;
+  localtime_r (&tick, &tm);
+
+  const DueWord *secs = duesetColumn (ds, DUECOL_Secs + tm.tm_sec % NUM_Secs);
+  const DueWord *mins = duesetColumn (ds, DUECOL_Mins + tm.tm_min);
+  const DueWord *hours = duesetColumn (ds, DUECOL_Hours + tm.tm_hour);
+  const DueWord *dom = duesetColumn (ds, DUECOL_DoM + tm.tm_mday);
+  const DueWord *month = duesetColumn (ds, DUECOL_Month + tm.tm_mon + 1);
+  const DueWord *dow = duesetColumn (ds, DUECOL_DoW + tm.tm_wday);
+  size_t num_due = 0;
+
+  for (size_t w = 0; w < ds->num_words; w++)
+    {
+      DueWord hit = secs[w] & mins[w] & hours[w] & month[w]
+                    & (dom[w] | dow[w]);
+
+      for (size_t lane = 0; lane < DUESET_WORD_LANES; lane++)
+        for (uint64_t bits = hit[lane]; bits != 0; bits &= bits - 1)
+          {
+            size_t bit = w * DUESET_WORD_BITS + lane * 64
+                         + __builtin_ctzll (bits);
+            ds->due[num_due++] = ds->schedules[bit];
+          }
+    }
+
+  return num_due;
+}
@@ -0,0 +1,43 @@
+/* clang -g -O1 -fsanitize=fuzzer,address -I.
+      fuzz/parser_fuzz.c cluster.c control.c dueset.c handoff.c job.c
+      logger.c mail.c parser.c reboot.c scheduler.c spawner.c status.c tab.c
+      -lpthread -lz
+   ./a.out -timeout=1 -max_len=4096 corpus/  */
+#define _GNU_SOURCE
+#include <pwd.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+  static struct passwd *pwd = NULL;
+  if (pwd == NULL)
+    pwd = getpwuid (getuid ());
+
+  if (size == 0)
+    return 0;
+
+  FILE *fstream = fmemopen ((void *)&data[1], size - 1, "r");
+  if (fstream == NULL)
+    return 0;
+
+  CronTab *volatile ct
+      = crontabNewDetached ("/dev/null", pwd->pw_name, data[0] & 1);
+  jmp_buf env;
+
+  SYNTAX_ERR_JMP = &env;
+  if (setjmp (env) == 0)
+    parserParseStream (ct, fstream);
+  SYNTAX_ERR_JMP = NULL;
+
+  fclose (fstream);
+  crontabDelete (ct);
+
+  return 0;
+}
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+static Handoff *HANDOFF = NULL;
+static pthread_once_t HANDOFF_ONCE = PTHREAD_ONCE_INIT;
+
+static uint64_t
+handoffHashCommand (const CronJob *cj)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < cj->command_len; i++)
+    hash = (hash ^ cj->command[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+static void
+handoffFillJob (HandoffJob *hj, const CronJob *cj)
+{
+  memset (hj, 0, sizeof (HandoffJob));
+  strncpy (&hj->path[0], &cj->tab->path[0], PATH_MAX);
+  hj->idx = cj->idx;
+  hj->hash = handoffHashCommand (cj);
+  hj->next_fire = TIME_UNSPEC;
+}
+
+static int
+handoffCompareJobs (const void *a, const void *b)
+{
+  const HandoffJob *ja = a, *jb = b;
+  int cmp = strcmp (&ja->path[0], &jb->path[0]);
+  if (cmp != 0)
+    return cmp;
+  return (ja->idx > jb->idx) - (ja->idx < jb->idx);
+}
+
+static bool
+handoffWrite (int fd, const void *buf, size_t len)
+{
+  const char *ptr = buf;
+  while (len > 0)
+    {
+      ssize_t n_written = write (fd, ptr, len);
+      if (n_written < 0 && errno == EINTR)
+        continue;
+      if (n_written <= 0)
+        return false;
+      ptr += n_written;
+      len -= n_written;
+    }
+  return true;
+}
+
+static void
+handoffLoad (void)
+{
+  const char *fdstr = getenv (HANDOFF_ENV);
+  if (fdstr == NULL)
+    return;
+
+  int fd = atoi (fdstr);
+  unsetenv (HANDOFF_ENV);
+
+  struct stat st = { 0 };
+  if (fstat (fd, &st) < 0 || (size_t)st.st_size < sizeof (HandoffHeader))
+    {
+      close (fd);
+      return;
+    }
+
+  void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return;
+
+  const HandoffHeader *hdr = map;
+  size_t jobs_len = (size_t)hdr->num_jobs * sizeof (HandoffJob);
+  size_t children_len = (size_t)hdr->num_children * sizeof (HandoffChild);
+  if (hdr->magic != HANDOFF_MAGIC || hdr->version != HANDOFF_VERSION
+      || sizeof (HandoffHeader) + jobs_len + children_len
+             != (size_t)st.st_size)
+    {
+      munmap (map, st.st_size);
+      return;
+    }
+
+  Handoff *ho = memAllocSafe (sizeof (Handoff));
+  ho->num_jobs = hdr->num_jobs;
+  ho->num_children = hdr->num_children;
+  ho->written = hdr->written;
+  ho->reply_fd = hdr->reply_fd;
+  ho->jobs = memAllocBlockSafe (ho->num_jobs + 1, sizeof (HandoffJob));
+  ho->children
+      = memAllocBlockSafe (ho->num_children + 1, sizeof (HandoffChild));
+  memCopySafe (ho->jobs, &hdr[1], jobs_len);
+  memCopySafe (ho->children, (const char *)&hdr[1] + jobs_len,
+               children_len);
+  munmap (map, st.st_size);
+
+  qsort (ho->jobs, ho->num_jobs, sizeof (HandoffJob), handoffCompareJobs);
+  if (ho->reply_fd >= 0)
+    fcntl (ho->reply_fd, F_SETFD, FD_CLOEXEC);
+  HANDOFF = ho;
+}
+
+Handoff *
+handoffGet (void)
+{
+  pthread_once (&HANDOFF_ONCE, handoffLoad);
+  return HANDOFF;
+}
+
+time_t
+handoffNextFire (CronJob *cj)
+{
+  Handoff *ho = handoffGet ();
+  if (ho == NULL)
+    return TIME_UNSPEC;
+
+  HandoffJob key;
+  handoffFillJob (&key, cj);
+  HandoffJob *hj = bsearch (&key, ho->jobs, ho->num_jobs, sizeof (HandoffJob),
+                            handoffCompareJobs);
+  if (hj == NULL || hj->hash != key.hash)
+    return TIME_UNSPEC;
+
+  time_t next_fire = hj->next_fire;
+  hj->next_fire = TIME_UNSPEC;
+  return next_fire;
+}
+
+static CronJob *
+handoffFindJob (TabSet *set, const HandoffJob *hj)
+{
+  for (size_t i = 0; i < set->num_tabs; i++)
+    {
+      CronTab *ct = set->tabs[i];
+      if (strcmp (&ct->path[0], &hj->path[0]) || hj->idx >= ct->store.num_jobs)
+        continue;
+
+      CronJob *cj = &ct->store.jobs[hj->idx];
+      return handoffHashCommand (cj) == hj->hash ? cj : NULL;
+    }
+
+  return NULL;
+}
+
+void
+handoffAdoptChildren (TabSet *set)
+{
+  Handoff *ho = handoffGet ();
+  if (ho == NULL)
+    return;
+
+  for (size_t i = 0; i < ho->num_children; i++)
+    {
+      HandoffChild *hc = &ho->children[i];
+      CronJob *cj = handoffFindJob (set, &hc->job);
+      siginfo_t info = { 0 };
+
+      if (cj == NULL
+          || waitid (P_PID, hc->pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0)
+        {
+          close (hc->out_fd);
+          close (hc->err_fd);
+          continue;
+        }
+
+      fcntl (hc->out_fd, F_SETFD, FD_CLOEXEC);
+      fcntl (hc->err_fd, F_SETFD, FD_CLOEXEC);
+
+      atomic_fetch_add (&cj->tab->refs, 1);
+      *_job_pid (cj) = hc->pid;
+      statusAcquire (cj);
+      statusRecordStart (cj, hc->pid);
+
+      struct Child child = { .pid = hc->pid, .job = cj, .out_fd = hc->out_fd,
+                             .err_fd = hc->err_fd };
+      childtblAdopt (cj->logger->children, &child);
+    }
+
+  ho->num_children = 0;
+
+  ChildTable *ctbl = childtblGet ();
+  if (ctbl != NULL)
+    atomic_store (&ctbl->adopting, false);
+
+  /* The client that asked for the re-exec gets its reply from this image,
+     once the state has been taken over.  */
+  if (ho->reply_fd >= 0)
+    {
+      send (ho->reply_fd, "ok\n", 3, MSG_NOSIGNAL | MSG_DONTWAIT);
+      close (ho->reply_fd);
+      ho->reply_fd = -1;
+    }
+}
+
+static char **
+handoffReadCmdline (char **buf_out)
+{
+  int fd = open ("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  size_t buf_max = MAX_BUF, buf_len = 0;
+  char *buf = memAllocBlockSafe (buf_max + 1, sizeof (char));
+  ssize_t n_read;
+  while ((n_read = read (fd, &buf[buf_len], buf_max - buf_len)) > 0)
+    {
+      buf_len += n_read;
+      if (buf_len < buf_max)
+        continue;
+      buf = memReallocSafe (buf, buf_max + 1, (buf_max << 1) + 1,
+                            sizeof (char));
+      buf_max <<= 1;
+    }
+  close (fd);
+  if (n_read < 0 || buf_len == 0)
+    {
+      memDeallocSafe (buf);
+      return NULL;
+    }
+
+  size_t argc = 0, max_argc = ARGC_DFL;
+  char **argv = memAllocBlockSafe (max_argc + 1, sizeof (char *));
+  for (char *arg = buf; arg < &buf[buf_len]; arg += strlen (arg) + 1)
+    {
+      if (argc == max_argc)
+        {
+          argv = memReallocSafe (argv, max_argc + 1, (max_argc << 1) + 1,
+                                 sizeof (char *));
+          max_argc <<= 1;
+        }
+      argv[argc++] = arg;
+    }
+  argv[argc] = NULL;
+
+  *buf_out = buf;
+  return argv;
+}
+
+static bool
+handoffReadExe (char *exe)
+{
+  ssize_t exe_len = readlink ("/proc/self/exe", exe, PATH_MAX);
+  if (exe_len <= 0)
+    return false;
+  exe[exe_len] = '\0';
+
+  static const char deleted[] = " (deleted)";
+  size_t suffix_len = sizeof (deleted) - 1;
+  if ((size_t)exe_len > suffix_len
+      && !strcmp (&exe[exe_len - suffix_len], deleted))
+    exe[exe_len - suffix_len] = '\0';
+
+  return true;
+}
+
+static bool
+handoffWriteState (int fd, TabSet *set, ChildTable *ctbl, int reply_fd)
+{
+  HandoffHeader hdr = { .magic = HANDOFF_MAGIC, .version = HANDOFF_VERSION,
+                        .written = time (NULL), .reply_fd = reply_fd };
+  if (lseek (fd, sizeof (HandoffHeader), SEEK_SET) < 0)
+    return false;
+
+  for (size_t i = 0; i < set->num_tabs; i++)
+    {
+      JobStore *store = &set->tabs[i]->store;
+      for (size_t idx = 0; idx < store->num_jobs; idx++)
+        {
+          HandoffJob hj;
+          handoffFillJob (&hj, &store->jobs[idx]);
+          hj.next_fire = scheduleNextFire (store->schedules[idx]);
+          if (!handoffWrite (fd, &hj, sizeof (hj)))
+            return false;
+          hdr.num_jobs++;
+        }
+    }
+
+  for (size_t i = 0; i < ctbl->max_children; i++)
+    {
+      struct Child *child = &ctbl->children[i];
+      if (child->pid <= 0 || child->job == NULL)
+        continue;
+
+      HandoffChild hc = { .pid = child->pid, .out_fd = child->out_fd,
+                          .err_fd = child->err_fd };
+      handoffFillJob (&hc.job, child->job);
+      if (!handoffWrite (fd, &hc, sizeof (hc)))
+        return false;
+      hdr.num_children++;
+    }
+
+  return lseek (fd, 0, SEEK_SET) == 0
+         && handoffWrite (fd, &hdr, sizeof (hdr));
+}
+
+static void
+handoffSetInherit (ChildTable *ctbl, bool inherit)
+{
+  for (size_t i = 0; i < ctbl->max_children; i++)
+    if (ctbl->children[i].pid > 0 && ctbl->children[i].job != NULL)
+      {
+        fcntl (ctbl->children[i].out_fd, F_SETFD, inherit ? 0 : FD_CLOEXEC);
+        fcntl (ctbl->children[i].err_fd, F_SETFD, inherit ? 0 : FD_CLOEXEC);
+      }
+}
+
+bool
+handoffExec (TabSet *set, int reply_fd)
+{
+  char exe[PATH_MAX + 1] = { 0 };
+  char *cmdline = NULL;
+  char **argv = handoffReadCmdline (&cmdline);
+  if (argv == NULL)
+    return false;
+  if (!handoffReadExe (&exe[0]))
+    {
+      memDeallocSafe (cmdline);
+      memDeallocSafe (argv);
+      return false;
+    }
+
+  int fd = memfd_create ("lykron-handoff", 0);
+  if (fd < 0)
+    {
+      memDeallocSafe (cmdline);
+      memDeallocSafe (argv);
+      return false;
+    }
+
+  char fdstr[MAX_INTEGER + 1] = { 0 };
+  snprintf (&fdstr[0], MAX_INTEGER, "%d", fd);
+
+  ChildTable *ctbl = childtblGet ();
+  if (ctbl == NULL)
+    {
+      close (fd);
+      memDeallocSafe (cmdline);
+      memDeallocSafe (argv);
+      return false;
+    }
+
+  loggerQuiesce ();
+  pthread_mutex_lock (&ctbl->lock);
+
+  if (handoffWriteState (fd, set, ctbl, reply_fd))
+    {
+      handoffSetInherit (ctbl, true);
+      fcntl (reply_fd, F_SETFD, 0);
+      setenv (HANDOFF_ENV, &fdstr[0], 1);
+      execv (&exe[0], argv);
+      unsetenv (HANDOFF_ENV);
+      fcntl (reply_fd, F_SETFD, FD_CLOEXEC);
+      handoffSetInherit (ctbl, false);
+    }
+
+  pthread_mutex_unlock (&ctbl->lock);
+  loggerResume ();
+
+  close (fd);
+  memDeallocSafe (cmdline);
+  memDeallocSafe (argv);
+  return false;
+}
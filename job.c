@@ -1,4 +1,6 @@
 #include <pwd.h>
+#include <stddef.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -6,29 +8,205 @@
 
 #include "lykron.h"
 
+static bool
+timesetAnySet (const bool *slots, size_t num_slots)
+{
+  return memchr (slots, true, num_slots * sizeof (bool)) != NULL;
+}
+
+/* Moves *VALUE to the first set slot at or after it, if there is one.  */
+static bool
+timesetSeek (const bool *slots, int *value, int num_slots)
+{
+  for (int v = *value; v < num_slots; v++)
+    if (slots[v])
+      {
+        *value = v;
+        return true;
+      }
+  return false;
+}
+
+static bool
+timesetDayMatches (const Timeset *ts, const struct tm *tm, bool any_star)
+{
+  bool dom_ok = ts->dom[tm->tm_mday];
+  bool dow_ok = ts->dow[tm->tm_wday] || (tm->tm_wday == 0 && ts->dow[7]);
+  return any_star ? dom_ok && dow_ok : dom_ok || dow_ok;
+}
+
+/* The last local day looked at, per thread.  On a day without a UTC offset
+   change, breaking a time down and making one are plain arithmetic.  */
+static _Thread_local struct TimesetDay
+{
+  time_t start;
+  struct tm midnight;
+  bool uniform;
+} TIMESET_DAY = { .start = TIME_UNSPEC };
+
+static void
+timesetLocalTime (time_t t, struct tm *tm)
+{
+  struct TimesetDay *day = &TIMESET_DAY;
+  time_t offst = t - day->start;
+
+  if (day->start != TIME_UNSPEC && day->uniform && offst >= 0
+      && offst < 24 * 60 * 60)
+    {
+      *tm = day->midnight;
+      tm->tm_hour = offst / (60 * 60);
+      tm->tm_min = offst / 60 % 60;
+      tm->tm_sec = offst % 60;
+      return;
+    }
+
+  localtime_r (&t, tm);
+
+  struct tm midnight = *tm, last;
+  midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+  midnight.tm_isdst = -1;
+  time_t start = mktime (&midnight);
+  time_t last_t = start + 24 * 60 * 60 - 1;
+  localtime_r (&last_t, &last);
+
+  day->start = start;
+  day->midnight = midnight;
+  day->uniform = start != TIME_UNSPEC && midnight.tm_hour == 0
+                 && last.tm_mday == midnight.tm_mday && last.tm_hour == 23
+                 && last.tm_min == 59 && last.tm_sec == 59;
+}
+
+static time_t
+timesetMakeTime (struct tm *tm)
+{
+  struct TimesetDay *day = &TIMESET_DAY;
+  if (day->uniform && tm->tm_mday == day->midnight.tm_mday
+      && tm->tm_mon == day->midnight.tm_mon
+      && tm->tm_year == day->midnight.tm_year && tm->tm_hour < 24
+      && tm->tm_min < 60 && tm->tm_sec < 60)
+    return day->start + tm->tm_hour * 60 * 60 + tm->tm_min * 60 + tm->tm_sec;
+
+  tm->tm_isdst = -1;
+  return mktime (tm);
+}
+
 time_t
 timesetComputeNextOccurence (Timeset *ts, time_t now)
 {
+  if (ts->reboot)
+    return TIME_UNSPEC;
+
+  if (ts->every > 0)
+    return ((now + ts->every - 1) / ts->every) * ts->every;
+
+  /* @after and @onsuccess jobs leave every field empty and only run when
+     their parent exits; any other empty field also never matches.  */
+  if (!timesetAnySet (&ts->secs[0], NUM_Secs)
+      || !timesetAnySet (&ts->mins[0], NUM_Mins)
+      || !timesetAnySet (&ts->hours[0], NUM_Hours)
+      || !timesetAnySet (&ts->month[0], NUM_Month)
+      || !(timesetAnySet (&ts->dom[0], NUM_DoM)
+           || timesetAnySet (&ts->dow[0], NUM_DoW)))
+    return TIME_UNSPEC;
+
+  /* As in Vixie cron, a restricted day of month and a restricted day of week
+     widen each other; if either is '*', both must match.  */
+  bool dom_star = memchr (&ts->dom[1], false, NUM_DoM - 1) == NULL;
+  bool dow_star = memchr (&ts->dow[0], false, NUM_DoW - 1) == NULL;
+
   struct tm tm;
-  localtime_r (&now, &tm);
+  timesetLocalTime (now, &tm);
+  int last_year = tm.tm_year + 5;
 
-  for (size_t i = 0; i < 60 * 24 * 356 * 5; i++)
+  /* Each pass either accepts a field or moves it to its next matching
+     value, clearing the finer fields.  mktime carries into the coarser
+     ones only when a field wrapped or the day changed.  */
+  while (tm.tm_year <= last_year)
     {
-      time_t candidate = mktime (&tm);
-      if (candidate == TIME_UNSPEC)
-        break;
+      int mon = tm.tm_mon, hour = tm.tm_hour, minute = tm.tm_min;
+      int sec = tm.tm_sec;
+      bool carry = false;
 
-      int minute = tm.tm_min;
-      int hour = tm.tm_hour;
-      int mday = tm.tm_mday;
-      int mon = tm.tm_mon;
-      int wday = tm.tm_wday;
-
-      if (ts->mins[minute] && ts->hours[hour] && ts->month[mon]
-          && (ts->dom[mday] || ts->dow[wday]))
-        return candidate;
+      if (!timesetSeek (&ts->month[1], &mon, NUM_Month - 1))
+        {
+          tm.tm_year++;
+          tm.tm_mon = 0;
+          tm.tm_mday = 1;
+          tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+          carry = true;
+        }
+      else if (mon != tm.tm_mon)
+        {
+          tm.tm_mon = mon;
+          tm.tm_mday = 1;
+          tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+          carry = true;
+        }
+      else if (!timesetDayMatches (ts, &tm, dom_star || dow_star)
+               || !timesetSeek (&ts->hours[0], &hour, NUM_Hours))
+        {
+          tm.tm_mday++;
+          tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+          carry = true;
+        }
+      else if (hour != tm.tm_hour)
+        {
+          tm.tm_hour = hour;
+          tm.tm_min = tm.tm_sec = 0;
+        }
+      else if (!timesetSeek (&ts->mins[0], &minute, NUM_Mins))
+        {
+          tm.tm_hour++;
+          tm.tm_min = tm.tm_sec = 0;
+          carry = tm.tm_hour == NUM_Hours;
+        }
+      else if (minute != tm.tm_min)
+        {
+          tm.tm_min = minute;
+          tm.tm_sec = 0;
+        }
+      else if (!timesetSeek (&ts->secs[0], &sec, NUM_Secs))
+        {
+          tm.tm_min++;
+          tm.tm_sec = 0;
+          carry = tm.tm_min == NUM_Mins;
+        }
+      else
+        {
+          struct tm want = tm;
+          want.tm_sec = sec;
+          tm = want;
+
+          time_t candidate = timesetMakeTime (&tm);
+          if (candidate != TIME_UNSPEC && candidate < now)
+            {
+              /* The earlier of a repeated hour; take the later one.  */
+              tm = want;
+              tm.tm_isdst = 0;
+              candidate = mktime (&tm);
+            }
+          if (candidate == TIME_UNSPEC)
+            break;
+
+          /* Inside a skipped hour mktime moved the time forward; check the
+             moved fields again.  */
+          if (tm.tm_hour == want.tm_hour && tm.tm_min == want.tm_min
+              && candidate >= now)
+            return candidate;
+          if (candidate < now)
+            {
+              tm.tm_sec++;
+              carry = true;
+            }
+          continue;
+        }
 
-      tm.tm_min++;
+      if (carry)
+        {
+          tm.tm_isdst = -1;
+          if (mktime (&tm) == TIME_UNSPEC)
+            break;
+        }
     }
 
   return TIME_UNSPEC;
@@ -49,6 +227,8 @@ timesetGetFieldOffset (Timeset *ts, TimesetField field)
       return &ts->month[0];
     case TSFIELD_DoW:
       return &ts->dow[0];
+    case TSFIELD_Secs:
+      return &ts->secs[0];
     default:
       return NULL;
     }
@@ -56,18 +236,24 @@ timesetGetFieldOffset (Timeset *ts, TimesetField field)
 void
 timesetDoGlob (Timeset *ts, int step, TimesetField field)
 {
-  bool *field = timesetGetFieldOffset (ts, field);
+  bool *slots = timesetGetFieldOffset (ts, field);
+  int num_slots = TSFIELD_NUMS_LUT[field];
+
   if (step == -1)
-    memset (field, true, TSFIELD_NUMS_LUT[field] * sizeof (bool));
+    memset (slots, true, num_slots * sizeof (bool));
+  else if (step <= 0 || step >= num_slots)
+    _raise_syntax_err ("Step out of range", 0, 0);
   else
-    for (size_t i = 0; i < TSFIELD_NUMS_LUT[field], i += step)
-      field[i] = true;
+    for (int i = 0; i < num_slots; i += step)
+      slots[i] = true;
 }
 
 void
 timesetDoList (Timeset *ts, int *lst, size_t lstlen, TimesetField field)
 {
-  bool *field = timesetGetFieldOffset (ts, field);
+  bool *slots = timesetGetFieldOffset (ts, field);
+  int num_slots = TSFIELD_NUMS_LUT[field];
+
   for (size_t i = 0; i < lstlen; i++)
     {
       int elt = lst[i];
@@ -76,154 +262,313 @@ timesetDoList (Timeset *ts, int *lst, size_t lstlen, TimesetField field)
           int lower = RANGE_GetLower (elt);
           int upper = RANGE_GetUpper (elt);
 
-          if (upper - lower > TSFIELD_NUMS_LUT[field])
-            _err_out ("Field out of range");
+          if (lower > upper || upper >= num_slots)
+            _raise_syntax_err ("Range out of bounds", 0, 0);
 
-          memset (&field[lower], true, (upper - lower) * sizeof (bool));
+          memset (&slots[lower], true, (upper - lower + 1) * sizeof (bool));
         }
+      else if (elt < 0 || elt >= num_slots)
+        _raise_syntax_err ("Field out of range", 0, 0);
       else
-        field[elt] = true;
+        slots[elt] = true;
     }
 }
 
+void
+timesetDoEvery (Timeset *ts, time_t every)
+{
+  ts->every = every;
+}
+
 void
 timesetDoReboot (Timeset *ts)
 {
-  // TODO
+  ts->reboot = true;
+}
+
+static void
+timesetDoAt (Timeset *ts, int hour, int dom, int month, int dow)
+{
+  ts->secs[0] = true;
+  ts->mins[0] = true;
+
+  if (hour < 0)
+    memset (&ts->hours[0], true, NUM_Hours * sizeof (bool));
+  else
+    ts->hours[hour] = true;
+
+  if (dom < 0)
+    memset (&ts->dom[1], true, (NUM_DoM - 1) * sizeof (bool));
+  else
+    ts->dom[dom] = true;
+
+  if (month < 0)
+    memset (&ts->month[1], true, (NUM_Month - 1) * sizeof (bool));
+  else
+    ts->month[month] = true;
+
+  if (dow < 0)
+    memset (&ts->dow[0], true, NUM_DoW * sizeof (bool));
+  else
+    ts->dow[dow] = true;
 }
 
 void
 timesetDoYearly (Timeset *ts)
 {
-  ts->dom[1] = true;
-  ts->month[1] = true;
+  timesetDoAt (ts, 0, 1, 1, -1);
 }
 
 void
 timesetDoMonthly (Timeset *ts)
 {
-  ts->dom[1] = true;
+  timesetDoAt (ts, 0, 1, -1, -1);
 }
 
 void
 timesetDoWeekly (Timeset *ts)
 {
-  ts->mins[0] = true;
-  ts->hours[0] = true;
-  ts->dow[0] = true;
+  timesetDoAt (ts, 0, -1, -1, 0);
 }
 
 void
 timesetDoDaily (Timeset *ts)
 {
-  ts->mins[0] = true;
-  ts->hours[0] = true;
+  timesetDoAt (ts, 0, -1, -1, -1);
 }
 
 void
 timesetDoHourly (Timeset *ts)
 {
-  ts->mins[0] = true;
+  timesetDoAt (ts, -1, -1, -1, -1);
+}
+
+uint32_t
+timesetHash (const Timeset *ts)
+{
+  const uint8_t *bytes = (const uint8_t *)ts;
+  uint32_t hash = 0x811c9dc5u;
+
+  for (size_t i = 0; i < offsetof (Timeset, every); i++)
+    {
+      hash ^= bytes[i];
+      hash *= 0x01000193u;
+    }
+
+  hash ^= (uint32_t)ts->every ^ (uint32_t)((uint64_t)ts->every >> 32);
+  hash = (hash * 0x01000193u) ^ ts->reboot;
+  return hash * 0x01000193u;
+}
+
+bool
+timesetEqual (const Timeset *ts1, const Timeset *ts2)
+{
+  return ts1->every == ts2->every && ts1->reboot == ts2->reboot
+         && !memcmp (ts1, ts2, offsetof (Timeset, every));
+}
+
+void
+jobstoreInit (JobStore *store)
+{
+  store->jobs = memAllocBlockSafe (INIT_JOBSTORE_SIZE, sizeof (CronJob));
+  store->schedules
+      = memAllocBlockSafe (INIT_JOBSTORE_SIZE, sizeof (Schedule *));
+  store->pids = memAllocBlockSafe (INIT_JOBSTORE_SIZE, sizeof (pid_t));
+  store->paused = memAllocBlockSafe (INIT_JOBSTORE_SIZE, sizeof (atomic_bool));
+  store->first_fires
+      = memAllocBlockSafe (INIT_JOBSTORE_SIZE, sizeof (time_t));
+  store->num_jobs = 0;
+  store->max_jobs = INIT_JOBSTORE_SIZE;
+}
+
+static void
+jobstoreGrow (JobStore *store)
+{
+  size_t old_max_jobs = store->max_jobs;
+  store->max_jobs <<= 1;
+
+  store->jobs = memReallocSafe (store->jobs, old_max_jobs, store->max_jobs,
+                                sizeof (CronJob));
+  store->schedules = memReallocSafe (store->schedules, old_max_jobs,
+                                     store->max_jobs, sizeof (Schedule *));
+  store->pids = memReallocSafe (store->pids, old_max_jobs, store->max_jobs,
+                                sizeof (pid_t));
+  store->paused = memReallocSafe (store->paused, old_max_jobs,
+                                  store->max_jobs, sizeof (atomic_bool));
+  store->first_fires = memReallocSafe (store->first_fires, old_max_jobs,
+                                       store->max_jobs, sizeof (time_t));
 }
 
 CronJob *
-cronjobNew (Timeset *ts, const uint8_t *command, size_t command_len,
-            const char *user)
+jobstorePush (JobStore *store, SchedulePool *pool, Timeset *ts,
+              const char *command, size_t command_len, const char *user)
 {
-  CronJob *cj = memAllocSafe (sizeof (CronJob));
-  cj->command = strndup (command, command_len);
+  struct passwd *pwd = getpwnam (user);
+  if (pwd == NULL)
+    _raise_syntax_err ("Unknown user", 0, 0);
+
+  if (store->num_jobs == store->max_jobs)
+    jobstoreGrow (store);
+
+  size_t idx = store->num_jobs++;
+  CronJob *cj = &store->jobs[idx];
+  memset (cj, 0, sizeof (CronJob));
+  cj->idx = idx;
+  cj->command = (const uint8_t *)strndup (command, command_len);
   cj->command_len = command_len;
   cj->argv = NULL;
-  cj->next = NULL;
+  cj->output_cap = OUTPUT_CAP_DFL * 1024;
+  cj->num_truncated = 0;
+  cj->logger = NULL;
+  cj->tab = NULL;
+  cj->member_idx = 0;
 
-  memCopySafe (&cj->timeset, ts, sizeof (Timeset));
-  strncat (&cj->user[0], user, LOGIN_NAME_MAX);
+  strncat ((char *)&cj->user[0], user, LOGIN_NAME_MAX);
 
-  struct passwd *pwd = getpwnam (&cj->user[0]);
   cj->uid = pwd->pw_uid;
   cj->gid = pwd->pw_gid;
 
+  store->schedules[idx] = schedpoolIntern (pool, ts);
+  store->pids[idx] = 0;
+  atomic_init (&store->paused[idx], false);
+  store->first_fires[idx] = TIME_UNSPEC;
+
   return cj;
 }
 
+/* Fills in each job's next fire after NOW, so a shard taking the store
+   on need not compute it.  Jobs sharing a schedule share the result.  */
 void
-cronjobListDelete (CronJob *cj)
+jobstorePrepareFires (JobStore *store, time_t now)
 {
-  if (cj == NULL)
-    return;
+  Schedule *prev = NULL;
+  time_t next_time = TIME_UNSPEC;
 
-  CronJob *next = cj->next;
-
-  for (size_t i = 0; i < cj->argc; i++)
-    memDeallocSafe (cj->argv[i]);
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    {
+      Schedule *sc = store->schedules[idx];
+      if (sc != prev)
+        next_time = timesetComputeNextOccurence (&sc->timeset, now);
+      store->first_fires[idx] = next_time;
+      prev = sc;
+    }
+}
 
-  memDeallocSafe (cj->argv);
-  memDeallocSafe (cj->command);
-  memDeallocSafe (cj);
+void
+jobstoreDelete (JobStore *store)
+{
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    {
+      CronJob *cj = &store->jobs[idx];
+      for (size_t i = 0; i < cj->argc; i++)
+        memDeallocSafe (cj->argv[i]);
+
+      memDeallocSafe (cj->argv);
+      memDeallocSafe (cj->command);
+      memDeallocSafe (cj->cgroup.path);
+      memDeallocSafe (cj->cgroup.cpu_max);
+      memDeallocSafe (cj->cgroup.memory_max);
+      memDeallocSafe (cj->label);
+      memDeallocSafe (cj->after_label);
+      memDeallocSafe (cj->dependents);
+      statusRelease (cj);
+      schedpoolRelease (store->schedules[idx]);
+    }
 
-  cronjobDelete (next);
+  memDeallocSafe (store->jobs);
+  memDeallocSafe (store->schedules);
+  memDeallocSafe (store->pids);
+  memDeallocSafe (store->paused);
+  memDeallocSafe (store->first_fires);
+  store->num_jobs = store->max_jobs = 0;
 }
 
-void
-cronjobListLink (CronJob *hcj, CronJob *ncj)
+pid_t
+cronjobExecute (CronJob *cj)
 {
-  CronJob *tcj = NULL;
-  for (tcj = hcj; tcj->next; tcj = tcj->next)
-    ;
-  tcj->next = ncj;
+  if (cj->limits.has_cgroup && !cj->cgroup.ready)
+    cj->cgroup.ready = spawnerPrepareCgroup (&cj->cgroup);
+
+  /* A fire that cannot be launched is logged and skipped; the daemon
+     keeps running.  */
+  int out_fd = spawnerOpenCapture ();
+  int err_fd = out_fd >= 0 ? spawnerOpenCapture () : -1;
+  pid_t pid = -1;
+  if (err_fd >= 0)
+    {
+      atomic_fetch_add (&cj->tab->refs, 1);
+      pid = loggerSpawnChild (cj->logger, cj, out_fd, err_fd);
+      if (pid < 0)
+        atomic_fetch_sub (&cj->tab->refs, 1);
+    }
+
+  if (pid < 0)
+    {
+      int err = errno;
+      if (out_fd >= 0)
+        close (out_fd);
+      if (err_fd >= 0)
+        close (err_fd);
+      loggerLogSpawnErr (cj->logger, cj, err);
+    }
+
+  return pid;
 }
 
 void
-cronjobExecute (CronJob *cj, char **envptr)
+cronjobTriggerDependents (CronJob *cj, int exit_stat)
 {
-  if (cj->argv == NULL)
-    cronjobPrepCommand (cj);
-  if ((cj->pid = fork ()) < 0)
-    _err_out ("fork");
+  if (cj->num_dependents == 0 || atomic_load (&cj->tab->paused))
+    return;
 
-  if (cj->pid == 0)
+  bool succeeded = WIFEXITED (exit_stat) && WEXITSTATUS (exit_stat) == 0;
+  JobStore *store = &cj->tab->store;
+
+  for (size_t i = 0; i < cj->num_dependents; i++)
     {
-      if (setuid (cj->uid) < 0)
-        _err_out ("setuid");
-      if (setgid (cj->gid) < 0)
-        _err_out ("setgid");
-
-      char path_stdout[MAX_PATH + 1] = { 0 };
-      char path_stderr[MAX_PATH + 1] = { 0 };
-      ssprintf (&path_stdout[0], "%s/%d.out", _get_tmp_dir (), getpid ());
-      ssprintf (&path_stderr[0], "%s/%d.err", _get_tmp_dir (), getpid ());
-      freopen (path_stdout, "w", stdout);
-      freopen (path_stderr, "w", stderr);
-
-      execvpe (cj->argv[0], &cj->argv[1], envptr);
-      _exit (EXIT_FAILURE);
+      CronJob *dep = &store->jobs[cj->dependents[i]];
+      if (dep->after_success && !succeeded)
+        continue;
+
+      schedulerPost (cj->tab->sched, dep, false);
     }
 }
 
 void
-cronjobScheduleInit (Scheduler *sched, CronJob *cj)
+cronjobScheduleInit (Scheduler *sched, JobStore *store)
 {
-  if (cj == NULL)
-    return;
+  EventNotice **evts
+      = memAllocBlockSafe (store->num_jobs + 1, sizeof (EventNotice *));
+  size_t num_evts = 0;
 
-  time_t now = time (NULL);
-  time_t next_time = timesetComputeNextOccurence (&cj->timeset, now);
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    {
+      CronJob *cj = &store->jobs[idx];
+      EventNotice *evt = scheduleAddMember (cj);
+      if (evt != NULL && !schedulerOfferDue (sched, evt))
+        evts[num_evts++] = evt;
 
-  if (next_time == TIME_UNSPEC)
-    _err_out ("Could not schedule");
+      statusAcquire (cj);
+      statusRecordNext (cj, _job_schedule (cj)->notice.time);
+    }
 
-  EventNotice *evt = noticeNew (next_time, cj);
-  time_t delay = next_time - sched->lower_bound;
-  schedulerHold (sched, evt, delay);
+  if (num_evts >= SCHED_BULK_MIN)
+    schedulerBulkLoad (sched, evts, num_evts);
+  else
+    for (size_t i = 0; i < num_evts; i++)
+      schedulerInsert (sched, evts[i]);
 
-  cronjobScheduleInit (sched, cj->next);
+  memDeallocSafe (evts);
 }
 
+/* Run by the parser, so argv is complete before the table is published
+   to the shards and the boot thread.  */
 void
 cronjobPrepCommand (CronJob *cj)
 {
-  char *cmddup = strndup (cj->command, cj->command_len);
-  char *subtok = strtok (cmddup, "\t ");
+  char *cmddup = strndup ((const char *)cj->command, cj->command_len);
+  char *saveptr = NULL;
+  char *subtok = strtok_r (cmddup, "\t ", &saveptr);
   size_t max_argc = ARGC_DFL;
   cj->argv = memAllocBlockSafe (ARGC_DFL, sizeof (char *));
   while (subtok != NULL)
@@ -236,7 +581,7 @@ cronjobPrepCommand (CronJob *cj)
                                      sizeof (char *));
         }
       cj->argv[cj->argc++] = strdup (subtok);
-      subtok = strtok (NULL, "\t ");
+      subtok = strtok_r (NULL, "\t ", &saveptr);
     }
   memDeallocSafe (cmddup);
 }
@@ -1,91 +1,1054 @@
+#define _GNU_SOURCE
 #define POSIX_SOURCE
 #define POSIX_C_SOURCE
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/signalfd.>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <syslog.h>
 #include <unistd.h>
 
 #include "lykron.h"
 
+static LogRing *LOG_RING = NULL;
+static ChildTable *CHILD_TABLE = NULL;
+static pthread_once_t LOG_RING_ONCE = PTHREAD_ONCE_INIT;
+
+bool
+logringPush (LogRing *ring, LogRecordKind kind, pid_t pid, bool syslog,
+             const char *text, size_t text_len)
+{
+  LogRecord *rec = NULL;
+  size_t pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+
+  while (true)
+    {
+      rec = &ring->records[pos & ring->mask];
+      size_t seq = atomic_load_explicit (&rec->seq, memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+      if (diff == 0)
+        {
+          if (atomic_compare_exchange_weak_explicit (&ring->head, &pos,
+                                                     pos + 1,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+            break;
+        }
+      else if (diff < 0)
+        return false;
+      else
+        pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+    }
+
+  if (text_len > MAX_LOG_RECORD)
+    text_len = MAX_LOG_RECORD;
+
+  rec->kind = kind;
+  rec->pid = pid;
+  rec->time = time (NULL);
+  rec->syslog = syslog;
+  rec->text_len = text_len;
+  memcpy (&rec->text[0], text, text_len);
+
+  atomic_store_explicit (&rec->seq, pos + 1, memory_order_release);
+
+  if (atomic_exchange (&ring->sleeping, false))
+    eventfd_write (ring->wake_fd, 1);
+
+  return true;
+}
+
+LogRecord *
+logringPeek (LogRing *ring)
+{
+  LogRecord *rec = &ring->records[ring->tail & ring->mask];
+  size_t seq = atomic_load_explicit (&rec->seq, memory_order_acquire);
+
+  return seq == ring->tail + 1 ? rec : NULL;
+}
+
 void
-loggerReapChildren (Logger *lgr)
+logringPop (LogRing *ring, LogRecord *rec)
 {
-  int sfd = 0;
-  ssize_t slen = 0;
-  sigset_t mask = { 0 };
-  struct signalfd_siginfo fdsi = { 0 };
-  struct pollfd pfd = { 0 };
+  atomic_store_explicit (&rec->seq, ring->tail + ring->mask + 1,
+                         memory_order_release);
+  ring->tail++;
+}
 
-  sigemptyset (&mask);
-  sigaddset (&mask, SIGINT);
-  sigaddset (&mask, SIGCHLD);
-  sigaddset (&mask, SIGQUIT);
+static size_t
+logringFormat (LogRecord *rec, char *buf, bool for_syslog)
+{
+  static const char *const kind_names[] = {
+    [LOGREC_Out] = "out",
+    [LOGREC_Err] = "err",
+    [LOGREC_ExitStat] = "exit",
+    [LOGREC_Truncated] = "truncated",
+    [LOGREC_Dropped] = "dropped",
+    [LOGREC_Syntax] = "syntax",
+    [LOGREC_SpawnErr] = "spawn",
+  };
+  static const int kind_prios[] = {
+    [LOGREC_Out] = LOG_INFO,
+    [LOGREC_Err] = LOG_WARNING,
+    [LOGREC_ExitStat] = LOG_NOTICE,
+    [LOGREC_Truncated] = LOG_WARNING,
+    [LOGREC_Dropped] = LOG_ERR,
+    [LOGREC_Syntax] = LOG_ERR,
+    [LOGREC_SpawnErr] = LOG_ERR,
+  };
 
-  if (sigprocmask (SIG_BLOCK, &mask, NULL) < 0)
-    _err_out ("sigprocmask");
+  struct tm tm;
+  char stamp[32] = { 0 };
+  localtime_r (&rec->time, &tm);
+
+  int len = 0;
+  if (for_syslog)
+    {
+      strftime (&stamp[0], sizeof (stamp), "%b %e %T", &tm);
+      len = snprintf (buf, MAX_LOG_LINE, "<%d>%s lykron[%d]: (%d) %s: %.*s",
+                      LOG_CRON | kind_prios[rec->kind], &stamp[0], getpid (),
+                      rec->pid, kind_names[rec->kind], (int)rec->text_len,
+                      &rec->text[0]);
+    }
+  else
+    {
+      strftime (&stamp[0], sizeof (stamp), "%F %T", &tm);
+      len = snprintf (buf, MAX_LOG_LINE, "%s (%d) %s: %.*s\n", &stamp[0],
+                      rec->pid, kind_names[rec->kind], (int)rec->text_len,
+                      &rec->text[0]);
+    }
 
-  if ((sfd = signalfd (-1, &mask, 0)) < 0)
-    errrorOut ("signalfd");
+  if (len < 0)
+    return 0;
+  return (size_t)len >= MAX_LOG_LINE ? MAX_LOG_LINE - 1 : (size_t)len;
+}
 
-  pfd = (struct pollfd){ .fd = sfd, .events = POLLIN };
-  while (poll (&pfd, 1, -1) > 0)
+static void
+logringFlushFile (LogRing *ring, struct iovec *iov, size_t iovcnt)
+{
+  while (iovcnt > 0)
     {
-      if (pfd.revents & POLLIN)
+      ssize_t n_written = writev (ring->log_fd, iov, iovcnt);
+      if (n_written < 0)
         {
-          memset (&fdsi, 0, sizeof (fdsi));
-          if (read (sfd, &fdsi, sizeof (fdsi)) < 0)
-            _err_out ("read");
+          if (errno == EINTR)
+            continue;
+          atomic_fetch_add (&ring->num_dropped, iovcnt);
+          return;
+        }
 
-          if (fdsi.ssi_signo == SIGCHLD)
+      while (iovcnt > 0 && (size_t)n_written >= iov->iov_len)
+        {
+          n_written -= iov->iov_len;
+          iov++;
+          iovcnt--;
+        }
+      if (iovcnt > 0)
+        {
+          iov->iov_base = (char *)iov->iov_base + n_written;
+          iov->iov_len -= n_written;
+        }
+    }
+}
+
+static void
+logringFlushSyslog (LogRing *ring, struct mmsghdr *msgs, size_t msgcnt)
+{
+  while (msgcnt > 0)
+    {
+      int n_sent = sendmmsg (ring->syslog_fd, msgs, msgcnt, 0);
+      if (n_sent < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          atomic_fetch_add (&ring->num_dropped, msgcnt);
+          return;
+        }
+
+      msgs += n_sent;
+      msgcnt -= n_sent;
+    }
+}
+
+static size_t
+logringDrain (LogRing *ring)
+{
+  static char lines[LOG_BATCH_MAX][MAX_LOG_LINE];
+  struct iovec file_iov[LOG_BATCH_MAX];
+  struct iovec sys_iov[LOG_BATCH_MAX];
+  struct mmsghdr sys_msgs[LOG_BATCH_MAX];
+  size_t num_file = 0, num_sys = 0, num_lines = 0;
+  LogRecord *rec = NULL;
+
+  size_t dropped = atomic_exchange (&ring->num_dropped, 0);
+  if (dropped > 0)
+    {
+      LogRecord drec = { .kind = LOGREC_Dropped, .pid = getpid () };
+      drec.time = time (NULL);
+      drec.syslog = ring->syslog_fd >= 0;
+      drec.text_len = snprintf (&drec.text[0], MAX_LOG_RECORD,
+                                "%zu log records lost", dropped);
+
+      size_t len = logringFormat (&drec, &lines[0][0], drec.syslog);
+      if (drec.syslog)
+        {
+          sys_iov[0] = (struct iovec){ .iov_base = &lines[0][0],
+                                       .iov_len = len };
+          sys_msgs[num_sys++] = (struct mmsghdr){
+            .msg_hdr = { .msg_iov = &sys_iov[0], .msg_iovlen = 1 },
+          };
+        }
+      else
+        file_iov[num_file++]
+            = (struct iovec){ .iov_base = &lines[0][0], .iov_len = len };
+      num_lines++;
+    }
+
+  while (num_lines < LOG_BATCH_MAX && (rec = logringPeek (ring)) != NULL)
+    {
+      bool to_syslog = rec->syslog && ring->syslog_fd >= 0;
+      char *line = &lines[num_lines++][0];
+      size_t len = logringFormat (rec, line, to_syslog);
+      logringPop (ring, rec);
+
+      if (to_syslog)
+        {
+          sys_iov[num_sys] = (struct iovec){ .iov_base = line, .iov_len = len };
+          sys_msgs[num_sys] = (struct mmsghdr){
+            .msg_hdr = { .msg_iov = &sys_iov[num_sys], .msg_iovlen = 1 },
+          };
+          num_sys++;
+        }
+      else
+        file_iov[num_file++]
+            = (struct iovec){ .iov_base = line, .iov_len = len };
+    }
+
+  if (num_sys > 0)
+    logringFlushSyslog (ring, &sys_msgs[0], num_sys);
+  if (num_file > 0)
+    logringFlushFile (ring, &file_iov[0], num_file);
+
+  return num_lines;
+}
+
+/* Compresses what a truncated capture had left into its spill file.  The
+   capture's descriptor was duplicated by the reaper, which has moved on.  */
+static void
+logringWriteSpill (LogRing *ring, LogSpill *spill)
+{
+  gzFile gzspill = NULL;
+  int fd = open (&spill->path[0],
+                 O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd >= 0 && (gzspill = gzdopen (fd, "wb")) == NULL)
+    close (fd);
+
+  bool spilled = gzspill != NULL;
+  if (gzspill != NULL)
+    {
+      char buf[MAX_BUF];
+      ssize_t n_read = 0;
+      off_t offset = spill->offset;
+
+      while ((n_read = pread (spill->fd, &buf[0], sizeof (buf), offset)) > 0)
+        {
+          if (gzwrite (gzspill, &buf[0], n_read) <= 0)
             {
-              pid_t reaped_pid = fdsi.ssi_pid;
-              int reaped_exit_stat = fdsi.ssi_status;
+              spilled = false;
+              break;
+            }
+          offset += n_read;
+        }
+
+      if (gzclose (gzspill) != Z_OK)
+        spilled = false;
+    }
+
+  if (!spilled)
+    {
+      char text[MAX_LOG_RECORD] = { 0 };
+      int text_len = snprintf (&text[0], sizeof (text),
+                               "spill to %s failed", &spill->path[0]);
+      logringPush (ring, LOGREC_Truncated, spill->pid, false, &text[0],
+                   text_len);
+    }
+
+  close (spill->fd);
+}
 
-              loggerLogReapedChild (lgr, reaped_pid, reaped_exit_stat);
+static void
+logringWriteSpills (LogRing *ring)
+{
+  LogSpill *spill = atomic_exchange (&ring->spills, NULL);
+  while (spill != NULL)
+    {
+      LogSpill *next = spill->next;
+      logringWriteSpill (ring, spill);
+      memDeallocSafe (spill);
+      spill = next;
+    }
+}
+
+void *
+loggerWriterLoop (void *arg)
+{
+  LogRing *ring = arg;
+  struct pollfd pfd = { .fd = ring->wake_fd, .events = POLLIN };
+  time_t last_flush = 0;
+
+  while (true)
+    {
+      /* Digests are checked once a second, busy or not.  */
+      time_t now = time (NULL);
+      if (now != last_flush)
+        {
+          mailerFlushDue (ring->mailer, now, false);
+          last_flush = now;
+        }
+
+      logringWriteSpills (ring);
+      if (logringDrain (ring) > 0)
+        continue;
+
+      if (!atomic_load (&ring->running) && atomic_load (&ring->spills) == NULL)
+        break;
+
+      atomic_store (&ring->sleeping, true);
+      if (logringPeek (ring) != NULL || atomic_load (&ring->spills) != NULL)
+        {
+          atomic_store (&ring->sleeping, false);
+          continue;
+        }
+
+      if (poll (&pfd, 1, LOG_FLUSH_INTERVAL) > 0 && (pfd.revents & POLLIN))
+        {
+          eventfd_t cnt = 0;
+          eventfd_read (ring->wake_fd, &cnt);
+        }
+      atomic_store (&ring->sleeping, false);
+    }
+
+  return NULL;
+}
+
+static inline size_t
+childtblSlot (ChildTable *ctbl, pid_t pid)
+{
+  return ((uint32_t)pid * 0x9e3779b1u) & (ctbl->max_children - 1);
+}
+
+ChildTable *
+childtblNew (void)
+{
+  ChildTable *ctbl = memAllocSafe (sizeof (ChildTable));
+  ctbl->children
+      = memAllocBlockSafe (INIT_CHILDTBL_SIZE, sizeof (struct Child));
+  ctbl->num_children = 0;
+  ctbl->max_children = INIT_CHILDTBL_SIZE;
+  ctbl->exits = NULL;
+  ctbl->num_exits = 0;
+  ctbl->max_exits = 0;
+  atomic_init (&ctbl->adopting, false);
+  pthread_mutex_init (&ctbl->lock, NULL);
+
+  return ctbl;
+}
+
+void
+childtblDelete (ChildTable *ctbl)
+{
+  pthread_mutex_destroy (&ctbl->lock);
+  if (ctbl->exits != NULL)
+    memDeallocSafe (ctbl->exits);
+  memDeallocSafe (ctbl->children);
+  memDeallocSafe (ctbl);
+}
+
+static void
+childtblInsertLocked (ChildTable *ctbl, const struct Child *child)
+{
+  if ((ctbl->num_children + 1) * 2 >= ctbl->max_children)
+    {
+      struct Child *old_children = ctbl->children;
+      size_t old_max_children = ctbl->max_children;
+
+      ctbl->max_children <<= 1;
+      ctbl->children
+          = memAllocBlockSafe (ctbl->max_children, sizeof (struct Child));
+      ctbl->num_children = 0;
+
+      for (size_t i = 0; i < old_max_children; i++)
+        if (old_children[i].pid > 0)
+          childtblInsertLocked (ctbl, &old_children[i]);
+      memDeallocSafe (old_children);
+    }
+
+  size_t idx = childtblSlot (ctbl, child->pid);
+  while (ctbl->children[idx].pid > 0)
+    idx = (idx + 1) & (ctbl->max_children - 1);
+
+  ctbl->children[idx] = *child;
+  ctbl->num_children++;
+}
+
+/* Children are recorded after the fork or spawner round trip returns, so
+   the reaper may see one exit first.  Its exit then waits in the table for
+   the launcher to claim it.  */
+static void
+childtblRecord (ChildTable *ctbl, const struct Child *child)
+{
+  pthread_mutex_lock (&ctbl->lock);
+
+  size_t idx = 0;
+  while (idx < ctbl->num_exits && ctbl->exits[idx].pid != child->pid)
+    idx++;
+
+  if (idx < ctbl->num_exits)
+    ctbl->exits[idx].child = *child;
+  else
+    childtblInsertLocked (ctbl, child);
+
+  pthread_mutex_unlock (&ctbl->lock);
+}
+
+pid_t
+childtblFork (ChildTable *ctbl, CronJob *cj)
+{
+  pid_t pid = fork ();
+  if (pid > 0)
+    {
+      struct Child child = { .pid = pid, .job = cj, .out_fd = -1,
+                             .err_fd = -1 };
+      childtblRecord (ctbl, &child);
+    }
+
+  return pid;
+}
+
+pid_t
+childtblSpawn (ChildTable *ctbl, CronJob *cj, int out_fd, int err_fd)
+{
+  Spawner *spw = spawnerGet ();
+  if (cj->tab->sched != NULL && cj->tab->sched->spawner != NULL)
+    spw = cj->tab->sched->spawner;
+
+  pid_t pid = spawnerSpawn (spw, cj, out_fd, err_fd);
+  if (pid > 0)
+    {
+      *_job_pid (cj) = pid;
+      statusRecordStart (cj, pid);
+      struct Child child = { .pid = pid, .job = cj, .out_fd = out_fd,
+                             .err_fd = err_fd };
+      childtblRecord (ctbl, &child);
+    }
+
+  return pid;
+}
+
+void
+childtblAdopt (ChildTable *ctbl, const struct Child *child)
+{
+  pthread_mutex_lock (&ctbl->lock);
+  childtblInsertLocked (ctbl, child);
+  pthread_mutex_unlock (&ctbl->lock);
+}
+
+ChildTable *
+childtblGet (void)
+{
+  return CHILD_TABLE;
+}
+
+/* Removes a reaped child from the table.  A pid not there yet is kept
+   with its exit status for childtblRecord.  */
+bool
+childtblReap (ChildTable *ctbl, pid_t pid, int exit_stat,
+              const struct rusage *usage, struct Child *child)
+{
+  bool found = false;
+  size_t mask = ctbl->max_children - 1;
+
+  pthread_mutex_lock (&ctbl->lock);
+
+  size_t idx = childtblSlot (ctbl, pid);
+  while (ctbl->children[idx].pid > 0 && ctbl->children[idx].pid != pid)
+    idx = (idx + 1) & mask;
+
+  if (ctbl->children[idx].pid == pid)
+    {
+      found = true;
+      *child = ctbl->children[idx];
+      ctbl->children[idx].pid = 0;
+      ctbl->children[idx].job = NULL;
+      ctbl->num_children--;
+
+      for (size_t hole = idx, next = (idx + 1) & mask;
+           ctbl->children[next].pid > 0; next = (next + 1) & mask)
+        {
+          size_t home = childtblSlot (ctbl, ctbl->children[next].pid);
+          if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+              ctbl->children[hole] = ctbl->children[next];
+              ctbl->children[next].pid = 0;
+              ctbl->children[next].job = NULL;
+              hole = next;
             }
         }
     }
+  else
+    {
+      if (ctbl->num_exits == ctbl->max_exits)
+        {
+          size_t old_max = ctbl->max_exits;
+          ctbl->max_exits = old_max > 0 ? old_max << 1 : NLIM;
+          ctbl->exits
+              = ctbl->exits == NULL
+                    ? memAllocBlockSafe (ctbl->max_exits,
+                                         sizeof (struct ChildExit))
+                    : memReallocSafe (ctbl->exits, old_max, ctbl->max_exits,
+                                      sizeof (struct ChildExit));
+        }
 
-  close (sfd);
+      ctbl->exits[ctbl->num_exits++] = (struct ChildExit){
+        .pid = pid,
+        .exit_stat = exit_stat,
+        .usage = *usage,
+        .reaped = time (NULL),
+      };
+    }
+
+  pthread_mutex_unlock (&ctbl->lock);
+
+  return found;
+}
+
+/* Takes exits claimed by their launcher, and those nobody claimed within
+   CHILD_EXIT_TTL seconds, which are returned with no job.  */
+size_t
+childtblTakeExits (ChildTable *ctbl, time_t now, struct ChildExit *exits,
+                   size_t max_exits)
+{
+  size_t num_taken = 0;
+
+  pthread_mutex_lock (&ctbl->lock);
+
+  for (size_t i = 0; i < ctbl->num_exits && num_taken < max_exits;)
+    {
+      struct ChildExit *pending = &ctbl->exits[i];
+      if (pending->child.pid == 0 && now - pending->reaped < CHILD_EXIT_TTL)
+        {
+          i++;
+          continue;
+        }
+
+      exits[num_taken] = *pending;
+      exits[num_taken++].child.pid = pending->pid;
+      *pending = ctbl->exits[--ctbl->num_exits];
+    }
+
+  pthread_mutex_unlock (&ctbl->lock);
+
+  return num_taken;
+}
+
+size_t
+childtblPendingExits (ChildTable *ctbl)
+{
+  pthread_mutex_lock (&ctbl->lock);
+  size_t num_exits = ctbl->num_exits;
+  pthread_mutex_unlock (&ctbl->lock);
+
+  return num_exits;
+}
+
+
+/* Spill files hold job output, so only the daemon may list them.  */
+static void
+logringMakeSpillDir (void)
+{
+  char path[PATH_MAX + 1] = { 0 };
+  int path_len = snprintf (&path[0], PATH_MAX, "%s", SPILL_DIR);
+
+  for (char *sep = &path[1]; sep < &path[path_len]; sep++)
+    if (*sep == '/')
+      {
+        *sep = '\0';
+        mkdir (&path[0], 0755);
+        *sep = '/';
+      }
+
+  mkdir (&path[0], 0700);
+}
+
+static void
+logringStart (void)
+{
+  spawnerStart ();
+  logringMakeSpillDir ();
+
+  LogRing *ring = memAllocSafe (sizeof (LogRing));
+  ring->records = memAllocBlockSafe (LOG_RING_SIZE, sizeof (LogRecord));
+  ring->mask = LOG_RING_SIZE - 1;
+  ring->tail = 0;
+  atomic_init (&ring->head, 0);
+  atomic_init (&ring->num_dropped, 0);
+  atomic_init (&ring->num_truncated, 0);
+  atomic_init (&ring->sleeping, false);
+  atomic_init (&ring->running, true);
+  atomic_init (&ring->spills, NULL);
+
+  for (size_t i = 0; i < LOG_RING_SIZE; i++)
+    atomic_init (&ring->records[i].seq, i);
+
+  if ((ring->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    _err_out ("eventfd");
+
+  char path[PATH_MAX + 1];
+  ring->log_fd = open (_instance_path (LOG_FILE, &path[0]),
+                       O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+  if (ring->log_fd < 0)
+    _err_out ("open");
+
+  ring->syslog_fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (ring->syslog_fd >= 0)
+    {
+      struct sockaddr_un addr = { .sun_family = AF_UNIX };
+      strncpy (&addr.sun_path[0], LOG_SOCKET, sizeof (addr.sun_path) - 1);
+      if (connect (ring->syslog_fd, (struct sockaddr *)&addr, sizeof (addr))
+          < 0)
+        {
+          close (ring->syslog_fd);
+          ring->syslog_fd = -1;
+        }
+    }
+
+  LOG_RING = ring;
+  CHILD_TABLE = childtblNew ();
+  atomic_store (&CHILD_TABLE->adopting, handoffGet () != NULL);
+  ring->mailer = mailerNew (CHILD_TABLE);
+
+  if (pthread_create (&ring->writer, NULL, loggerWriterLoop, ring) != 0)
+    _err_out ("pthread_create");
+}
+
+Logger *
+loggerNew (void)
+{
+  pthread_once (&LOG_RING_ONCE, logringStart);
+
+  Logger *lgr = memAllocSafe (sizeof (Logger));
+  lgr->mail_from = NULL;
+  lgr->mail_to = NULL;
+  lgr->mail_window = MAIL_DIGEST_WINDOW;
+  lgr->mail_max = MAIL_DIGEST_MAX;
+  lgr->syslog = false;
+  lgr->block_on_full = false;
+  lgr->ring = LOG_RING;
+  lgr->children = CHILD_TABLE;
+  lgr->mailer = LOG_RING->mailer;
+
+  return lgr;
 }
 
 void
-loggerLogReapedChild (Logger *lgr, pid_t reaped_pid, reaped_exit_stat)
+loggerDelete (Logger *lgr)
 {
-  char path_stdout[PATH_MAX + 1] = { 0 };
-  char path_stderr[PATH_MAX + 1] = { 0 };
-  ssprintf (&path_stdout[0], "%s/%d.out", _get_tmp_dir (), reaped_pid);
-  ssprintf (&path_stderr[0], "%s/%d.err", _get_tmp_dir (), reaped_pid);
+  memDeallocSafe (lgr);
+}
 
-  FILE *outtmp = fopen (path_stdout, "r");
-  FILE *errtmp = fopen (path_stderr, "r");
+static void
+logringStop (LogRing *ring)
+{
+  atomic_store (&ring->running, false);
+  eventfd_write (ring->wake_fd, 1);
+  pthread_join (ring->writer, NULL);
+}
 
-  if (outtmp == NULL || errtmp == NULL)
-    _err_out ("fopen");
+void
+loggerQuiesce (void)
+{
+  LogRing *ring = LOG_RING;
+  if (ring == NULL)
+    return;
+
+  mailerFlushDue (ring->mailer, time (NULL), true);
+  logringStop (ring);
+}
+
+void
+loggerResume (void)
+{
+  LogRing *ring = LOG_RING;
+  if (ring == NULL)
+    return;
+
+  atomic_store (&ring->running, true);
+  if (pthread_create (&ring->writer, NULL, loggerWriterLoop, ring) != 0)
+    _err_out ("pthread_create");
+}
+
+void
+loggerShutdown (void)
+{
+  LogRing *ring = LOG_RING;
+  if (ring == NULL)
+    return;
+
+  logringStop (ring);
+  mailerDelete (ring->mailer);
+
+  close (ring->wake_fd);
+  close (ring->log_fd);
+  if (ring->syslog_fd >= 0)
+    close (ring->syslog_fd);
+
+  memDeallocSafe (ring->records);
+  memDeallocSafe (ring);
+  LOG_RING = NULL;
+
+  childtblDelete (CHILD_TABLE);
+  CHILD_TABLE = NULL;
+}
 
-  char *logln = NULL;
-  size_t logln_len = 0;
-  while (getline (&logln, &logln_len, outtmp) > 0)
+pid_t
+loggerSpawnChild (Logger *lgr, CronJob *cj, int out_fd, int err_fd)
+{
+  return childtblSpawn (lgr->children, cj, out_fd, err_fd);
+}
+
+static void
+loggerPush (Logger *lgr, LogRecordKind kind, pid_t pid, const char *text,
+            size_t text_len)
+{
+  while (!logringPush (lgr->ring, kind, pid, lgr->syslog, text, text_len))
     {
-      if (logln_len == 0 || logln == NULL)
-        continue;
-      loggerLogOut (lgr, reaped_pid, logln, logln_len);
+      if (!lgr->block_on_full)
+        {
+          atomic_fetch_add (&lgr->ring->num_dropped, 1);
+          return;
+        }
+
+      if (atomic_exchange (&lgr->ring->sleeping, false))
+        eventfd_write (lgr->ring->wake_fd, 1);
+      sched_yield ();
+    }
+}
+
+void
+loggerLogOut (Logger *lgr, pid_t pid, const char *ln, size_t ln_len)
+{
+  if (ln_len > 0 && ln[ln_len - 1] == '\n')
+    ln_len--;
+  loggerPush (lgr, LOGREC_Out, pid, ln, ln_len);
+}
+
+void
+loggerLogErr (Logger *lgr, pid_t pid, const char *ln, size_t ln_len)
+{
+  if (ln_len > 0 && ln[ln_len - 1] == '\n')
+    ln_len--;
+  loggerPush (lgr, LOGREC_Err, pid, ln, ln_len);
+}
+
+void
+loggerLogExitStat (Logger *lgr, pid_t pid, int exit_stat,
+                   const struct rusage *usage)
+{
+  char text[MAX_LOG_RECORD] = { 0 };
+  int text_len = 0;
+
+  if (WIFSIGNALED (exit_stat))
+    text_len = snprintf (&text[0], sizeof (text), "killed by signal %d",
+                         WTERMSIG (exit_stat));
+  else
+    text_len = snprintf (&text[0], sizeof (text), "status %d",
+                         WEXITSTATUS (exit_stat));
+
+  if (usage != NULL)
+    text_len += snprintf (
+        &text[text_len], sizeof (text) - text_len,
+        ", user %ld.%03lds, sys %ld.%03lds, maxrss %ldkB, majflt %ld",
+        (long)usage->ru_utime.tv_sec, (long)usage->ru_utime.tv_usec / 1000,
+        (long)usage->ru_stime.tv_sec, (long)usage->ru_stime.tv_usec / 1000,
+        usage->ru_maxrss, usage->ru_majflt);
+
+  loggerPush (lgr, LOGREC_ExitStat, pid, &text[0], text_len);
+}
+
+void
+loggerLogSyntaxErr (Logger *lgr, const char *path, const char *msg)
+{
+  char text[MAX_LOG_RECORD] = { 0 };
+  int text_len = snprintf (&text[0], sizeof (text), "%s: %s", path, msg);
+  if (text_len >= (int)sizeof (text))
+    text_len = sizeof (text) - 1;
+
+  loggerPush (lgr, LOGREC_Syntax, getpid (), &text[0], text_len);
+}
+
+void
+loggerLogSpawnErr (Logger *lgr, CronJob *cj, int err)
+{
+  char text[MAX_LOG_RECORD] = { 0 };
+  int text_len = snprintf (&text[0], sizeof (text), "%.*s: %s",
+                           (int)cj->command_len, (char *)cj->command,
+                           strerror (err));
+  if (text_len >= (int)sizeof (text))
+    text_len = sizeof (text) - 1;
+
+  loggerPush (lgr, LOGREC_SpawnErr, getpid (), &text[0], text_len);
+}
+
+static bool
+loggerCaptureStream (Logger *lgr, pid_t pid, FILE *fstream, size_t cap,
+                     LogRecordKind kind, const char *suffix, FILE *mailsec)
+{
+  char chunk[MAX_LOG_RECORD + 1] = { 0 };
+  size_t n_logged = 0, chunk_len = 0;
+
+  while (fgets (&chunk[0], sizeof (chunk), fstream) != NULL)
+    {
+      chunk_len = strlen (&chunk[0]);
+      if (n_logged + chunk_len > cap)
+        break;
+
+      if (kind == LOGREC_Out)
+        loggerLogOut (lgr, pid, &chunk[0], chunk_len);
+      else
+        loggerLogErr (lgr, pid, &chunk[0], chunk_len);
+      if (mailsec != NULL)
+        fwrite (&chunk[0], 1, chunk_len, mailsec);
+      n_logged += chunk_len;
+      chunk_len = 0;
     }
-  while (getline (&logln, &logln_len, errtmp) > 0)
+
+  if (chunk_len == 0)
+    return false;
+
+  /* The rest is compressed by the writer thread; the reaper only takes a
+     descriptor and the offset the spill starts at.  */
+  char path_spill[PATH_MAX + 1] = { 0 };
+  snprintf (&path_spill[0], PATH_MAX, "%s/%d-%ld.%s.gz", SPILL_DIR, pid,
+            (long)time (NULL), suffix);
+
+  struct stat st = { 0 };
+  size_t n_spilled = 0;
+  off_t offset = ftello (fstream) - chunk_len;
+  LogSpill *spill = memAllocSafe (sizeof (LogSpill));
+  spill->fd = fcntl (fileno (fstream), F_DUPFD_CLOEXEC, 0);
+  spill->offset = offset;
+  spill->pid = pid;
+  memcpy (&spill->path[0], &path_spill[0], sizeof (path_spill));
+
+  if (spill->fd >= 0 && fstat (spill->fd, &st) == 0 && st.st_size > offset)
     {
-      if (logln_len == 0 || logln == NULL)
-        continue;
-      loggerLogErr (lgr, reaped_pid, logln, logln_len);
+      n_spilled = st.st_size - offset;
+      LogSpill *head = atomic_load (&lgr->ring->spills);
+      do
+        spill->next = head;
+      while (!atomic_compare_exchange_weak (&lgr->ring->spills, &head, spill));
+      eventfd_write (lgr->ring->wake_fd, 1);
     }
+  else
+    {
+      if (spill->fd >= 0)
+        close (spill->fd);
+      memDeallocSafe (spill);
+    }
+
+  atomic_fetch_add (&lgr->ring->num_truncated, 1);
+
+  char text[MAX_LOG_RECORD] = { 0 };
+  int text_len = snprintf (
+      &text[0], sizeof (text), "%s truncated after %zu bytes, %zu spilled to %s",
+      suffix, n_logged, n_spilled, n_spilled > 0 ? &path_spill[0] : "(none)");
+  loggerPush (lgr, LOGREC_Truncated, pid, &text[0], text_len);
+  if (mailsec != NULL)
+    fprintf (mailsec, "[%.*s]\n", text_len, &text[0]);
+
+  return true;
+}
+
+static void
+loggerFinishChild (Logger *lgr, const struct Child *child,
+                   int reaped_exit_stat, const struct rusage *reaped_usage)
+{
+  pid_t reaped_pid = child->pid;
+  if (child->job == NULL)
+    {
+      loggerLogExitStat (lgr, reaped_pid, reaped_exit_stat, reaped_usage);
+      return;
+    }
+
+  CronJob *cj = child->job;
+  if (cj->logger != NULL)
+    lgr = cj->logger;
+
+  lseek (child->out_fd, 0, SEEK_SET);
+  lseek (child->err_fd, 0, SEEK_SET);
+  FILE *outtmp = fdopen (child->out_fd, "r");
+  FILE *errtmp = fdopen (child->err_fd, "r");
+
+  if (outtmp == NULL || errtmp == NULL)
+    _err_out ("fdopen");
+
+  char *mailbuf = NULL;
+  size_t mailbuf_len = 0;
+  FILE *mailsec = NULL;
+  long mailsec_hdr = 0;
+  if (lgr->mail_to != NULL && *lgr->mail_to != '\0')
+    {
+      mailsec = open_memstream (&mailbuf, &mailbuf_len);
+      fprintf (mailsec, "---- (%d) %.*s\n", reaped_pid,
+               (int)cj->command_len, cj->command);
+      mailsec_hdr = ftell (mailsec);
+    }
+
+  size_t num_truncated = 0;
+  num_truncated += loggerCaptureStream (lgr, reaped_pid, outtmp,
+                                        cj->output_cap, LOGREC_Out, "out",
+                                        mailsec);
+  num_truncated += loggerCaptureStream (lgr, reaped_pid, errtmp,
+                                        cj->output_cap, LOGREC_Err, "err",
+                                        mailsec);
   fclose (outtmp);
   fclose (errtmp);
 
-  loggerLogExitStat (lgr, repeaed_pid, reaped_exit_stat);
+  if (mailsec != NULL)
+    {
+      bool has_output = ftell (mailsec) > mailsec_hdr;
+      if (WIFSIGNALED (reaped_exit_stat))
+        fprintf (mailsec, "---- killed by signal %d\n\n",
+                 WTERMSIG (reaped_exit_stat));
+      else
+        fprintf (mailsec, "---- exit status %d\n\n",
+                 WEXITSTATUS (reaped_exit_stat));
+      fclose (mailsec);
+      if (has_output)
+        mailerAppend (lgr->mailer, lgr->mail_from, lgr->mail_to,
+                      lgr->mail_window, lgr->mail_max, mailbuf, mailbuf_len);
+      memDeallocSafe (mailbuf);
+    }
+
+  *_job_pid (cj) = 0;
+  cj->num_truncated += num_truncated;
+
+  loggerLogExitStat (lgr, reaped_pid, reaped_exit_stat, reaped_usage);
+  statusRecordExit (cj, reaped_pid, reaped_exit_stat);
+  rebootFinish (reaped_pid, reaped_exit_stat);
+  cronjobTriggerDependents (cj, reaped_exit_stat);
+
+  atomic_fetch_sub (&cj->tab->refs, 1);
+}
+
+void
+loggerLogReapedChild (Logger *lgr, pid_t reaped_pid, int reaped_exit_stat,
+                      const struct rusage *reaped_usage)
+{
+  struct Child child = { 0 };
+  if (childtblReap (lgr->children, reaped_pid, reaped_exit_stat,
+                    reaped_usage, &child))
+    loggerFinishChild (lgr, &child, reaped_exit_stat, reaped_usage);
+}
+
+size_t
+loggerDrainChildren (Logger *lgr)
+{
+  size_t num_reaped = 0;
+  pid_t reaped_pid = 0;
+  int reaped_exit_stat = 0;
+  struct rusage reaped_usage = { 0 };
+
+  /* Children handed over by the previous image are not in the table until
+     adopted; reaping one before that would lose its output.  */
+  if (atomic_load (&lgr->children->adopting))
+    return 0;
+
+  while ((reaped_pid = wait4 (-1, &reaped_exit_stat, WNOHANG, &reaped_usage))
+         > 0)
+    {
+      loggerLogReapedChild (lgr, reaped_pid, reaped_exit_stat,
+                            &reaped_usage);
+      num_reaped++;
+    }
+
+  if (reaped_pid < 0 && errno != ECHILD && errno != EINTR)
+    _err_out ("wait4");
+
+  struct ChildExit exits[LOG_BATCH_MAX];
+  size_t num_exits = 0;
+  while ((num_exits = childtblTakeExits (lgr->children, time (NULL),
+                                         &exits[0], LOG_BATCH_MAX))
+         > 0)
+    for (size_t i = 0; i < num_exits; i++)
+      loggerFinishChild (lgr, &exits[i].child, exits[i].exit_stat,
+                         &exits[i].usage);
+
+  return num_reaped;
+}
+
+void
+loggerReapChildren (Logger *lgr)
+{
+  int sfd = 0;
+  sigset_t mask = { 0 };
+  struct signalfd_siginfo fdsi[LOG_BATCH_MAX];
+  struct pollfd pfd = { 0 };
+
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGCHLD);
+  sigaddset (&mask, SIGQUIT);
+
+  if (sigprocmask (SIG_BLOCK, &mask, NULL) < 0)
+    _err_out ("sigprocmask");
+
+  if ((sfd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+    _err_out ("signalfd");
+
+  loggerDrainChildren (lgr);
+
+  pfd = (struct pollfd){ .fd = sfd, .events = POLLIN };
+  while (true)
+    {
+      int timeout = atomic_load (&lgr->children->adopting)
+                            || childtblPendingExits (lgr->children) > 0
+                        ? LOG_FLUSH_INTERVAL
+                        : -1;
+      int n_ready = poll (&pfd, 1, timeout);
+      if (n_ready < 0 && errno == EINTR)
+        continue;
+      if (n_ready < 0)
+        break;
+
+      if (n_ready > 0 && (pfd.revents & POLLIN))
+        {
+          while (read (sfd, &fdsi[0], sizeof (fdsi)) > 0)
+            ;
+          if (errno != EAGAIN)
+            _err_out ("read");
+        }
+
+      loggerDrainChildren (lgr);
+    }
+
+  close (sfd);
 }
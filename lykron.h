@@ -1,26 +1,30 @@
 #ifndef LYKRON_H
 #define LYKRON_H
 
-#define _POSIX_SOURCE
-#define _POSIX_C_SOURCE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <semaphore.h>
+#include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <wordexp.h>
-
-#ifndef TABLE_DIRS_ADDITIONAL
-#define TABLE_DIRS_ADDITIONAL
-#endif
+#include <zlib.h>
 
 #ifndef TABLE_FILE_SYSWIDE
 #define TABLE_FILE_SYSWIDE "/etc/lykrontab"
@@ -38,6 +42,86 @@
 #define INIT_SYMTBL_LOG2 10
 #endif
 
+#ifndef CONTROL_SOCKET
+#define CONTROL_SOCKET "/run/lykron.sock"
+#endif
+
+#ifndef CONTROL_MAX_CLIENTS
+#define CONTROL_MAX_CLIENTS 16
+#endif
+
+#ifndef CONTROL_MAX_NEXT
+#define CONTROL_MAX_NEXT 64
+#endif
+
+#ifndef SCHED_NUM_SHARDS
+#define SCHED_NUM_SHARDS 1
+#endif
+
+#ifndef SCHED_TIMER_SLACK
+#define SCHED_TIMER_SLACK 0
+#endif
+
+#ifndef SPAWN_MAX_INFLIGHT
+#define SPAWN_MAX_INFLIGHT 16
+#endif
+
+#ifndef RCU_MAX_READERS
+#define RCU_MAX_READERS 256
+#endif
+
+#ifndef RELOAD_GRACE_INTERVAL
+#define RELOAD_GRACE_INTERVAL 1000
+#endif
+
+#ifndef RELOAD_DEBOUNCE_INTERVAL
+#define RELOAD_DEBOUNCE_INTERVAL 250
+#endif
+
+#ifndef SCHED_BULK_MIN
+#define SCHED_BULK_MIN 64
+#endif
+
+#ifndef PRESSURE_NORMAL_MAX
+#define PRESSURE_NORMAL_MAX 90.0
+#endif
+
+#ifndef PRESSURE_LOW_MAX
+#define PRESSURE_LOW_MAX 25.0
+#endif
+
+#ifndef DEFER_MIN_BACKOFF
+#define DEFER_MIN_BACKOFF 30
+#endif
+
+#ifndef DEFER_MAX_BACKOFF
+#define DEFER_MAX_BACKOFF 600
+#endif
+
+#ifndef DEFER_MAX_DELAY
+#define DEFER_MAX_DELAY 3600
+#endif
+
+#ifndef CLUSTER_MEMBERS
+#define CLUSTER_MEMBERS "/etc/lykron/members"
+#endif
+
+#ifndef REBOOT_STAMP
+#define REBOOT_STAMP "/run/lykron.reboot"
+#endif
+
+#ifndef REBOOT_MAX_PARALLEL
+#define REBOOT_MAX_PARALLEL 4
+#endif
+
+#ifndef SCHED_DUESET
+#define SCHED_DUESET false
+#endif
+
+#ifndef DUESET_MAX_CATCHUP
+#define DUESET_MAX_CATCHUP 3600
+#endif
+
 #ifndef INIT_INTERVAL_WIDTH
 #define INIT_INTERVAL_WIDTH 86400
 #endif
@@ -46,6 +130,94 @@
 #define INIT_NUM_BUCKETS 1825
 #endif
 
+#ifndef LOG_FILE
+#define LOG_FILE "/var/log/lykron.log"
+#endif
+
+#ifndef LOG_SOCKET
+#define LOG_SOCKET "/dev/log"
+#endif
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 4096
+#endif
+
+#ifndef LOG_BATCH_MAX
+#define LOG_BATCH_MAX 64
+#endif
+
+#ifndef LOG_FLUSH_INTERVAL
+#define LOG_FLUSH_INTERVAL 250
+#endif
+
+#ifndef SPILL_DIR
+#define SPILL_DIR "/var/log/lykron/spill"
+#endif
+
+#ifndef OUTPUT_CAP_DFL
+#define OUTPUT_CAP_DFL 64
+#endif
+
+#ifndef INIT_SCHEDPOOL_SIZE
+#define INIT_SCHEDPOOL_SIZE 64
+#endif
+
+#ifndef INIT_JOBSTORE_SIZE
+#define INIT_JOBSTORE_SIZE 16
+#endif
+
+#ifndef INIT_MEMBERS_SIZE
+#define INIT_MEMBERS_SIZE 8
+#endif
+
+#ifndef CGROUP_ROOT
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#endif
+
+#ifndef CGROUP_USER_ROOT
+#define CGROUP_USER_ROOT "lykron.slice/user"
+#endif
+
+#ifndef MAX_CPUS
+#define MAX_CPUS 1024
+#endif
+
+#ifndef SPAWN_MAX_PAYLOAD
+#define SPAWN_MAX_PAYLOAD (64 * 1024)
+#endif
+
+#ifndef MAIL_SENDMAIL
+#define MAIL_SENDMAIL "/usr/sbin/sendmail -oi -t"
+#endif
+
+#ifndef MAIL_DIGEST_WINDOW
+#define MAIL_DIGEST_WINDOW 900
+#endif
+
+#ifndef MAIL_DIGEST_MAX
+#define MAIL_DIGEST_MAX (256 * 1024)
+#endif
+
+#ifndef STATUS_FILE
+#define STATUS_FILE "/run/lykron.status"
+#endif
+
+#ifndef STATUS_GROUP
+#define STATUS_GROUP "lykron"
+#endif
+
+#ifndef STATUS_MAX_JOBS
+#define STATUS_MAX_JOBS 4096
+#endif
+
+#ifndef INIT_CHILDTBL_SIZE
+#define INIT_CHILDTBL_SIZE 256
+#endif
+
+#ifndef CHILD_EXIT_TTL
+#define CHILD_EXIT_TTL 2
+#endif
+
 #define PHI 0x5851f42dULL
 
 #define MAX_BUF 4096
@@ -53,18 +225,37 @@
 #define MAX_INTEGER 24
 #define MAX_NUM_TOKEN 24
 #define MAX_SYM_TOKEN 5
+#define MAX_DIRECTIVE_LEN 16
+#define MAX_LABEL_LEN 64
+#define MAX_VAR_NAME 128
+#define MAX_LOG_RECORD 512
+#define MAX_LOG_LINE (MAX_LOG_RECORD + 128)
+#define MAX_STATUS_PATH 128
+#define MAX_STATUS_COMMAND 128
+
+#define STATUS_MAGIC 0x534b594cU
+#define STATUS_VERSION 2
+
+#define HANDOFF_ENV "LYKRON_HANDOFF_FD"
+#define HANDOFF_MAGIC 0x484b594cU
+#define HANDOFF_VERSION 2
 
 #define ARGC_DFL 32
 
 #define NLIM 32
 #define TIME_UNSPEC (time_t)-1
 
+#define NUM_Secs 60
 #define NUM_Mins 60
 #define NUM_Hours 24
 #define NUM_DoM 32
 #define NUM_Month 13
 #define NUM_DoW 8
 
+#define DUESET_VECTOR_BYTES 32
+#define DUESET_WORD_LANES (DUESET_VECTOR_BYTES / 8)
+#define DUESET_WORD_BITS (DUESET_VECTOR_BYTES * 8)
+
 #define LOOKAHEAD(sptr) (*(sptr + 1))
 
 #define SKIP_Whitespace(sptr)                                                 \
@@ -75,23 +266,89 @@
     }                                                                         \
   while (0)
 
-#define MARK_UpperBit (tok) (tok | 0x80000000)
-#define MARK_UpperBitIsSet (tok) (tok & 0x80000000)
-#define STEP_GetLower (tok) (tok & 0x000000FF)
-#define STEP_GetHigher (tok) ((tok & 0x0000FF00) >> 8)
+#define MARK_UpperBit(tok) ((tok) | 0x80000000)
+#define MARK_UpperBitIsSet(tok) ((tok) & 0x80000000)
+#define RANGE_GetLower(tok) ((tok) & 0x000000FF)
+#define RANGE_GetUpper(tok) (((tok) & 0x0000FF00) >> 8)
 
 typedef struct Timeset
 {
+  bool secs[NUM_Secs];
   bool mins[NUM_Mins];
   bool hours[NUM_Hours];
   bool dom[NUM_DoM];
   bool month[NUM_Month];
   bool dow[NUM_DoW];
+  time_t every;
+  bool reboot;
 } Timeset;
 
+typedef struct JobLimits
+{
+  uint64_t cpus[MAX_CPUS / 64];
+  int nice;
+  int ioprio;
+  bool has_cpus;
+  bool has_nice;
+  bool has_ioprio;
+  bool has_cgroup;
+} JobLimits;
+
+typedef struct JobCgroup
+{
+  char *path;
+  char *cpu_max;
+  char *memory_max;
+  bool ready;
+} JobCgroup;
+
+typedef enum
+{
+  PRIO_High,
+  PRIO_Normal,
+  PRIO_Low,
+} JobPriority;
+
+typedef struct StatusRecord
+{
+  atomic_uint seq;
+  uint32_t in_use;
+  int32_t pid;
+  int32_t last_exit;
+  int64_t last_start;
+  int64_t last_duration;
+  int64_t next_fire;
+  uint64_t num_runs;
+  char tab[MAX_STATUS_PATH];
+  char label[MAX_LABEL_LEN + 1];
+  char command[MAX_STATUS_COMMAND];
+} StatusRecord;
+
+typedef struct StatusHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_records;
+  uint32_t record_size;
+  int64_t started;
+  uint64_t num_dropped;
+} StatusHeader;
+
+typedef struct StatusPage
+{
+  StatusHeader *hdr;
+  StatusRecord *records;
+  size_t map_len;
+  int fd;
+  uint32_t *free_slots;
+  size_t num_free;
+  pthread_mutex_t lock;
+} StatusPage;
+
 typedef struct CronJob
 {
-  Timeset timeset;
+  size_t idx;
+  size_t member_idx;
   const uint8_t *command;
   size_t command_len;
   char **argv;
@@ -100,11 +357,37 @@ typedef struct CronJob
   const char user[LOGIN_NAME_MAX + 1];
   uid_t uid;
   gid_t gid;
-  pid_t pid;
 
-  struct CronJob *next;
+  size_t output_cap;
+  size_t num_truncated;
+  JobLimits limits;
+  JobCgroup cgroup;
+  JobPriority priority;
+  bool cluster_once;
+  atomic_bool owned;
+  int reboot_order;
+  atomic_bool deferred;
+  StatusRecord *status;
+  char *label;
+  char *after_label;
+  bool after_success;
+  size_t *dependents;
+  size_t num_dependents;
+  struct Logger *logger;
+  struct CronTab *tab;
 } CronJob;
 
+typedef struct JobStore
+{
+  CronJob *jobs;
+  struct Schedule **schedules;
+  pid_t *pids;
+  atomic_bool *paused;
+  time_t *first_fires;
+  size_t num_jobs;
+  size_t max_jobs;
+} JobStore;
+
 typedef struct Symtbl
 {
   struct Symbol
@@ -116,56 +399,414 @@ typedef struct Symtbl
       uint8_t *v_str;
     } value;
     bool occupied;
+    bool numeric;
   } *symbols;
   size_t num_symbols;
   size_t max_symbols;
+  size_t log2;
 } Symtbl;
 
 typedef struct EventNotice
 {
   time_t time;
   CronJob *job;
+  struct Schedule *schedule;
+  time_t backoff;
+  time_t deadline;
   int bucket_idx;
-  struct EventNotice *prev, *next;
+  bool forced;
+  struct EventNotice *next;
 } EventNotice;
 
+typedef struct BucketSlot
+{
+  time_t time;
+  EventNotice *evt;
+} BucketSlot;
+
 typedef struct EventBucket
 {
-  time_t key;
+  BucketSlot *slots;
   size_t num_notices;
-  bool is_dummy;
-  EventNotice anchor;
+  size_t max_notices;
 } EventBucket;
 
+typedef enum
+{
+  DUECOL_Secs = 0,
+  DUECOL_Mins = DUECOL_Secs + NUM_Secs,
+  DUECOL_Hours = DUECOL_Mins + NUM_Mins,
+  DUECOL_DoM = DUECOL_Hours + NUM_Hours,
+  DUECOL_Month = DUECOL_DoM + NUM_DoM,
+  DUECOL_DoW = DUECOL_Month + NUM_Month,
+  DUECOL_NumColumns = DUECOL_DoW + NUM_DoW,
+} DueColumn;
+
+typedef uint64_t DueWord __attribute__ ((vector_size (DUESET_VECTOR_BYTES)));
+
+typedef struct DueSet
+{
+  DueWord *columns;
+  size_t num_words;
+  struct Schedule **schedules;
+  struct Schedule **due;
+  size_t num_schedules;
+  uint64_t secs_mask;
+  time_t last_tick;
+} DueSet;
+
+typedef struct Schedule
+{
+  Timeset timeset;
+  uint32_t hash;
+  ssize_t due_bit;
+  size_t refs;
+  CronJob **members;
+  size_t num_members;
+  size_t max_members;
+  EventNotice notice;
+  _Atomic (time_t) next_fire;
+  struct SchedulePool *pool;
+  struct Schedule *next;
+} Schedule;
+
+typedef struct SchedulePool
+{
+  Schedule **slots;
+  size_t max_slots;
+  size_t num_schedules;
+  pthread_mutex_t lock;
+} SchedulePool;
+
+typedef struct RcuReader
+{
+  atomic_size_t seen;
+  atomic_size_t *gp_epoch;
+} RcuReader;
+
+typedef struct TabSwap
+{
+  struct CronTab *old_tab;
+  struct CronTab *new_tab;
+  atomic_bool done;
+  struct TabSwap *next;
+} TabSwap;
+
+typedef struct Admission
+{
+  sem_t slots;
+  atomic_size_t num_admitted;
+  atomic_size_t num_contended;
+} Admission;
+
 typedef struct Scheduler
 {
   EventBucket *buckets;
   size_t num_buckets;
   size_t curr_bucket;
+  size_t num_queued;
+  size_t resize_at;
   time_t lower_bound;
   time_t interval_width;
+  int wake_fd;
+  _Atomic (EventNotice *) posted;
+  _Atomic (TabSwap *) swaps;
+  RcuReader *rcu;
+  Admission *admission;
+  SchedulePool *pool;
+  DueSet *dueset;
+  struct Spawner *spawner;
+  time_t slack;
+  time_t started;
+  atomic_size_t num_fires;
+  atomic_size_t num_wakeups;
+  atomic_size_t added_latency;
+  atomic_size_t num_latency_samples;
+  atomic_size_t num_deferrals;
+  _Atomic (double) pressure;
+  time_t pressure_sampled;
 } Scheduler;
 
+typedef struct ShardSet
+{
+  Scheduler **shards;
+  pthread_t *threads;
+  size_t num_shards;
+  Admission admission;
+} ShardSet;
+
+typedef enum
+{
+  LOGREC_Out,
+  LOGREC_Err,
+  LOGREC_ExitStat,
+  LOGREC_Truncated,
+  LOGREC_Dropped,
+  LOGREC_Syntax,
+  LOGREC_SpawnErr,
+} LogRecordKind;
+
+typedef struct LogRecord
+{
+  atomic_size_t seq;
+  LogRecordKind kind;
+  pid_t pid;
+  time_t time;
+  bool syslog;
+  size_t text_len;
+  char text[MAX_LOG_RECORD];
+} LogRecord;
+
+typedef struct LogSpill
+{
+  int fd;
+  off_t offset;
+  pid_t pid;
+  char path[PATH_MAX + 1];
+  struct LogSpill *next;
+} LogSpill;
+
+typedef struct LogRing
+{
+  LogRecord *records;
+  size_t mask;
+  atomic_size_t head;
+  size_t tail;
+  atomic_size_t num_dropped;
+  atomic_size_t num_truncated;
+  atomic_bool sleeping;
+  atomic_bool running;
+  int wake_fd;
+  int log_fd;
+  int syslog_fd;
+  pthread_t writer;
+  _Atomic (LogSpill *) spills;
+  struct Mailer *mailer;
+} LogRing;
+
+typedef struct ChildTable
+{
+  struct Child
+  {
+    pid_t pid;
+    CronJob *job;
+    int out_fd;
+    int err_fd;
+  } *children;
+  size_t num_children;
+  size_t max_children;
+  struct ChildExit
+  {
+    struct Child child;
+    pid_t pid;
+    int exit_stat;
+    struct rusage usage;
+    time_t reaped;
+  } *exits;
+  size_t num_exits;
+  size_t max_exits;
+  atomic_bool adopting;
+  pthread_mutex_t lock;
+} ChildTable;
+
+typedef struct SpawnRequest
+{
+  char user[LOGIN_NAME_MAX + 1];
+  uid_t uid;
+  gid_t gid;
+  JobLimits limits;
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t payload_len;
+} SpawnRequest;
+
+typedef struct SpawnReply
+{
+  pid_t pid;
+  int err;
+} SpawnReply;
+
+typedef struct Spawner
+{
+  int sock;
+  pid_t pid;
+  pthread_mutex_t lock;
+  char payload[SPAWN_MAX_PAYLOAD];
+} Spawner;
+
+typedef struct MailDigest
+{
+  char *recipient;
+  char *sender;
+  char *body;
+  size_t body_len;
+  size_t max_body;
+  size_t num_runs;
+  time_t opened;
+  time_t window;
+  size_t max_len;
+  struct MailDigest *next;
+} MailDigest;
+
+typedef struct Mailer
+{
+  MailDigest *digests;
+  ChildTable *children;
+  const char *sendmail;
+  pthread_mutex_t lock;
+} Mailer;
+
 typedef struct Logger
 {
   const char *mail_from;
   const char *mail_to;
+  time_t mail_window;
+  size_t mail_max;
   bool syslog;
+  bool block_on_full;
+  LogRing *ring;
+  ChildTable *children;
+  Mailer *mailer;
 } Logger;
 
 typedef struct CronTab
 {
   const char path[PATH_MAX + 1];
   const char user[LOGIN_NAME_MAX + 1];
-  time_t mtime;
 
   Symtbl *stab;
   Scheduler *sched;
   Logger *logger;
-  CronJob *first_job;
-  struct CronTab *next;
+  JobStore store;
+  char **envp;
+  bool is_main;
+  atomic_bool paused;
+  atomic_size_t refs;
 } CronTab;
 
+typedef struct TabSet
+{
+  CronTab **tabs;
+  size_t num_tabs;
+  size_t max_tabs;
+  size_t generation;
+} TabSet;
+
+typedef struct Cluster
+{
+  char self[HOST_NAME_MAX + 1];
+  uint64_t self_hash;
+  uint64_t *members;
+  size_t num_members;
+  bool is_dir;
+  char watch_dir[PATH_MAX + 1];
+  const char *watch_only;
+  char members_dir[PATH_MAX + 1];
+} Cluster;
+
+typedef struct HandoffHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_jobs;
+  uint32_t num_children;
+  int64_t written;
+  int32_t reply_fd;
+} HandoffHeader;
+
+typedef struct HandoffJob
+{
+  char path[PATH_MAX + 1];
+  uint32_t idx;
+  uint64_t hash;
+  int64_t next_fire;
+} HandoffJob;
+
+typedef struct HandoffChild
+{
+  HandoffJob job;
+  int32_t pid;
+  int32_t out_fd;
+  int32_t err_fd;
+} HandoffChild;
+
+typedef struct Handoff
+{
+  HandoffJob *jobs;
+  size_t num_jobs;
+  HandoffChild *children;
+  size_t num_children;
+  time_t written;
+  int reply_fd;
+} Handoff;
+
+typedef struct RebootRun
+{
+  CronJob **jobs;
+  size_t num_jobs;
+  pid_t *pids;
+  size_t num_pids;
+  size_t num_started;
+  size_t num_running;
+  size_t num_failed;
+  size_t max_running;
+  int64_t started;
+  int64_t elapsed;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  pthread_t thread;
+} RebootRun;
+
+typedef struct Reloader
+{
+  _Atomic (TabSet *) current;
+  atomic_size_t gp_epoch;
+  RcuReader readers[RCU_MAX_READERS];
+  atomic_size_t num_readers;
+  struct PendingSwap
+  {
+    TabSwap *swap;
+    struct PendingSwap *next;
+  } *pending;
+  struct Retired
+  {
+    void *ptr;
+    bool is_tabset;
+    size_t epoch;
+    struct Retired *next;
+  } *retired;
+  int inotify_fd;
+  struct WatchDir
+  {
+    int wd;
+    const char *dir;
+    const char *only;
+    bool dirs;
+  } *watches;
+  size_t num_watches;
+  struct Debounce
+  {
+    char path[PATH_MAX + 1];
+    uint64_t deadline;
+    struct Debounce *next;
+  } *debounce;
+  pthread_t thread;
+} Reloader;
+
+typedef struct Control
+{
+  int listen_fd;
+  Reloader *rld;
+  RcuReader *rcu;
+  struct ControlClient
+  {
+    int fd;
+    size_t buf_len;
+    char buf[MAX_BUF];
+  } clients[CONTROL_MAX_CLIENTS];
+  size_t num_clients;
+} Control;
+
 typedef enum
 {
   LINE_Comment,
@@ -182,21 +823,274 @@ typedef enum
   TSFIELD_DoM = 2,
   TSFIELD_Month = 3,
   TSFIELD_DoW = 4,
-  TSFIELD_TimesetField = 5,
+  TSFIELD_Secs = 5,
+  TSFIELD_TimesetField = 6,
 } TimesetField;
 
+static inline void
+_mem_out (void)
+{
+  fputs ("Out of memory\n", stderr);
+  exit (EXIT_FAILURE);
+}
+
+static inline void *
+memAllocSafe (size_t size)
+{
+  void *ptr = calloc (1, size);
+  if (ptr == NULL)
+    _mem_out ();
+  return ptr;
+}
+
+static inline void *
+memAllocBlockSafe (size_t nmemb, size_t size)
+{
+  void *ptr = calloc (nmemb, size);
+  if (ptr == NULL)
+    _mem_out ();
+  return ptr;
+}
+
+static inline void *
+memReallocSafe (void *ptr, size_t old_nmemb, size_t new_nmemb, size_t size)
+{
+  void *new_ptr = realloc (ptr, new_nmemb * size);
+  if (new_ptr == NULL)
+    _mem_out ();
+  if (new_nmemb > old_nmemb)
+    memset ((char *)new_ptr + old_nmemb * size, 0,
+            (new_nmemb - old_nmemb) * size);
+  return new_ptr;
+}
+
+static inline void
+memDeallocSafe (const void *ptr)
+{
+  free ((void *)ptr);
+}
+
+static inline void *
+memCopySafe (void *dst, const void *src, size_t size)
+{
+  if (size == 0)
+    return dst;
+  return memcpy (dst, src, size);
+}
+
+/* tab.c */
+Symtbl *symtblNew (void);
+void symtblDelete (Symtbl *stab);
+void symtblSet (Symtbl *stab, const char *key, size_t key_len,
+                const char *value, size_t value_len);
+void symtblSetNumeric (Symtbl *stab, const char *key, size_t key_len,
+                       int value);
+char *symtblGet (Symtbl *stab, const char *key);
+int symtblGetNumeric (Symtbl *stab, const char *key);
+char **symtblGetEnvironPointer (Symtbl *stab);
+CronTab *crontabNew (const char *path, const char *user, bool is_main);
+CronTab *crontabNewDetached (const char *path, const char *user,
+                             bool is_main);
+void crontabDelete (CronTab *ct);
+void crontabWatchInotify (Reloader *rld);
+RcuReader *rcuRegister (Reloader *rld);
+void rcuQuiescent (RcuReader *rdr);
+void rcuOffline (RcuReader *rdr);
+void rcuOnline (RcuReader *rdr);
+TabSet *crontabLoadAll (void);
+Reloader *reloaderNew (TabSet *set, ShardSet *ss);
+void reloaderStart (Reloader *rld);
+void reloaderReload (Reloader *rld, const char *path);
+void reloaderCollect (Reloader *rld);
+CronTab *crontabLoadFromFile (const char *path, bool is_main);
+
+/* parser.c */
+int parserLexNumeric (const char **lnptr);
+int parserLexSymbolic (const char **lnptr);
+int parserLexToken (const char **lnptr);
+void parserHandleField (Timeset *ts, const char *lnptr, TimesetField tsfld);
+const char *parserHandleFields (Timeset *ts, const char *lnptr,
+                                bool with_secs);
+const char *parserHandleLabel (const char *lnptr, char *label);
+const char *parserHandleDirective (Timeset *ts, const char *lnptr,
+                                   char *after_label, bool *after_success);
+char *parserExpandValue (Symtbl *stab, const char *value, size_t value_len);
+const char *parserHandleUser (const char *lnptr, char *userptr);
+void parserHandleCommand (const char *lnptr, char **cmdptr, size_t *cmdlenptr);
+size_t parserGetOutputCap (Symtbl *stab);
+JobPriority parserGetPriority (Symtbl *stab);
+bool parserGetClusterOnce (Symtbl *stab);
+bool parserGetSeconds (Symtbl *stab);
+int parserGetRebootOrder (Symtbl *stab);
+time_t parserGetMailWindow (Symtbl *stab);
+size_t parserGetMailMax (Symtbl *stab);
+void parserParseStream (CronTab *ct, FILE *fstream);
+void parserParseTable (CronTab *ct);
+
+/* job.c */
+time_t timesetComputeNextOccurence (Timeset *ts, time_t now);
+bool *timesetGetFieldOffset (Timeset *ts, TimesetField field);
+void timesetDoGlob (Timeset *ts, int step, TimesetField field);
+void timesetDoList (Timeset *ts, int *lst, size_t lstlen, TimesetField field);
+void timesetDoEvery (Timeset *ts, time_t every);
+void timesetDoReboot (Timeset *ts);
+void timesetDoYearly (Timeset *ts);
+void timesetDoMonthly (Timeset *ts);
+void timesetDoWeekly (Timeset *ts);
+void timesetDoDaily (Timeset *ts);
+void timesetDoHourly (Timeset *ts);
+uint32_t timesetHash (const Timeset *ts);
+bool timesetEqual (const Timeset *ts1, const Timeset *ts2);
+void jobstoreInit (JobStore *store);
+CronJob *jobstorePush (JobStore *store, SchedulePool *pool, Timeset *ts,
+                       const char *command, size_t command_len,
+                       const char *user);
+void jobstorePrepareFires (JobStore *store, time_t now);
+void jobstoreDelete (JobStore *store);
+pid_t cronjobExecute (CronJob *cj);
+void cronjobTriggerDependents (CronJob *cj, int exit_stat);
+void cronjobScheduleInit (Scheduler *sched, JobStore *store);
+void cronjobPrepCommand (CronJob *cj);
+
+/* scheduler.c */
+SchedulePool *schedpoolNew (void);
+void schedpoolDelete (SchedulePool *pool);
+Schedule *schedpoolIntern (SchedulePool *pool, const Timeset *ts);
+void schedpoolRelease (Schedule *sc);
+EventNotice *noticeNew (time_t time, CronJob *job);
+Scheduler *schedulerNew (void);
+void schedulerDelete (Scheduler *sched);
+void schedulerBulkLoad (Scheduler *sched, EventNotice **evts, size_t num_evts);
+EventNotice *schedulerRemoveMin (Scheduler *sched);
+void schedulerInsert (Scheduler *sched, EventNotice *evt);
+void schedulerUnlink (Scheduler *sched, EventNotice *evt);
+void schedulerHold (Scheduler *sched, EventNotice *evt, time_t delay);
+EventNotice *scheduleAddMember (CronJob *cj);
+time_t scheduleNextFire (Schedule *sc);
+bool schedulerOfferDue (Scheduler *sched, EventNotice *evt);
+void scheduleJoin (Scheduler *sched, CronJob *cj);
+void scheduleLeave (Scheduler *sched, CronJob *cj);
+void admissionInit (Admission *adm, size_t max_inflight);
+void admissionEnter (Admission *adm);
+void admissionLeave (Admission *adm);
+void schedulerExecuteLoop (Scheduler *sched);
+size_t shardsetCount (size_t num_shards);
+ShardSet *shardsetNew (size_t num_shards);
+ShardSet *shardsetGet (void);
+Scheduler *shardsetPick (ShardSet *ss, const char *key);
+void shardsetStart (ShardSet *ss);
+void shardsetReport (ShardSet *ss, FILE *fstream);
+size_t shardsetFires (ShardSet *ss);
+void schedulerPost (Scheduler *sched, CronJob *cj, bool forced);
+void schedulerAwaitPressure (Scheduler *sched, JobPriority prio);
+void schedulerPublish (Scheduler *sched, TabSwap *swap);
+
+/* logger.c */
+bool logringPush (LogRing *ring, LogRecordKind kind, pid_t pid, bool syslog,
+                  const char *text, size_t text_len);
+LogRecord *logringPeek (LogRing *ring);
+void logringPop (LogRing *ring, LogRecord *rec);
+void *loggerWriterLoop (void *arg);
+ChildTable *childtblNew (void);
+void childtblDelete (ChildTable *ctbl);
+pid_t childtblFork (ChildTable *ctbl, CronJob *cj);
+pid_t childtblSpawn (ChildTable *ctbl, CronJob *cj, int out_fd, int err_fd);
+void childtblAdopt (ChildTable *ctbl, const struct Child *child);
+ChildTable *childtblGet (void);
+bool childtblReap (ChildTable *ctbl, pid_t pid, int exit_stat,
+                   const struct rusage *usage, struct Child *child);
+size_t childtblTakeExits (ChildTable *ctbl, time_t now,
+                          struct ChildExit *exits, size_t max_exits);
+size_t childtblPendingExits (ChildTable *ctbl);
+Logger *loggerNew (void);
+void loggerDelete (Logger *lgr);
+void loggerQuiesce (void);
+void loggerResume (void);
+void loggerShutdown (void);
+pid_t loggerSpawnChild (Logger *lgr, CronJob *cj, int out_fd, int err_fd);
+void loggerLogOut (Logger *lgr, pid_t pid, const char *ln, size_t ln_len);
+void loggerLogErr (Logger *lgr, pid_t pid, const char *ln, size_t ln_len);
+void loggerLogExitStat (Logger *lgr, pid_t pid, int exit_stat,
+                        const struct rusage *usage);
+void loggerLogSyntaxErr (Logger *lgr, const char *path, const char *msg);
+void loggerLogSpawnErr (Logger *lgr, CronJob *cj, int err);
+size_t loggerDrainChildren (Logger *lgr);
+void loggerReapChildren (Logger *lgr);
+void loggerLogReapedChild (Logger *lgr, pid_t reaped_pid, int reaped_exit_stat,
+                           const struct rusage *reaped_usage);
+
+/* mail.c */
+Mailer *mailerNew (ChildTable *children);
+void mailerDelete (Mailer *mlr);
+void mailerAppend (Mailer *mlr, const char *from, const char *to,
+                   time_t window, size_t max_len, const char *text,
+                   size_t text_len);
+void mailerFlushDue (Mailer *mlr, time_t now, bool force);
+
+/* spawner.c */
+int spawnerOpenCapture (void);
+bool spawnerPrepareCgroup (JobCgroup *cg);
+Spawner *spawnerNew (void);
+Spawner *spawnerStart (void);
+Spawner *spawnerGet (void);
+Spawner *spawnerTake (size_t shard_idx);
+void spawnerStop (Spawner *spw);
+pid_t spawnerSpawn (Spawner *spw, CronJob *cj, int out_fd, int err_fd);
+
+/* control.c */
+Control *controlNew (Reloader *rld);
+void controlDelete (Control *ctl);
+void controlServe (Control *ctl);
+
+/* cluster.c */
+Cluster *clusterGet (void);
+bool clusterOwns (Cluster *cl, CronJob *cj);
+void clusterAssignTab (Cluster *cl, CronTab *ct);
+bool clusterIsMembership (Cluster *cl, const char *path);
+void clusterReload (Cluster *cl, TabSet *set);
+
+/* dueset.c */
+DueSet *duesetNew (void);
+void duesetDelete (DueSet *ds);
+void duesetAdd (DueSet *ds, Schedule *sc);
+void duesetRemove (DueSet *ds, Schedule *sc);
+time_t duesetNextTick (DueSet *ds);
+size_t duesetCollect (DueSet *ds, time_t tick);
+
+/* handoff.c */
+Handoff *handoffGet (void);
+time_t handoffNextFire (CronJob *cj);
+void handoffAdoptChildren (TabSet *set);
+bool handoffExec (TabSet *set, int reply_fd);
+
+/* reboot.c */
+void rebootStart (TabSet *set);
+void rebootFinish (pid_t pid, int exit_stat);
+void rebootReport (FILE *fstream);
+
+/* status.c */
+StatusPage *statusGet (void);
+void statusAcquire (CronJob *cj);
+void statusRelease (CronJob *cj);
+void statusRecordNext (CronJob *cj, time_t next_fire);
+void statusRecordStart (CronJob *cj, pid_t pid);
+void statusRecordExit (CronJob *cj, pid_t pid, int exit_stat);
+
 static Symtbl *GLOBAL_STAB = NULL;
 
-static const int TSFIELD_NUMS_LUT[TimesetField] = {
+static const int TSFIELD_NUMS_LUT[TSFIELD_TimesetField + 1] = {
   [TSFIELD_Mins] = NUM_Mins, [TSFIELD_Hours] = NUM_Hours,
   [TSFIELD_DoM] = NUM_DoM,   [TSFIELD_Month] = NUM_Month,
-  [TSFIELD_DoW] = NUM_DoW,   [TSFIELD_TimesetField] = -1,
+  [TSFIELD_DoW] = NUM_DoW,   [TSFIELD_Secs] = NUM_Secs,
+  [TSFIELD_TimesetField] = -1,
 };
 
 static const char *TABLE_DIRS[] = {
   "/etc/lykron.d/",
   "/var/spool/lykron/",
+#ifdef TABLE_DIRS_ADDITIONAL
   TABLE_DIRS_ADDITIONAL,
+#endif
   NULL,
 };
 
@@ -234,12 +1128,12 @@ _knuth_hash32 (const uint8_t *data)
 static inline void
 _free_envptr (const char **envp)
 {
-  for (char *e = *envp; e; e++)
-    memDeallocSafe (e);
+  for (const char **e = envp; *e != NULL; e++)
+    memDeallocSafe (*e);
   memDeallocSafe (envp);
 }
 
-static inline char *
+static inline const char *
 _get_tmp_dir (void)
 {
   const char *tmpdir = getenv ("TMPDIR");
@@ -248,10 +1142,29 @@ _get_tmp_dir (void)
   return tmpdir;
 }
 
+/* Daemons sharing a host as cluster nodes each get their own runtime
+   files, CLUSTER_NODE inserted before the extension.  */
+static inline const char *
+_instance_path (const char *path, char *buf)
+{
+  const char *node = getenv ("CLUSTER_NODE");
+  if (node == NULL || *node == '\0' || strchr (node, '/') != NULL)
+    return path;
+
+  const char *ext = strrchr (strrchr (path, '/') + 1, '.');
+  if (ext == NULL)
+    ext = path + strlen (path);
+
+  snprintf (buf, PATH_MAX + 1, "%.*s.%s%s", (int)(ext - path), path, node,
+            ext);
+  return buf;
+}
+
 static inline void
 _write_pid_file (void)
 {
-  FILE *fstream = fopen (CROND_PID_FILE, "w");
+  char path[PATH_MAX + 1];
+  FILE *fstream = fopen (_instance_path (CROND_PID_FILE, &path[0]), "w");
   if (fstream == NULL)
     {
       perror ("fopen");
@@ -264,14 +1177,15 @@ _write_pid_file (void)
 static inline pid_t
 _get_pid_from_file (void)
 {
-  FILE *fstream = fopen (CROND_PID_FILE, "r");
+  char path[PATH_MAX + 1];
+  FILE *fstream = fopen (_instance_path (CROND_PID_FILE, &path[0]), "r");
   if (fstream == NULL)
     {
       perror ("fopen");
       exit (EXIT_FAILURE);
     }
   pid_t pid = 0;
-  sscanf (fstream, "%d\n", &pid);
+  fscanf (fstream, "%d\n", &pid);
   fclose (fstream);
   return pid;
 }
@@ -279,38 +1193,73 @@ _get_pid_from_file (void)
 static inline void
 _delete_pid_file (void)
 {
-  unlink (CROND_PID_FILE);
+  char path[PATH_MAX + 1];
+  unlink (_instance_path (CROND_PID_FILE, &path[0]));
 }
 
 static inline void
 _err_out (const char *msg)
 {
   size_t msglen = strlen (msg);
-  char msgdup[msglen + 4] = { '\n' };
-  strncat (&msgdup[0], msg, msglen);
+  char msgdup[msglen + 2];
+  msgdup[0] = '\n';
+  memcpy (&msgdup[1], msg, msglen + 1);
   perror (&msgdup[0]);
   _delete_pid_file ();
   exit (EXIT_FAILURE);
 }
 
-static inline void
-_raise_syntax_err (const char *msg, size_t lnno, size_t colno)
+/* A job belongs to its table from the moment the parser pushes it, so
+   cj->tab is never NULL outside jobstorePush.  */
+static inline Schedule *
+_job_schedule (const CronJob *cj)
 {
-  fprintf (stderr, "Syntax error: %s, line: %lu, column: %lu\n", msg, lnno,
-           colno);
+  return cj->tab->store.schedules[cj->idx];
+}
+
+static inline pid_t *
+_job_pid (const CronJob *cj)
+{
+  return &cj->tab->store.pids[cj->idx];
+}
+
+static inline atomic_bool *
+_job_paused (const CronJob *cj)
+{
+  return &cj->tab->store.paused[cj->idx];
+}
+
+extern _Thread_local jmp_buf *SYNTAX_ERR_JMP;
+extern _Thread_local char SYNTAX_ERR_MSG[MAX_LOG_RECORD];
+
+static inline __attribute__ ((noreturn)) void
+_unwind_syntax_err (void)
+{
+  if (SYNTAX_ERR_JMP != NULL)
+    longjmp (*SYNTAX_ERR_JMP, 1);
+
+  fprintf (stderr, "Syntax error: %s\n", &SYNTAX_ERR_MSG[0]);
   _delete_pid_file ();
   exit (EXIT_FAILURE);
 }
 
+static inline __attribute__ ((noreturn)) void
+_raise_syntax_err (const char *msg, size_t lnno, size_t colno)
+{
+  snprintf (&SYNTAX_ERR_MSG[0], MAX_LOG_RECORD, "%s, line: %lu, column: %lu",
+            msg, lnno, colno);
+  _unwind_syntax_err ();
+}
+
 static inline void
 _intern_symbolic_tokens (void)
 {
   static const char *const symbols[] = {
-    "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "ot",
+    "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct",
     "nov", "dec", "mon", "tue", "wed", "thu", "fri", "sat", "sun", NULL,
   };
   static const int values[] = {
-    1, 2, 3, 4, 5, 6, 7, 8, 8, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7, -1,
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 1, 2, 3, 4, 5, 6, 0, -1,
   };
 
   GLOBAL_STAB = symtblNew ();
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+Mailer *
+mailerNew (ChildTable *children)
+{
+  Mailer *mlr = memAllocSafe (sizeof (Mailer));
+  mlr->digests = NULL;
+  mlr->children = children;
+  mlr->sendmail = getenv ("LYKRON_SENDMAIL");
+  if (mlr->sendmail == NULL)
+    mlr->sendmail = MAIL_SENDMAIL;
+  pthread_mutex_init (&mlr->lock, NULL);
+
+  return mlr;
+}
+
+void
+mailerDelete (Mailer *mlr)
+{
+  mailerFlushDue (mlr, time (NULL), true);
+  pthread_mutex_destroy (&mlr->lock);
+  memDeallocSafe (mlr);
+}
+
+static MailDigest *
+digestNew (const char *from, const char *to, time_t now, time_t window,
+           size_t max_len)
+{
+  MailDigest *dg = memAllocSafe (sizeof (MailDigest));
+  dg->recipient = strdup (to);
+  dg->sender = from != NULL ? strdup (from) : NULL;
+  dg->body = memAllocBlockSafe (MAX_BUF, sizeof (char));
+  dg->body_len = 0;
+  dg->max_body = MAX_BUF;
+  dg->num_runs = 0;
+  dg->opened = now;
+  dg->window = window;
+  dg->max_len = max_len;
+  dg->next = NULL;
+
+  return dg;
+}
+
+static void
+digestDelete (MailDigest *dg)
+{
+  memDeallocSafe (dg->recipient);
+  memDeallocSafe (dg->sender);
+  memDeallocSafe (dg->body);
+  memDeallocSafe (dg);
+}
+
+/* A digest shared by several tables flushes on the tightest window and
+   size limit among them.  */
+void
+mailerAppend (Mailer *mlr, const char *from, const char *to, time_t window,
+              size_t max_len, const char *text, size_t text_len)
+{
+  if (to == NULL || *to == '\0' || text_len == 0)
+    return;
+
+  pthread_mutex_lock (&mlr->lock);
+
+  MailDigest *dg = mlr->digests;
+  while (dg != NULL && strcmp (dg->recipient, to))
+    dg = dg->next;
+
+  if (dg == NULL)
+    {
+      dg = digestNew (from, to, time (NULL), window, max_len);
+      dg->next = mlr->digests;
+      mlr->digests = dg;
+    }
+  if (window < dg->window)
+    dg->window = window;
+  if (max_len < dg->max_len)
+    dg->max_len = max_len;
+
+  if (dg->body_len + text_len >= dg->max_body)
+    {
+      size_t old_max_body = dg->max_body;
+      while (dg->body_len + text_len >= dg->max_body)
+        dg->max_body <<= 1;
+      dg->body = memReallocSafe (dg->body, old_max_body, dg->max_body,
+                                 sizeof (char));
+    }
+
+  memcpy (&dg->body[dg->body_len], text, text_len);
+  dg->body_len += text_len;
+  dg->num_runs++;
+
+  pthread_mutex_unlock (&mlr->lock);
+}
+
+static void
+mailerSendAll (int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n_sent = send (fd, buf, len, MSG_NOSIGNAL);
+      if (n_sent < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;
+        }
+      buf += n_sent;
+      len -= n_sent;
+    }
+}
+
+static void
+mailerSend (Mailer *mlr, MailDigest *dg)
+{
+  int sv[2];
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    return;
+
+  pid_t pid = childtblFork (mlr->children, NULL);
+  if (pid < 0)
+    {
+      close (sv[0]);
+      close (sv[1]);
+      return;
+    }
+
+  if (pid == 0)
+    {
+      dup2 (sv[1], STDIN_FILENO);
+      execl ("/bin/sh", "sh", "-c", mlr->sendmail, (char *)NULL);
+      _exit (EXIT_FAILURE);
+    }
+
+  close (sv[1]);
+
+  char host[HOST_NAME_MAX + 1] = { 0 };
+  char date[64] = { 0 };
+  char hdr[MAX_BUF] = { 0 };
+  struct tm tm;
+  time_t now = time (NULL);
+
+  gethostname (&host[0], HOST_NAME_MAX);
+  localtime_r (&now, &tm);
+  strftime (&date[0], sizeof (date), "%a, %d %b %Y %T %z", &tm);
+
+  int hdr_len = snprintf (
+      &hdr[0], sizeof (hdr),
+      "From: %s\nTo: %s\nDate: %s\nSubject: lykron on %s: %zu job run%s\n\n",
+      dg->sender != NULL ? dg->sender : "root", dg->recipient, &date[0],
+      &host[0], dg->num_runs, dg->num_runs == 1 ? "" : "s");
+
+  mailerSendAll (sv[0], &hdr[0], hdr_len);
+  mailerSendAll (sv[0], dg->body, dg->body_len);
+  close (sv[0]);
+}
+
+void
+mailerFlushDue (Mailer *mlr, time_t now, bool force)
+{
+  MailDigest *due = NULL;
+
+  pthread_mutex_lock (&mlr->lock);
+  for (MailDigest **dgp = &mlr->digests; *dgp != NULL;)
+    {
+      MailDigest *dg = *dgp;
+      if (force || dg->body_len >= dg->max_len
+          || now - dg->opened >= dg->window)
+        {
+          *dgp = dg->next;
+          dg->next = due;
+          due = dg;
+        }
+      else
+        dgp = &dg->next;
+    }
+  pthread_mutex_unlock (&mlr->lock);
+
+  while (due != NULL)
+    {
+      MailDigest *next = due->next;
+      mailerSend (mlr, due);
+      digestDelete (due);
+      due = next;
+    }
+}
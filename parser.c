@@ -1,17 +1,21 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <pwd.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wordexp.h>
 
 #include "lykron.h"
 
+_Thread_local jmp_buf *SYNTAX_ERR_JMP = NULL;
+_Thread_local char SYNTAX_ERR_MSG[MAX_LOG_RECORD];
+
 static inline LineKind
 parserAssessLineKind (const char *ln)
 {
-  if (ln == NULL || isblank (ln[0]))
+  if (ln == NULL || ln[0] == '\0' || isspace (ln[0]))
     return LINE_None;
   else if (ln[0] == '#')
     return LINE_Comment;
@@ -22,7 +26,7 @@ parserAssessLineKind (const char *ln)
   else if (isalpha (ln[0]))
     return LINE_Assign;
   else
-    _raise_syntax_err ("Unkown line");
+    _raise_syntax_err ("Unkown line", 0, 0);
 }
 
 int
@@ -31,22 +35,32 @@ parserLexNumeric (const char **lnptr)
   char buf[MAX_NUM_TOKEN + 1] = { 0 };
 
   for (size_t i = 0; i < MAX_NUM_TOKEN && isdigit (**lnptr); i++)
-    buf[i] = **lnptr++;
+    buf[i] = *(*lnptr)++;
+
+  if (isdigit (**lnptr))
+    _raise_syntax_err ("Numeric token too long", 0, 0);
 
-  return strtod (&buf[0], NULL);
+  long val = strtol (&buf[0], NULL, 10);
+  if (val > UINT8_MAX)
+    _raise_syntax_err ("Numeric token out of range", 0, 0);
+
+  return val;
 }
 
 int
-parsrLexSymbolic (const char **lnptr)
+parserLexSymbolic (const char **lnptr)
 {
   char buf[MAX_SYM_TOKEN + 1] = { 0 };
 
   for (size_t i = 0; i < MAX_SYM_TOKEN && isalpha (**lnptr); i++)
-    buf[i] = **lnptr++;
+    buf[i] = tolower (*(*lnptr)++);
+
+  if (isalpha (**lnptr))
+    _raise_syntax_err ("Symbolic token too long", 0, 0);
 
   int val = symtblGetNumeric (GLOBAL_STAB, &buf[0]);
   if (val == -1)
-    _raise_syntax_err ("Unknown symbol");
+    _raise_syntax_err ("Unknown symbol", 0, 0);
 
   return val;
 }
@@ -54,196 +68,863 @@ parsrLexSymbolic (const char **lnptr)
 int
 parserLexToken (const char **lnptr)
 {
-  if (isdigit (*lnptr))
+  if (isdigit (**lnptr))
     return parserLexNumeric (lnptr);
-  else
+  else if (isalpha (**lnptr))
     return parserLexSymbolic (lnptr);
+  else
+    _raise_syntax_err ("Expected token", 0, 0);
 }
 
 void
 parserHandleField (Timeset *ts, const char *lnptr, TimesetField tsfld)
 {
-  while (!isblank (*lnptr))
+  while (*lnptr && !isspace (*lnptr))
     {
-      char chr = *lnptr;
-
-      if (chr == '*')
+      if (*lnptr == '*')
         {
-          if (LOOKAHEAD (lnptr) == '/')
+          lnptr++;
+          if (*lnptr == '/')
             {
               lnptr++;
-              int tok = parserLexToken (&lnptr);
-              timesetDoGlob (ts, tok, tsfld);
+              timesetDoGlob (ts, parserLexToken (&lnptr), tsfld);
             }
           else
             timesetDoGlob (ts, -1, tsfld);
         }
-      else if (isalpha (lnptr) || isdigit (lnptr))
+      else if (isalnum (*lnptr))
         {
           int toklst[NUM_Mins + 1] = { -1 };
           size_t lstlen = 0;
           while (true)
             {
+              if (lstlen == NUM_Mins)
+                _raise_syntax_err ("Too many list elements", 0, 0);
+
               int tok = parserLexToken (&lnptr);
               if (*lnptr == '-')
                 {
                   lnptr++;
                   tok |= parserLexToken (&lnptr) << 8;
-                  MARK_UpperBit (tok);
+                  tok = MARK_UpperBit (tok);
                 }
               toklst[lstlen++] = tok;
-              if (*lnptr == ',')
-                {
-                  lnptr++;
-                  continue;
-                }
-              else
+              if (*lnptr != ',')
                 break;
+              lnptr++;
             }
           timesetDoList (ts, &toklst[0], lstlen, tsfld);
         }
-      lnptr++;
+      else
+        _raise_syntax_err ("Unexpected character in field", 0, 0);
     }
 }
 
-void
-parserHandleFields (Timeset *ts, const char *lnptr)
+const char *
+parserHandleFields (Timeset *ts, const char *lnptr, bool with_secs)
 {
-  static TimesetFiled tsflds[TSFIELD_TimesetField] = {
+  static const TimesetField tsflds_mins[] = {
     TSFIELD_Mins,  TSFIELD_Hours, TSFIELD_DoM,
     TSFIELD_Month, TSFIELD_DoW,   TSFIELD_TimesetField,
   };
+  static const TimesetField tsflds_secs[] = {
+    TSFIELD_Secs,  TSFIELD_Mins, TSFIELD_Hours,        TSFIELD_DoM,
+    TSFIELD_Month, TSFIELD_DoW,  TSFIELD_TimesetField,
+  };
+
+  const TimesetField *tsflds = &tsflds_mins[0];
+  if (with_secs)
+    tsflds = &tsflds_secs[0];
+  else
+    ts->secs[0] = true;
 
   for (size_t i = 0; tsflds[i] != TSFIELD_TimesetField; i++)
     {
       SKIP_Whitespace (lnptr);
-      parserHandleField (ts, lnptr, tsflds[i])
+      parserHandleField (ts, lnptr, tsflds[i]);
+      while (*lnptr && !isspace (*lnptr))
+        lnptr++;
     }
+
+  return lnptr;
 }
 
-void
-parserHandleDirective (Timeset *ts, const char *lnptr)
+static time_t
+parserLexDuration (const char **lnptr)
+{
+  time_t every = 0;
+
+  while (isblank (**lnptr))
+    (*lnptr)++;
+  while (isdigit (**lnptr))
+    {
+      time_t num = 0;
+      while (isdigit (**lnptr))
+        {
+          num = num * 10 + (*(*lnptr)++ - '0');
+          if (num > INT32_MAX)
+            _raise_syntax_err ("Duration too long", 0, 0);
+        }
+
+      switch (*(*lnptr)++)
+        {
+        case 's':
+          every += num;
+          break;
+        case 'm':
+          every += num * 60;
+          break;
+        case 'h':
+          every += num * 3600;
+          break;
+        case 'd':
+          every += num * 86400;
+          break;
+        default:
+          _raise_syntax_err ("Unknown duration unit", 0, 0);
+        }
+    }
+
+  if (every <= 0 || every > INT32_MAX || !isspace (**lnptr))
+    _raise_syntax_err ("Invalid duration", 0, 0);
+
+  return every;
+}
+
+static bool
+parserIsLabelChar (char chr)
+{
+  return isalnum (chr) || chr == '_' || chr == '-' || chr == '.';
+}
+
+static const char *
+parserLexLabel (const char *lnptr, char *label)
+{
+  size_t label_len = 0;
+
+  SKIP_Whitespace (lnptr);
+  while (parserIsLabelChar (*lnptr))
+    {
+      if (label_len == MAX_LABEL_LEN)
+        _raise_syntax_err ("Label too long", 0, 0);
+      label[label_len++] = *lnptr++;
+    }
+  label[label_len] = '\0';
+
+  if (label_len == 0)
+    _raise_syntax_err ("Expected label", 0, 0);
+
+  return lnptr;
+}
+
+const char *
+parserHandleLabel (const char *lnptr, char *label)
+{
+  const char *start = lnptr;
+
+  if (!isalpha (*lnptr))
+    return start;
+  while (parserIsLabelChar (*lnptr))
+    lnptr++;
+  if (*lnptr != ':' || lnptr - start > MAX_LABEL_LEN)
+    return start;
+
+  memcpy (label, start, lnptr - start);
+  label[lnptr - start] = '\0';
+  lnptr++;
+  SKIP_Whitespace (lnptr);
+
+  return lnptr;
+}
+
+const char *
+parserHandleDirective (Timeset *ts, const char *lnptr, char *after_label,
+                       bool *after_success)
 {
   char dir[MAX_DIRECTIVE_LEN + 1] = { 0 };
-  for (size_t i = 0; i < MAX_DIRECTIVE_LEN && !isblank (*lnptr); i++)
+  for (size_t i = 0; i < MAX_DIRECTIVE_LEN && *lnptr && !isspace (*lnptr);
+       i++)
     dir[i] = *lnptr++;
 
-  if (strncmp (dir, "@reboot", MAX_DIRECTIVE_LEN))
+  bool is_after = !strncmp (dir, "@after", MAX_DIRECTIVE_LEN)
+                  || !strncmp (dir, "@onsuccess", MAX_DIRECTIVE_LEN);
+
+  if (is_after)
+    {
+      lnptr = parserLexLabel (lnptr, after_label);
+      *after_success = dir[1] == 'o';
+    }
+  else if (!strncmp (dir, "@reboot", MAX_DIRECTIVE_LEN))
     timesetDoReboot (ts);
-  else if (strncmp (dir, "@yearly", MAX_DIRECTIVE_LEN))
+  else if (!strncmp (dir, "@every", MAX_DIRECTIVE_LEN))
+    timesetDoEvery (ts, parserLexDuration (&lnptr));
+  else if (!strncmp (dir, "@yearly", MAX_DIRECTIVE_LEN)
+           || !strncmp (dir, "@annually", MAX_DIRECTIVE_LEN))
     timesetDoYearly (ts);
-  else if (strncmp (dir, "@annually", MAX_DIRECTIVE_LEN))
-    timesetDoAnually (ts);
-  else if (strncmp (dir, "@monthly", MAX_DIRECTIVE_LEN))
+  else if (!strncmp (dir, "@monthly", MAX_DIRECTIVE_LEN))
     timesetDoMonthly (ts);
-  else if (strncmp (dir, "@weekly", MAX_DIRECTIVE_LEN))
+  else if (!strncmp (dir, "@weekly", MAX_DIRECTIVE_LEN))
     timesetDoWeekly (ts);
-  else if (strncmp (dir, "@daily", MAX_DIRECTIVE_LEN))
+  else if (!strncmp (dir, "@daily", MAX_DIRECTIVE_LEN))
     timesetDoDaily (ts);
-  else if (strncmp (dir, "@hourly", MAX_DIRECTIVE_LEN))
+  else if (!strncmp (dir, "@hourly", MAX_DIRECTIVE_LEN))
     timesetDoHourly (ts);
   else
-    raiseError ("Unknown directive");
+    _raise_syntax_err ("Unknown directive", 0, 0);
+
+  return lnptr;
 }
 
-void
-parserHandleAssign (Symtbl *stab, const char *lnptr)
+struct ExpandBuf
+{
+  char *buf;
+  size_t len;
+  size_t max;
+};
+
+static inline void
+parserExpandPut (struct ExpandBuf *eb, const char *str, size_t str_len)
+{
+  if (eb->len + str_len > eb->max)
+    {
+      size_t old_max = eb->max;
+      eb->max = old_max > 0 ? old_max << 1 : MAX_BUF / 16;
+      while (eb->len + str_len > eb->max)
+        eb->max <<= 1;
+      eb->buf = eb->buf == NULL
+                    ? memAllocBlockSafe (eb->max, sizeof (char))
+                    : memReallocSafe (eb->buf, old_max, eb->max,
+                                      sizeof (char));
+    }
+
+  memcpy (&eb->buf[eb->len], str, str_len);
+  eb->len += str_len;
+}
+
+static const char *
+parserExpandTilde (Symtbl *stab, const char *ptr, const char *end,
+                   struct ExpandBuf *out)
 {
-  uint8_t *key = NULL;
-  uint8_t *value = NULL;
-  uint8_t *kptr = NULL, *vptr = NULL;
-  size_t key_len, val_len;
-  wordexp_t wxp;
+  const char *user = ptr + 1, *user_end = user;
+  while (user_end < end && *user_end != '/' && *user_end != ':')
+    user_end++;
+
+  char name[LOGIN_NAME_MAX + 1] = { 0 };
+  if ((size_t)(user_end - user) > LOGIN_NAME_MAX)
+    _raise_syntax_err ("User name too long", 0, 0);
+  memcpy (&name[0], user, user_end - user);
+
+  const char *home = NULL;
+  if (name[0] == '\0')
+    {
+      home = symtblGet (stab, "HOME");
+      if (home == NULL)
+        home = getenv ("HOME");
+    }
+  else
+    {
+      struct passwd *pwd = getpwnam (&name[0]);
+      if (pwd != NULL)
+        home = pwd->pw_dir;
+    }
+
+  if (home == NULL)
+    {
+      parserExpandPut (out, "~", 1);
+      return ptr + 1;
+    }
 
-  for (kptr = lnptr; *kptr != '='; kptr++)
-    ;
-  key_len = (size_t)(kptr - lnptr);
+  parserExpandPut (out, home, strlen (home));
+  return user_end;
+}
+
+static const char *
+parserExpandVariable (Symtbl *stab, const char *ptr, const char *end,
+                      struct ExpandBuf *out)
+{
+  const char *name = ++ptr;
+  bool braced = ptr < end && *ptr == '{';
 
-  for (vptr = ++kptr; *vptr; vptr++)
-    ;
-  val_len = (size_t)(vptr - kptr);
+  if (ptr < end && (*ptr == '(' || *ptr == '`'))
+    _raise_syntax_err ("Command substitution not allowed", 0, 0);
 
-  key = memAllocBlockSafe (key_len + 1, sizeof (uint8_t));
-  value = memAllocBlockSafe (val_len + 1, sizeof (uint8_t));
+  if (braced)
+    name = ++ptr;
+  else if (ptr == end || !(isalpha (*ptr) || *ptr == '_'))
+    {
+      parserExpandPut (out, "$", 1);
+      return ptr;
+    }
 
-  strncpy (name, lnptr, key_len);
-  strncpy (value, &lnptr[key_len + 1], val_len);
+  while (ptr < end && (isalnum (*ptr) || *ptr == '_'))
+    ptr++;
 
-  wordexp (value, &wxp, 0);
-  memDeallocSafe (value);
-  val_len = strlen (*wxp.we_wordv);
-  value = (uint8_t *)strndup (*wxp.we_wordv, val_len);
-  wordfree (&wxp);
+  size_t name_len = ptr - name;
+  if (name_len == 0 || name_len > MAX_VAR_NAME
+      || (braced && (ptr == end || *ptr != '}')))
+    _raise_syntax_err ("Invalid variable reference", 0, 0);
 
-  symtblSet (stab, key, key_len, value, value_len);
+  char key[MAX_VAR_NAME + 1] = { 0 };
+  memcpy (&key[0], name, name_len);
 
-  memDeallocSafe (key);
-  memDeallocSafe (value);
+  /* As wordexp did, an undefined variable expands to nothing.  */
+  const char *value = symtblGet (stab, &key[0]);
+  if (value == NULL)
+    value = getenv (&key[0]);
+  if (value != NULL)
+    parserExpandPut (out, value, strlen (value));
+  return braced ? ptr + 1 : ptr;
 }
 
-void
+static char *
+parserExpandInto (Symtbl *stab, const char *value, size_t value_len,
+                  struct ExpandBuf *out)
+{
+  const char *ptr = value, *end = &value[value_len];
+  size_t kept_len = 0;
+
+  out->len = 0;
+
+  while (ptr < end && isblank (*ptr))
+    ptr++;
+
+  const char *start = ptr;
+
+  while (ptr < end)
+    {
+      const char *word = ptr;
+
+      if (*ptr == '\'')
+        {
+          const char *close = memchr (ptr + 1, '\'', end - ptr - 1);
+          if (close == NULL)
+            _raise_syntax_err ("Unterminated single quote", 0, 0);
+          parserExpandPut (out, ptr + 1, close - ptr - 1);
+          ptr = close + 1;
+        }
+      else if (*ptr == '"')
+        {
+          for (ptr++; ptr < end && *ptr != '"';)
+            if (*ptr == '$')
+              ptr = parserExpandVariable (stab, ptr, end, out);
+            else if (*ptr == '`')
+              _raise_syntax_err ("Command substitution not allowed", 0, 0);
+            else if (*ptr == '\\' && ptr + 1 < end
+                     && strchr ("\"\\$`", ptr[1]) != NULL)
+              {
+                parserExpandPut (out, &ptr[1], 1);
+                ptr += 2;
+              }
+            else
+              parserExpandPut (out, ptr++, 1);
+
+          if (ptr == end)
+            _raise_syntax_err ("Unterminated double quote", 0, 0);
+          ptr++;
+        }
+      else if (*ptr == '\\')
+        {
+          if (++ptr < end)
+            parserExpandPut (out, ptr++, 1);
+        }
+      else if (*ptr == '$')
+        ptr = parserExpandVariable (stab, ptr, end, out);
+      else if (*ptr == '`')
+        _raise_syntax_err ("Command substitution not allowed", 0, 0);
+      else if (*ptr == '~' && (ptr == start || ptr[-1] == ':'))
+        ptr = parserExpandTilde (stab, ptr, end, out);
+      else
+        parserExpandPut (out, ptr++, 1);
+
+      if (!isblank (*word))
+        kept_len = out->len;
+    }
+
+  parserExpandPut (out, "", 1);
+  out->buf[kept_len] = '\0';
+  return out->buf;
+}
+
+char *
+parserExpandValue (Symtbl *stab, const char *value, size_t value_len)
+{
+  struct ExpandBuf eb = { .buf = NULL, .len = 0, .max = 0 };
+  return parserExpandInto (stab, value, value_len, &eb);
+}
+
+static void
+parserHandleAssign (Symtbl *stab, const char *lnptr, struct ExpandBuf *eb)
+{
+  const char *eq = strchr (lnptr, '=');
+  if (eq == NULL)
+    _raise_syntax_err ("Expected assignment", 0, 0);
+
+  size_t key_len = (size_t)(eq - lnptr);
+  while (key_len > 0 && isblank (lnptr[key_len - 1]))
+    key_len--;
+  if (key_len > MAX_VAR_NAME)
+    _raise_syntax_err ("Variable name too long", 0, 0);
+
+  char key[MAX_VAR_NAME + 1] = { 0 };
+  memcpy (&key[0], lnptr, key_len);
+  char *value = parserExpandInto (stab, eq + 1, strcspn (eq + 1, "\n"), eb);
+
+  symtblSet (stab, &key[0], key_len, value, strlen (value));
+}
+
+const char *
 parserHandleUser (const char *lnptr, char *userptr)
 {
-  SKIP_Whitesace (lnptr);
-  for (size_t i = 0; i < LOGIN_NAME_MAX && !isblank (*lnptr); i++)
+  SKIP_Whitespace (lnptr);
+  for (size_t i = 0; i < LOGIN_NAME_MAX && *lnptr && !isspace (*lnptr); i++)
     userptr[i] = *lnptr++;
+
+  return lnptr;
 }
 
 void
 parserHandleCommand (const char *lnptr, char **cmdptr, size_t *cmdlenptr)
 {
   SKIP_Whitespace (lnptr);
-  *cmdlenptr = strlen (lnptr);
+  *cmdlenptr = strcspn (lnptr, "\n");
   *cmdptr = strndup (lnptr, *cmdlenptr);
 }
 
-void
-parserParseTable (CronTab *ct)
+size_t
+parserGetOutputCap (Symtbl *stab)
 {
-  char *ln = NULL;
-  size_t ln_len = 0;
-  FILE *fstream = fopen (ct->path, "r");
-  if (fstream == NULL)
-    _err_out ("fopen");
+  char *cap = symtblGet (stab, "OUTPUT_CAP");
+  if (cap == NULL)
+    return OUTPUT_CAP_DFL * 1024;
+
+  char *endptr = NULL;
+  unsigned long cap_kb = strtoul (cap, &endptr, 10);
+  if (endptr == cap || *endptr != '\0')
+    _raise_syntax_err ("Invalid OUTPUT_CAP", 0, 0);
 
-  while (getline (&ln, &ln_len, fstream) > 0)
+  return cap_kb * 1024;
+}
+
+JobPriority
+parserGetPriority (Symtbl *stab)
+{
+  char *prio = symtblGet (stab, "PRIORITY");
+  if (prio == NULL || !strcmp (prio, "normal"))
+    return PRIO_Normal;
+  else if (!strcmp (prio, "high"))
+    return PRIO_High;
+  else if (!strcmp (prio, "low"))
+    return PRIO_Low;
+
+  _raise_syntax_err ("Invalid PRIORITY", 0, 0);
+}
+
+bool
+parserGetClusterOnce (Symtbl *stab)
+{
+  char *mode = symtblGet (stab, "CLUSTER");
+  if (mode == NULL || !strcmp (mode, "all"))
+    return false;
+  else if (!strcmp (mode, "once"))
+    return true;
+
+  _raise_syntax_err ("Invalid CLUSTER", 0, 0);
+}
+
+bool
+parserGetSeconds (Symtbl *stab)
+{
+  char *secs = symtblGet (stab, "SECONDS");
+  if (secs == NULL || !strcmp (secs, "0"))
+    return false;
+  else if (!strcmp (secs, "1"))
+    return true;
+
+  _raise_syntax_err ("Invalid SECONDS", 0, 0);
+}
+
+int
+parserGetRebootOrder (Symtbl *stab)
+{
+  char *order = symtblGet (stab, "REBOOT_ORDER");
+  if (order == NULL)
+    return 0;
+
+  char *endptr = NULL;
+  long level = strtol (order, &endptr, 10);
+  if (endptr == order || *endptr != '\0' || level < 0 || level > INT_MAX)
+    _raise_syntax_err ("Invalid REBOOT_ORDER", 0, 0);
+
+  return level;
+}
+
+time_t
+parserGetMailWindow (Symtbl *stab)
+{
+  char *window = symtblGet (stab, "MAIL_DIGEST_WINDOW");
+  if (window == NULL)
+    return MAIL_DIGEST_WINDOW;
+
+  char *endptr = NULL;
+  long secs = strtol (window, &endptr, 10);
+  if (endptr == window || *endptr != '\0' || secs < 0)
+    _raise_syntax_err ("Invalid MAIL_DIGEST_WINDOW", 0, 0);
+
+  return secs;
+}
+
+size_t
+parserGetMailMax (Symtbl *stab)
+{
+  char *max = symtblGet (stab, "MAIL_DIGEST_MAX");
+  if (max == NULL)
+    return MAIL_DIGEST_MAX;
+
+  char *endptr = NULL;
+  unsigned long max_kb = strtoul (max, &endptr, 10);
+  if (endptr == max || *endptr != '\0')
+    _raise_syntax_err ("Invalid MAIL_DIGEST_MAX", 0, 0);
+
+  return max_kb * 1024;
+}
+
+static void
+parserLexCpuList (const char *lnptr, uint64_t *cpus)
+{
+  memset (cpus, 0, MAX_CPUS / 8);
+
+  while (*lnptr)
+    {
+      if (!isdigit (*lnptr))
+        _raise_syntax_err ("Invalid CPU_AFFINITY", 0, 0);
+
+      char *endptr = NULL;
+      unsigned long lower = strtoul (lnptr, &endptr, 10);
+      unsigned long upper = lower;
+      lnptr = endptr;
+
+      if (*lnptr == '-')
+        {
+          upper = strtoul (++lnptr, &endptr, 10);
+          if (endptr == lnptr)
+            _raise_syntax_err ("Invalid CPU_AFFINITY", 0, 0);
+          lnptr = endptr;
+        }
+
+      if (lower > upper || upper >= MAX_CPUS)
+        _raise_syntax_err ("CPU_AFFINITY out of range", 0, 0);
+
+      for (unsigned long cpu = lower; cpu <= upper; cpu++)
+        cpus[cpu / 64] |= 1ULL << (cpu % 64);
+
+      if (*lnptr == ',')
+        lnptr++;
+      else if (*lnptr)
+        _raise_syntax_err ("Invalid CPU_AFFINITY", 0, 0);
+    }
+}
+
+static int
+parserLexIoprio (const char *lnptr)
+{
+  static const char *const classes[] = {
+    "none", "realtime", "best-effort", "idle", NULL,
+  };
+
+  size_t class_len = strcspn (lnptr, ":");
+  int class = -1;
+  for (int i = 0; classes[i] != NULL; i++)
+    if (strlen (classes[i]) == class_len
+        && !strncmp (classes[i], lnptr, class_len))
+      class = i;
+
+  if (class == -1)
+    _raise_syntax_err ("Unknown IONICE class", 0, 0);
+
+  int level = class == 3 ? 0 : 4;
+  if (lnptr[class_len] == ':')
+    {
+      char *endptr = NULL;
+      level = strtol (&lnptr[class_len + 1], &endptr, 10);
+      if (endptr == &lnptr[class_len + 1] || *endptr || level < 0
+          || level > 7)
+        _raise_syntax_err ("Invalid IONICE level", 0, 0);
+    }
+  else if (lnptr[class_len])
+    _raise_syntax_err ("Invalid IONICE", 0, 0);
+
+  return class << 13 | level;
+}
+
+/* User tables may only lower their jobs' priority: NICE of 0 or more, no
+   realtime I/O class, best-effort no higher than the default level, and
+   cgroups below CGROUP_USER_ROOT/<user>.  */
+static void
+parserGetLimits (Symtbl *stab, CronJob *cj, bool is_main)
+{
+  JobLimits *lim = &cj->limits;
+  char *val = NULL;
+
+  if ((val = symtblGet (stab, "CPU_AFFINITY")) != NULL && *val)
+    {
+      parserLexCpuList (val, &lim->cpus[0]);
+      lim->has_cpus = true;
+    }
+
+  if ((val = symtblGet (stab, "NICE")) != NULL && *val)
+    {
+      char *endptr = NULL;
+      lim->nice = strtol (val, &endptr, 10);
+      if (*endptr || lim->nice < -20 || lim->nice > 19)
+        _raise_syntax_err ("Invalid NICE", 0, 0);
+      if (!is_main && lim->nice < 0)
+        _raise_syntax_err ("Negative NICE needs the system table", 0, 0);
+      lim->has_nice = true;
+    }
+
+  if ((val = symtblGet (stab, "IONICE")) != NULL && *val)
     {
-      if (!ln_len)
+      lim->ioprio = parserLexIoprio (val);
+      int class = lim->ioprio >> 13, level = lim->ioprio & 0x7;
+      if (!is_main && (class == 1 || (class == 2 && level < 4)))
+        _raise_syntax_err ("IONICE above best-effort:4 needs the system table",
+                           0, 0);
+      lim->has_ioprio = true;
+    }
+
+  if ((val = symtblGet (stab, "CGROUP")) != NULL && *val)
+    {
+      if (val[0] == '/' || strstr (val, "..") != NULL)
+        _raise_syntax_err ("CGROUP must be relative to " CGROUP_ROOT, 0, 0);
+
+      if (is_main)
+        cj->cgroup.path = strdup (val);
+      else if (asprintf (&cj->cgroup.path, "%s/%s/%s", CGROUP_USER_ROOT,
+                         &cj->user[0], val)
+               < 0)
+        _err_out ("asprintf");
+
+      if ((val = symtblGet (stab, "CGROUP_CPU_MAX")) != NULL && *val)
+        cj->cgroup.cpu_max = strdup (val);
+      if ((val = symtblGet (stab, "CGROUP_MEMORY_MAX")) != NULL && *val)
+        cj->cgroup.memory_max = strdup (val);
+      lim->has_cgroup = true;
+    }
+}
+
+static int
+parserCompareLabels (const void *a, const void *b)
+{
+  return strcmp ((*(CronJob *const *)a)->label, (*(CronJob *const *)b)->label);
+}
+
+struct ParseScratch
+{
+  FILE *owned_fstream;
+  char *ln;
+  char *cmd;
+  struct ExpandBuf expand;
+  CronJob **labeled;
+  size_t *parents;
+  size_t *walks;
+};
+
+/* Everything the parser holds on the heap outside the table itself, so a
+   syntax error unwinding through parserParse leaks nothing.  */
+static void
+parserScratchFree (struct ParseScratch *scr)
+{
+  if (scr->owned_fstream != NULL)
+    fclose (scr->owned_fstream);
+  memDeallocSafe (scr->ln);
+  memDeallocSafe (scr->cmd);
+  memDeallocSafe (scr->expand.buf);
+  memDeallocSafe (scr->labeled);
+  memDeallocSafe (scr->parents);
+  memDeallocSafe (scr->walks);
+}
+
+static void
+parserResolveChains (JobStore *store, struct ParseScratch *scr)
+{
+  CronJob **labeled = scr->labeled
+      = memAllocBlockSafe (store->num_jobs + 1, sizeof (CronJob *));
+  size_t *parents = scr->parents
+      = memAllocBlockSafe (store->num_jobs + 1, sizeof (size_t));
+  size_t *walks = scr->walks
+      = memAllocBlockSafe (store->num_jobs + 1, sizeof (size_t));
+  size_t num_labeled = 0;
+
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    if (store->jobs[idx].label != NULL)
+      labeled[num_labeled++] = &store->jobs[idx];
+
+  qsort (labeled, num_labeled, sizeof (CronJob *), parserCompareLabels);
+  for (size_t i = 1; i < num_labeled; i++)
+    if (!strcmp (labeled[i - 1]->label, labeled[i]->label))
+      _raise_syntax_err ("Duplicate job label", 0, 0);
+
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    {
+      CronJob *cj = &store->jobs[idx];
+      parents[idx] = SIZE_MAX;
+      if (cj->after_label == NULL)
         continue;
 
+      CronJob key = { .label = cj->after_label }, *keyp = &key;
+      CronJob **found = bsearch (&keyp, labeled, num_labeled,
+                                 sizeof (CronJob *), parserCompareLabels);
+      if (found == NULL)
+        _raise_syntax_err ("Unknown job label", 0, 0);
+
+      parents[idx] = (*found)->idx;
+      (*found)->num_dependents++;
+    }
+
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    {
+      size_t cur = idx;
+      while (cur != SIZE_MAX && walks[cur] == 0)
+        {
+          walks[cur] = idx + 1;
+          cur = parents[cur];
+        }
+      if (cur != SIZE_MAX && walks[cur] == idx + 1)
+        _raise_syntax_err ("Job chain forms a cycle", 0, 0);
+    }
+
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    if (store->jobs[idx].num_dependents > 0)
+      {
+        store->jobs[idx].dependents = memAllocBlockSafe (
+            store->jobs[idx].num_dependents, sizeof (size_t));
+        store->jobs[idx].num_dependents = 0;
+      }
+
+  for (size_t idx = 0; idx < store->num_jobs; idx++)
+    if (parents[idx] != SIZE_MAX)
+      {
+        CronJob *parent = &store->jobs[parents[idx]];
+        parent->dependents[parent->num_dependents++] = idx;
+      }
+}
+
+static void
+parserParseLines (CronTab *ct, FILE *fstream, struct ParseScratch *scr)
+{
+  size_t ln_len = 0;
+
+  if (GLOBAL_STAB == NULL)
+    _intern_symbolic_tokens ();
+
+  while (getline (&scr->ln, &ln_len, fstream) > 0)
+    {
+      const char *ln = scr->ln;
       LineKind lnknd = parserAssessLineKind (ln);
 
       if (lnknd == LINE_None || lnknd == LINE_Comment)
         continue;
 
+      char curr_label[MAX_LABEL_LEN + 1] = { 0 };
+      const char *lnptr = parserHandleLabel (ln, &curr_label[0]);
+      if (lnptr != ln)
+        {
+          lnknd = parserAssessLineKind (lnptr);
+          if (lnknd != LINE_Directive && lnknd != LINE_Field)
+            _raise_syntax_err ("Label must precede a job", 0, 0);
+        }
+
       if (lnknd == LINE_Assign)
         {
-          parserHandleAssign (ct->stab, lnptr);
+          parserHandleAssign (ct->stab, lnptr, &scr->expand);
           continue;
         }
 
       Timeset curr_ts = { 0 };
+      char after_label[MAX_LABEL_LEN + 1] = { 0 };
+      bool after_success = false;
       if (lnknd == LINE_Directive)
-        parserHandleDirective (&curr_ts, lnptr);
+        lnptr = parserHandleDirective (&curr_ts, lnptr, &after_label[0],
+                                       &after_success);
       else if (lnknd == LINE_Field)
-        parserHandleFields (&curr_ts, lnptr);
+        lnptr = parserHandleFields (&curr_ts, lnptr,
+                                    parserGetSeconds (ct->stab));
 
-      char *curr_user = &ct->user[0];
+      char curr_user[LOGIN_NAME_MAX + 1] = { 0 };
       if (ct->is_main)
-        parserHandleUser (lnptr, curr_user);
+        lnptr = parserHandleUser (lnptr, &curr_user[0]);
+      else
+        strncpy (&curr_user[0], &ct->user[0], LOGIN_NAME_MAX);
 
-      char *curr_cmd = NULL;
       size_t curr_cmd_len = 0;
-      parserHandleCommand (lnptr, &curr_cmd, &curr_cmd_len);
+      parserHandleCommand (lnptr, &scr->cmd, &curr_cmd_len);
 
       CronJob *curr_cj
-          = cronjobNew (&curr_ts, curr_cmd, curr_cmd_len, curr_user);
-      if (ct->jobs == NULL)
-        ct->jobs = curr_cj;
-      else
-        cronjobListLink (ct->jobs, curr_cj);
+          = jobstorePush (&ct->store, ct->sched->pool, &curr_ts, scr->cmd,
+                          curr_cmd_len, &curr_user[0]);
+      memDeallocSafe (scr->cmd);
+      scr->cmd = NULL;
+
+      curr_cj->logger = ct->logger;
+      curr_cj->tab = ct;
+      curr_cj->output_cap = parserGetOutputCap (ct->stab);
+      curr_cj->priority = parserGetPriority (ct->stab);
+      curr_cj->cluster_once = parserGetClusterOnce (ct->stab);
+      curr_cj->reboot_order = parserGetRebootOrder (ct->stab);
+      atomic_init (&curr_cj->owned, true);
+      atomic_init (&curr_cj->deferred, false);
+      parserGetLimits (ct->stab, curr_cj, ct->is_main);
+      cronjobPrepCommand (curr_cj);
+
+      if (curr_label[0] != '\0')
+        curr_cj->label = strdup (&curr_label[0]);
+      if (after_label[0] != '\0')
+        {
+          curr_cj->after_label = strdup (&after_label[0]);
+          curr_cj->after_success = after_success;
+        }
     }
 
-  memDeallocSafe (ln);
-  fclose (fstream);
+  parserResolveChains (&ct->store, scr);
+}
+
+/* Jobs already pushed stay in ct->store on error and go with the table;
+   the caller is expected to crontabDelete it.  The error is re-raised to
+   the next handler out, or ends the process if there is none.  */
+static void
+parserParse (CronTab *ct, FILE *fstream, bool owns_fstream)
+{
+  struct ParseScratch scr = { 0 };
+  jmp_buf env, *prev = SYNTAX_ERR_JMP;
+
+  if (owns_fstream)
+    scr.owned_fstream = fstream;
+
+  if (setjmp (env) != 0)
+    {
+      SYNTAX_ERR_JMP = prev;
+      parserScratchFree (&scr);
+      _unwind_syntax_err ();
+    }
+
+  SYNTAX_ERR_JMP = &env;
+  parserParseLines (ct, fstream, &scr);
+  SYNTAX_ERR_JMP = prev;
+  parserScratchFree (&scr);
+}
+
+void
+parserParseStream (CronTab *ct, FILE *fstream)
+{
+  parserParse (ct, fstream, false);
+}
+
+void
+parserParseTable (CronTab *ct)
+{
+  FILE *fstream = fopen (ct->path, "r");
+  if (fstream == NULL)
+    _err_out ("fopen");
+
+  parserParse (ct, fstream, true);
 }
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* @reboot jobs run once per boot, REBOOT_STAMP living on a tmpfs.  Jobs
+   are started level by level in ascending REBOOT_ORDER; a level starts
+   only after every job of the previous one has exited.  */
+
+static RebootRun *REBOOT = NULL;
+
+static int64_t
+rebootNowMs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+rebootCompareJobs (const void *a, const void *b)
+{
+  const CronJob *ja = *(CronJob *const *)a, *jb = *(CronJob *const *)b;
+  return (ja->reboot_order > jb->reboot_order)
+         - (ja->reboot_order < jb->reboot_order);
+}
+
+static size_t
+rebootMaxRunning (void)
+{
+  const char *max_str = getenv ("LYKRON_REBOOT_PARALLEL");
+  if (max_str == NULL)
+    return REBOOT_MAX_PARALLEL;
+
+  char *endptr = NULL;
+  unsigned long max_running = strtoul (max_str, &endptr, 10);
+  if (endptr == max_str || *endptr != '\0' || max_running == 0)
+    return REBOOT_MAX_PARALLEL;
+
+  return max_running;
+}
+
+static RebootRun *
+rebootCollect (TabSet *set)
+{
+  RebootRun *run = memAllocSafe (sizeof (RebootRun));
+  size_t max_jobs = 0;
+  run->jobs = NULL;
+  run->num_jobs = 0;
+
+  for (size_t i = 0; i < set->num_tabs; i++)
+    {
+      JobStore *store = &set->tabs[i]->store;
+      for (size_t idx = 0; idx < store->num_jobs; idx++)
+        {
+          CronJob *cj = &store->jobs[idx];
+          if (!store->schedules[idx]->timeset.reboot
+              || (cj->cluster_once && !atomic_load (&cj->owned)))
+            continue;
+
+          if (run->num_jobs == max_jobs)
+            {
+              size_t old_max = max_jobs;
+              max_jobs = old_max > 0 ? old_max << 1 : NLIM;
+              run->jobs
+                  = run->jobs == NULL
+                        ? memAllocBlockSafe (max_jobs, sizeof (CronJob *))
+                        : memReallocSafe (run->jobs, old_max, max_jobs,
+                                          sizeof (CronJob *));
+            }
+
+          atomic_fetch_add (&cj->tab->refs, 1);
+          run->jobs[run->num_jobs++] = cj;
+        }
+    }
+
+  qsort (run->jobs, run->num_jobs, sizeof (CronJob *), rebootCompareJobs);
+
+  run->num_started = 0;
+  run->num_running = 0;
+  run->num_failed = 0;
+  run->max_running = rebootMaxRunning ();
+  run->pids = memAllocBlockSafe (run->max_running, sizeof (pid_t));
+  run->num_pids = 0;
+  run->started = rebootNowMs ();
+  run->elapsed = -1;
+  pthread_mutex_init (&run->lock, NULL);
+  pthread_cond_init (&run->done, NULL);
+
+  return run;
+}
+
+static size_t
+rebootLevelEnd (RebootRun *run, size_t start)
+{
+  size_t end = start;
+  while (end < run->num_jobs
+         && run->jobs[end]->reboot_order == run->jobs[start]->reboot_order)
+    end++;
+  return end;
+}
+
+static void *
+rebootThread (void *arg)
+{
+  RebootRun *run = arg;
+  size_t level_end = 0;
+
+  pthread_mutex_lock (&run->lock);
+  while (run->num_started < run->num_jobs || run->num_running > 0)
+    {
+      if (run->num_running == 0 && run->num_started == level_end)
+        level_end = rebootLevelEnd (run, level_end);
+
+      if (run->num_started == level_end
+          || run->num_running == run->max_running)
+        {
+          pthread_cond_wait (&run->done, &run->lock);
+          continue;
+        }
+
+      CronJob *cj = run->jobs[run->num_started++];
+      bool paused = atomic_load (_job_paused (cj))
+                    || atomic_load (&cj->tab->paused);
+      if (paused)
+        {
+          atomic_fetch_sub (&cj->tab->refs, 1);
+          continue;
+        }
+      run->num_running++;
+      pthread_mutex_unlock (&run->lock);
+
+      /* Boot jobs go through the same pressure deferral and spawn
+         admission as scheduled ones.  The run lock is held across the
+         spawn so the reaper cannot finish the pid before it is tracked.  */
+      Scheduler *sched = cj->tab->sched;
+      schedulerAwaitPressure (sched, cj->priority);
+      admissionEnter (sched->admission);
+      pthread_mutex_lock (&run->lock);
+      pid_t pid = cronjobExecute (cj);
+      if (pid > 0)
+        run->pids[run->num_pids++] = pid;
+      else
+        {
+          run->num_running--;
+          run->num_failed++;
+        }
+      pthread_mutex_unlock (&run->lock);
+      admissionLeave (sched->admission);
+      atomic_fetch_add_explicit (&sched->num_fires, 1, memory_order_relaxed);
+      atomic_fetch_sub (&cj->tab->refs, 1);
+
+      pthread_mutex_lock (&run->lock);
+    }
+
+  run->elapsed = rebootNowMs () - run->started;
+  pthread_mutex_unlock (&run->lock);
+
+  return NULL;
+}
+
+void
+rebootStart (TabSet *set)
+{
+  if (handoffGet () != NULL)
+    return;
+
+  char path[PATH_MAX + 1];
+  int fd = open (_instance_path (REBOOT_STAMP, &path[0]),
+                 O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  close (fd);
+
+  RebootRun *run = rebootCollect (set);
+  if (run->num_jobs == 0)
+    {
+      pthread_mutex_destroy (&run->lock);
+      pthread_cond_destroy (&run->done);
+      memDeallocSafe (run->pids);
+      memDeallocSafe (run->jobs);
+      memDeallocSafe (run);
+      return;
+    }
+
+  REBOOT = run;
+  if (pthread_create (&run->thread, NULL, rebootThread, run) != 0)
+    _err_out ("pthread_create");
+  pthread_detach (run->thread);
+}
+
+void
+rebootFinish (pid_t pid, int exit_stat)
+{
+  RebootRun *run = REBOOT;
+  if (run == NULL)
+    return;
+
+  pthread_mutex_lock (&run->lock);
+
+  size_t idx = 0;
+  while (idx < run->num_pids && run->pids[idx] != pid)
+    idx++;
+  if (idx == run->num_pids)
+    {
+      pthread_mutex_unlock (&run->lock);
+      return;
+    }
+
+  run->pids[idx] = run->pids[--run->num_pids];
+  run->num_running--;
+  if (!WIFEXITED (exit_stat) || WEXITSTATUS (exit_stat) != 0)
+    run->num_failed++;
+  pthread_cond_signal (&run->done);
+  pthread_mutex_unlock (&run->lock);
+}
+
+void
+rebootReport (FILE *fstream)
+{
+  RebootRun *run = REBOOT;
+  if (run == NULL)
+    return;
+
+  pthread_mutex_lock (&run->lock);
+  int64_t elapsed
+      = run->elapsed >= 0 ? run->elapsed : rebootNowMs () - run->started;
+  fprintf (fstream,
+           "reboot jobs=%zu started=%zu running=%zu failed=%zu "
+           "max_parallel=%zu elapsed=%.3fs%s\n",
+           run->num_jobs, run->num_started, run->num_running,
+           run->num_failed, run->max_running, elapsed / 1000.0,
+           run->elapsed >= 0 ? "" : " (in progress)");
+  pthread_mutex_unlock (&run->lock);
+}
@@ -1,306 +1,1134 @@
+#define _GNU_SOURCE
 #define POSIX_SOURCE
 #define POSIX_C_SOURCE
+#include <assert.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "lykron.h"
 
+static ShardSet *SHARD_SET = NULL;
+
+SchedulePool *
+schedpoolNew (void)
+{
+  SchedulePool *pool = memAllocSafe (sizeof (SchedulePool));
+  pool->slots = memAllocBlockSafe (INIT_SCHEDPOOL_SIZE, sizeof (Schedule *));
+  pool->max_slots = INIT_SCHEDPOOL_SIZE;
+  pool->num_schedules = 0;
+  pthread_mutex_init (&pool->lock, NULL);
+
+  return pool;
+}
+
+static void
+scheduleDelete (Schedule *sc)
+{
+  memDeallocSafe (sc->members);
+  memDeallocSafe (sc);
+}
+
+void
+schedpoolDelete (SchedulePool *pool)
+{
+  for (size_t i = 0; i < pool->max_slots; i++)
+    while (pool->slots[i] != NULL)
+      {
+        Schedule *next = pool->slots[i]->next;
+        scheduleDelete (pool->slots[i]);
+        pool->slots[i] = next;
+      }
+
+  pthread_mutex_destroy (&pool->lock);
+  memDeallocSafe (pool->slots);
+  memDeallocSafe (pool);
+}
+
+static void
+schedpoolGrow (SchedulePool *pool)
+{
+  Schedule **old_slots = pool->slots;
+  size_t old_max_slots = pool->max_slots;
+
+  pool->max_slots <<= 1;
+  pool->slots = memAllocBlockSafe (pool->max_slots, sizeof (Schedule *));
+
+  for (size_t i = 0; i < old_max_slots; i++)
+    while (old_slots[i] != NULL)
+      {
+        Schedule *sc = old_slots[i];
+        old_slots[i] = sc->next;
+        size_t idx = sc->hash & (pool->max_slots - 1);
+        sc->next = pool->slots[idx];
+        pool->slots[idx] = sc;
+      }
+
+  memDeallocSafe (old_slots);
+}
+
+Schedule *
+schedpoolIntern (SchedulePool *pool, const Timeset *ts)
+{
+  uint32_t hash = timesetHash (ts);
+
+  pthread_mutex_lock (&pool->lock);
+
+  Schedule *sc = pool->slots[hash & (pool->max_slots - 1)];
+  while (sc != NULL
+         && (sc->hash != hash || !timesetEqual (&sc->timeset, ts)))
+    sc = sc->next;
+
+  if (sc == NULL)
+    {
+      if (pool->num_schedules + 1 > pool->max_slots)
+        schedpoolGrow (pool);
+
+      sc = memAllocSafe (sizeof (Schedule));
+      memCopySafe (&sc->timeset, ts, sizeof (Timeset));
+      sc->hash = hash;
+      sc->due_bit = -1;
+      sc->refs = 0;
+      sc->members = NULL;
+      sc->num_members = 0;
+      sc->max_members = 0;
+      sc->notice.time = TIME_UNSPEC;
+      sc->notice.job = NULL;
+      sc->notice.schedule = sc;
+      sc->notice.bucket_idx = -1;
+      sc->notice.next = NULL;
+      atomic_init (&sc->next_fire, TIME_UNSPEC);
+      sc->pool = pool;
+
+      size_t idx = hash & (pool->max_slots - 1);
+      sc->next = pool->slots[idx];
+      pool->slots[idx] = sc;
+      pool->num_schedules++;
+    }
+
+  sc->refs++;
+
+  pthread_mutex_unlock (&pool->lock);
+
+  return sc;
+}
+
+void
+schedpoolRelease (Schedule *sc)
+{
+  SchedulePool *pool = sc->pool;
+
+  pthread_mutex_lock (&pool->lock);
+
+  if (--sc->refs == 0)
+    {
+      Schedule **scp = &pool->slots[sc->hash & (pool->max_slots - 1)];
+      while (*scp != sc)
+        scp = &(*scp)->next;
+      *scp = sc->next;
+      pool->num_schedules--;
+      scheduleDelete (sc);
+    }
+
+  pthread_mutex_unlock (&pool->lock);
+}
+
+EventNotice *
+noticeNew (time_t time, CronJob *job)
+{
+  EventNotice *evt = memAllocSafe (sizeof (EventNotice));
+  evt->time = time;
+  evt->job = job;
+  evt->schedule = NULL;
+  evt->backoff = 0;
+  evt->deadline = TIME_UNSPEC;
+  evt->bucket_idx = -1;
+  evt->forced = false;
+  evt->next = NULL;
+  return evt;
+}
+
+static EventBucket *
+bucketsNew (size_t num_buckets)
+{
+  EventBucket *buckets = memAllocBlockSafe (num_buckets, sizeof (EventBucket));
+  for (size_t i = 0; i < num_buckets; i++)
+    {
+      buckets[i].slots = NULL;
+      buckets[i].num_notices = 0;
+      buckets[i].max_notices = 0;
+    }
+  return buckets;
+}
+
+static void
+bucketsDelete (EventBucket *buckets, size_t num_buckets)
+{
+  for (size_t i = 0; i < num_buckets; i++)
+    memDeallocSafe (buckets[i].slots);
+  memDeallocSafe (buckets);
+}
+
+static void
+bucketReserve (EventBucket *b, size_t num_notices)
+{
+  if (num_notices <= b->max_notices)
+    return;
+
+  size_t old_max = b->max_notices;
+  b->max_notices = old_max > 0 ? old_max : NLIM;
+  while (b->max_notices < num_notices)
+    b->max_notices <<= 1;
+
+  b->slots = b->slots == NULL
+                 ? memAllocBlockSafe (b->max_notices, sizeof (BucketSlot))
+                 : memReallocSafe (b->slots, old_max, b->max_notices,
+                                   sizeof (BucketSlot));
+}
+
+static size_t
+bucketSearch (const EventBucket *b, time_t time)
+{
+  size_t lo = 0, hi = b->num_notices;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (b->slots[mid].time > time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+static void
+schedulerResetBuckets (Scheduler *sched, time_t lower_bound,
+                       time_t interval_width)
+{
+  sched->curr_bucket = 0;
+  sched->num_queued = 0;
+  sched->lower_bound = lower_bound;
+  sched->interval_width = interval_width;
+
+  for (size_t i = 0; i < sched->num_buckets; i++)
+    sched->buckets[i].num_notices = 0;
+}
+
 Scheduler *
 schedulerNew (void)
 {
   Scheduler *sched = memAllocSafe (sizeof (Scheduler));
-  sched->buckets
-      = memAllocBlockSafe (INIT_NUM_BUCKETS + 1, sizeof (EventBucket));
+  sched->buckets = bucketsNew (INIT_NUM_BUCKETS);
   sched->num_buckets = INIT_NUM_BUCKETS;
-  sched->curr_bucket = 0;
-  sched->lower_bound = 0;
-  sched->interval_width = INIT_INTERVAL_WIDTH;
+  sched->resize_at = NLIM;
+  atomic_init (&sched->posted, NULL);
+  atomic_init (&sched->swaps, NULL);
+  sched->rcu = NULL;
+  atomic_init (&sched->num_fires, 0);
+  atomic_init (&sched->num_wakeups, 0);
+  atomic_init (&sched->added_latency, 0);
+  atomic_init (&sched->num_latency_samples, 0);
+  atomic_init (&sched->num_deferrals, 0);
+  atomic_init (&sched->pressure, 0.0);
+  sched->pressure_sampled = 0;
+  sched->slack = SCHED_TIMER_SLACK;
+  sched->started = time (NULL);
+  sched->admission = NULL;
+  sched->pool = schedpoolNew ();
+  sched->dueset = SCHED_DUESET ? duesetNew () : NULL;
+  sched->spawner = NULL;
 
-  for (size_t i = 0; i < sched->num_buckets + 1; i++)
-    {
-      sched->buckets[i].key
-          = (i < sched->num_buckets
-                 ? sched->lower_bound + i * sched->interval_width
-                 : TIME_UNSPEC);
-      sched->buckets[i].num_notices = 0;
-      sched->buckets[i].is_dummy = (i == 0 || i == sched->num_bucekts);
-      noticeListInit (&sched->buckets[i].anchor);
-    }
+  /* After a re-exec, ticks since the previous image stopped are still
+     due.  */
+  Handoff *ho = handoffGet ();
+  if (sched->dueset != NULL && ho != NULL
+      && ho->written < sched->dueset->last_tick)
+    sched->dueset->last_tick = ho->written;
+
+  if ((sched->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    _err_out ("eventfd");
+
+  schedulerResetBuckets (sched, time (NULL), INIT_INTERVAL_WIDTH);
+
+  return sched;
 }
 
 void
 schedulerDelete (Scheduler *sched)
 {
-  for (size_t i = 0; i < sched->num_buckets + 1; i++)
+  EventNotice *posted = atomic_exchange (&sched->posted, NULL);
+  while (posted != NULL)
     {
-      EventNotice *evt = &sched->buckets[i].anchor;
-      while (evt != NULL)
-        {
-          EventNotice *next = evt->next;
-          memDeallocSafe (evt);
-          evt = next;
-        }
+      EventNotice *next = posted->next;
+      memDeallocSafe (posted);
+      posted = next;
     }
 
-  memDeallocSafe (sched->buckets);
+  for (size_t i = 0; i < sched->num_buckets; i++)
+    for (size_t j = 0; j < sched->buckets[i].num_notices; j++)
+      {
+        EventNotice *evt = sched->buckets[i].slots[j].evt;
+        evt->bucket_idx = -1;
+        if (evt->schedule != NULL)
+          continue;
+        atomic_fetch_sub (&evt->job->tab->refs, 1);
+        memDeallocSafe (evt);
+      }
+
+  close (sched->wake_fd);
+  if (sched->dueset != NULL)
+    duesetDelete (sched->dueset);
+  if (sched->spawner != NULL)
+    spawnerStop (sched->spawner);
+  schedpoolDelete (sched->pool);
+  bucketsDelete (sched->buckets, sched->num_buckets);
   memDeallocSafe (sched);
 }
 
+static void
+schedulerRadixSort (EventNotice **evts, size_t num_evts, time_t min_time,
+                    time_t max_time)
+{
+  time_t unit = 60;
+  for (size_t i = 0; i < num_evts && unit > 1; i++)
+    if ((evts[i]->time - min_time) % 60)
+      unit = 1;
+
+  uint64_t max_key = (uint64_t)(max_time - min_time) / unit;
+  EventNotice **tmp = memAllocBlockSafe (num_evts, sizeof (EventNotice *));
+  EventNotice **src = evts, **dst = tmp;
+
+  for (unsigned shift = 0; shift < 64 && (max_key >> shift) > 0; shift += 8)
+    {
+      size_t counts[256 + 1] = { 0 };
+
+      for (size_t i = 0; i < num_evts; i++)
+        counts[((uint64_t)(src[i]->time - min_time) / unit >> shift & 0xFF)
+               + 1]++;
+      for (size_t d = 1; d <= 256; d++)
+        counts[d] += counts[d - 1];
+      for (size_t i = 0; i < num_evts; i++)
+        dst[counts[(uint64_t)(src[i]->time - min_time) / unit >> shift
+                   & 0xFF]++]
+            = src[i];
+
+      EventNotice **swp = src;
+      src = dst;
+      dst = swp;
+    }
+
+  if (src != evts)
+    memCopySafe (evts, src, num_evts * sizeof (EventNotice *));
+  memDeallocSafe (tmp);
+}
+
+void
+schedulerBulkLoad (Scheduler *sched, EventNotice **evts, size_t num_evts)
+{
+  size_t num_queued = 0;
+  for (size_t i = 0; i < sched->num_buckets; i++)
+    num_queued += sched->buckets[i].num_notices;
+
+  size_t num_all = num_evts + num_queued;
+  sched->resize_at = num_all > NLIM / 2 ? num_all << 1 : NLIM;
+  if (num_all == 0)
+    return;
+
+  EventNotice **all = memAllocBlockSafe (num_all, sizeof (EventNotice *));
+  memCopySafe (all, evts, num_evts * sizeof (EventNotice *));
+
+  size_t n = num_evts;
+  for (size_t i = 0; i < sched->num_buckets; i++)
+    for (size_t j = 0; j < sched->buckets[i].num_notices; j++)
+      all[n++] = sched->buckets[i].slots[j].evt;
+
+  time_t min_time = all[0]->time, max_time = all[0]->time;
+  for (size_t i = 1; i < num_all; i++)
+    {
+      if (all[i]->time < min_time)
+        min_time = all[i]->time;
+      if (all[i]->time > max_time)
+        max_time = all[i]->time;
+    }
+
+  schedulerRadixSort (all, num_all, min_time, max_time);
+
+  size_t num_buckets = num_all / (NLIM / 2) + 1;
+  if (num_buckets < INIT_NUM_BUCKETS)
+    num_buckets = INIT_NUM_BUCKETS;
+  if (num_buckets != sched->num_buckets)
+    {
+      bucketsDelete (sched->buckets, sched->num_buckets);
+      sched->buckets = bucketsNew (num_buckets);
+      sched->num_buckets = num_buckets;
+    }
+
+  time_t width = (max_time - min_time) / num_buckets + 1;
+  if (width > 60)
+    width = (width + 59) / 60 * 60;
+  schedulerResetBuckets (sched, min_time, width);
+
+  for (size_t i = num_all; i > 0; i--)
+    {
+      size_t idx = (all[i - 1]->time - min_time) / width;
+      EventBucket *b = &sched->buckets[idx];
+      bucketReserve (b, b->num_notices + 1);
+      b->slots[b->num_notices++]
+          = (BucketSlot){ .time = all[i - 1]->time, .evt = all[i - 1] };
+      all[i - 1]->bucket_idx = idx;
+    }
+  sched->num_queued = num_all;
+
+  memDeallocSafe (all);
+}
+
 EventNotice *
 schedulerRemoveMin (Scheduler *sched)
 {
   for (size_t i = 0; i < sched->num_buckets; i++)
     {
-      size_t idx = (sched->curr_bucket + i) % (sched->num_buckets + 1);
-      if (sched->buckets[idx].is_dummy || sched->buckets[idx].num_notices == 0)
+      size_t idx = (sched->curr_bucket + i) % sched->num_buckets;
+      time_t window_end = sched->lower_bound + (i + 1) * sched->interval_width;
+      EventBucket *b = &sched->buckets[idx];
+      if (b->num_notices == 0
+          || b->slots[b->num_notices - 1].time >= window_end)
         continue;
 
-      EventNotice *evt = sched->buckets[idx].anchor->next;
-      noticeListUnlink (evt);
-      sched->buckets[idx].num_notices--;
+      EventNotice *evt = b->slots[--b->num_notices].evt;
+      evt->bucket_idx = -1;
+      sched->num_queued--;
       sched->curr_bucket = idx;
-      sched->lower_bound = sched->buckets[idx].key;
+      sched->lower_bound += i * sched->interval_width;
 
       return evt;
     }
 
-  return NULL;
+  schedulerBulkLoad (sched, NULL, 0);
+  if (sched->buckets[sched->curr_bucket].num_notices == 0)
+    return NULL;
+
+  return schedulerRemoveMin (sched);
 }
 
 void
-schedulerHold (Scheduler *sched, EventNotice *evt, time_t delay)
+schedulerInsert (Scheduler *sched, EventNotice *evt)
 {
-  time_t new_t = evt->time + delay;
-  evt->time = new_t;
+  time_t new_t = evt->time;
+  time_t rel = (new_t - sched->lower_bound) / sched->interval_width;
+  size_t offst = rel > 0 ? rel : 0;
+  size_t idx = (sched->curr_bucket + offst) % sched->num_buckets;
+
+  EventBucket *b = &sched->buckets[idx];
+  bucketReserve (b, b->num_notices + 1);
 
-  if (evt->next && evt->next != &sched->buckets[evt->bucket_idx].anchor
-      && evt->next->time >= new_t)
+  /* Past any notices due at the same time, so a burst of them shifts
+     only the later slots; they pop in no particular order.  */
+  size_t pos = bucketSearch (b, new_t - 1);
+  memmove (&b->slots[pos + 1], &b->slots[pos],
+           (b->num_notices - pos) * sizeof (BucketSlot));
+  b->slots[pos] = (BucketSlot){ .time = new_t, .evt = evt };
+  b->num_notices++;
+  evt->bucket_idx = idx;
+
+  /* Re-bucketing each time the queue doubles keeps buckets short while
+     it grows one insert at a time, at amortized constant cost.  A long
+     bucket only forces it when it holds more than one lap of the
+     calendar; notices sharing a time cannot be spread out.  */
+  if (++sched->num_queued > sched->resize_at
+      || (b->num_notices > NLIM && offst >= sched->num_buckets
+          && b->slots[0].time - b->slots[b->num_notices - 1].time
+                 >= sched->interval_width))
+    schedulerBulkLoad (sched, NULL, 0);
+}
+
+void
+schedulerUnlink (Scheduler *sched, EventNotice *evt)
+{
+  if (evt->bucket_idx < 0)
     return;
 
-  noticeListUnlink (evt);
-  sched->buckets[evt->bucket_idx].num_notices--;
+  EventBucket *b = &sched->buckets[evt->bucket_idx];
+  size_t pos = bucketSearch (b, evt->time);
+  while (pos < b->num_notices && b->slots[pos].evt != evt)
+    pos++;
 
-  time_t rel = (new_t - sched->lower_bound) / sched->interval_width;
-  size_t offst = FLOOR (rel);
-  if (offst > sched->num_buckets)
-    offst = sched->num_buckets;
-  ssize_t idx = (sched->curr_bucket + offst) % (sched->num_buckets + 1);
+  /* The slot is found by time, so a queued notice's time must only change
+     through schedulerHold.  */
+  assert (pos < b->num_notices && b->slots[pos].time == evt->time);
 
-  while (sched->buckets[idx].key > new_t)
-    idx = (idx == 0 ? sched->num_buckets : idx - 1);
+  memmove (&b->slots[pos], &b->slots[pos + 1],
+           (b->num_notices - pos - 1) * sizeof (BucketSlot));
+  b->num_notices--;
+  sched->num_queued--;
+  evt->bucket_idx = -1;
+}
 
-  EventNotice *cursor = &sched->buckets[idx].anchor;
-  while (cursor->next != &sched->buckets[idx].anchor
-         && sched->next->time <= new_t)
-    cursor = cursor->next;
+void
+schedulerHold (Scheduler *sched, EventNotice *evt, time_t delay)
+{
+  schedulerUnlink (sched, evt);
+  evt->time += delay;
+  schedulerInsert (sched, evt);
+}
 
-  noticeListLinkAfter (cursor, evt);
-  evt->bucket_idx = idx;
-  sched->buckets[idx].num_notices++;
+EventNotice *
+scheduleAddMember (CronJob *cj)
+{
+  Schedule *sc = _job_schedule (cj);
 
-  if (sched->buckets[idx].num_notices > NLIM)
+  if (sc->num_members == sc->max_members)
     {
-      if (sched->buckets[(idx + sched->num_buckets) % (sched->num_buckets + 1)]
-              .is_dummy)
-        schedulerSplit (sched, idx);
+      size_t old_max_members = sc->max_members;
+      sc->max_members
+          = old_max_members > 0 ? old_max_members << 1 : INIT_MEMBERS_SIZE;
+      if (sc->members == NULL)
+        sc->members = memAllocBlockSafe (sc->max_members, sizeof (CronJob *));
       else
-        schedulerAdjust (sched, idx);
+        sc->members = memReallocSafe (sc->members, old_max_members,
+                                      sc->max_members, sizeof (CronJob *));
+    }
+
+  cj->member_idx = sc->num_members;
+  sc->members[sc->num_members++] = cj;
+
+  if (sc->num_members > 1)
+    return NULL;
+
+  /* The reloader computes the first fire before publishing the table;
+     it is only redone here if the table waited past it.  */
+  time_t next_time = handoffNextFire (cj);
+  if (next_time == TIME_UNSPEC)
+    {
+      time_t now = time (NULL);
+      next_time = cj->tab->store.first_fires[cj->idx];
+      if (next_time == TIME_UNSPEC || next_time < now)
+        next_time = timesetComputeNextOccurence (&sc->timeset, now);
     }
+  if (next_time == TIME_UNSPEC)
+    return NULL;
+
+  sc->notice.time = next_time;
+  atomic_store_explicit (&sc->next_fire, next_time, memory_order_relaxed);
+  return &sc->notice;
+}
+
+/* notice.time belongs to the shard thread; other threads read the copy
+   published here.  */
+time_t
+scheduleNextFire (Schedule *sc)
+{
+  return atomic_load_explicit (&sc->next_fire, memory_order_relaxed);
+}
+
+bool
+schedulerOfferDue (Scheduler *sched, EventNotice *evt)
+{
+  if (sched->dueset == NULL || evt->schedule == NULL
+      || evt->schedule->timeset.every > 0)
+    return false;
+
+  duesetAdd (sched->dueset, evt->schedule);
+  return true;
 }
 
 void
-schedulerSplit (Scheduler *sched, ssize_t idx)
+scheduleJoin (Scheduler *sched, CronJob *cj)
 {
-  if (idx < 0 || idx >= sched->num_buckets - 1)
-    return;
+  EventNotice *evt = scheduleAddMember (cj);
+  if (evt != NULL && !schedulerOfferDue (sched, evt))
+    schedulerInsert (sched, evt);
+}
 
-  EventBucket *old_bucket = &sched->buckets[idx];
-  EventBucket *new_bucket = &sched->buckets[sched->num_buckets];
+void
+scheduleLeave (Scheduler *sched, CronJob *cj)
+{
+  Schedule *sc = _job_schedule (cj);
+  CronJob *last = sc->members[--sc->num_members];
+
+  sc->members[cj->member_idx] = last;
+  last->member_idx = cj->member_idx;
+
+  if (sc->num_members == 0 && sc->due_bit >= 0)
+    duesetRemove (sched->dueset, sc);
+  else if (sc->num_members == 0)
+    schedulerUnlink (sched, &sc->notice);
+}
 
-  if (!new_bucket->is_dummy)
+void
+admissionInit (Admission *adm, size_t max_inflight)
+{
+  sem_init (&adm->slots, 0, max_inflight);
+  atomic_init (&adm->num_admitted, 0);
+  atomic_init (&adm->num_contended, 0);
+}
+
+void
+admissionEnter (Admission *adm)
+{
+  if (adm == NULL)
     return;
 
-  time_t mid = old_bucket->key + sched->interval_width / 2.0;
+  if (sem_trywait (&adm->slots) < 0)
+    {
+      atomic_fetch_add_explicit (&adm->num_contended, 1,
+                                 memory_order_relaxed);
+      while (sem_wait (&adm->slots) < 0 && errno == EINTR)
+        ;
+    }
+  atomic_fetch_add_explicit (&adm->num_admitted, 1, memory_order_relaxed);
+}
 
-  noticeListInit (&new_bucket->anchor);
-  new_bucket->key = mid;
-  new_bucket->is_dummy = false;
-  new_bucket->num_notices = 0;
+void
+admissionLeave (Admission *adm)
+{
+  if (adm != NULL)
+    sem_post (&adm->slots);
+}
+
+static double
+pressureReadPsi (const char *path)
+{
+  FILE *fstream = fopen (path, "r");
+  if (fstream == NULL)
+    return -1.0;
 
-  EventNotice *cursor = old_bucket->anchor.next;
-  while (cursor != &old_bucket->anchor)
+  double avg10 = -1.0;
+  if (fscanf (fstream, "some avg10=%lf", &avg10) != 1)
+    avg10 = -1.0;
+
+  fclose (fstream);
+  return avg10;
+}
+
+static double
+pressureSample (void)
+{
+  static const char *const psi_paths[] = {
+    "/proc/pressure/cpu",
+    "/proc/pressure/io",
+    "/proc/pressure/memory",
+  };
+  double pressure = -1.0;
+
+  for (size_t i = 0; i < sizeof (psi_paths) / sizeof (psi_paths[0]); i++)
     {
-      EventNotice *next = cursor->next;
-      if (cursor->time >= mid)
-        {
-          noticeListUnlink (cursor);
-          noticeListLinkAfter (&new_bucket->anchor, cursor);
-          cursor->bucket_idx = sched->num_buckets;
-          old_bucket->num_notices--;
-          new_bucket->num_notices++;
-        }
-      cursor = next;
+      double avg10 = pressureReadPsi (psi_paths[i]);
+      if (avg10 > pressure)
+        pressure = avg10;
     }
 
-  schedulerMoveDummy (sched);
+  if (pressure >= 0.0)
+    return pressure;
+
+  double loadavg[1] = { 0.0 };
+  long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  if (getloadavg (&loadavg[0], 1) < 1 || num_cpus < 1)
+    return 0.0;
+
+  return loadavg[0] / num_cpus * 100.0;
 }
 
+static bool
+pressureExceeds (JobPriority prio, double pressure)
+{
+  static const double thresholds[] = {
+    [PRIO_Normal] = PRESSURE_NORMAL_MAX,
+    [PRIO_Low] = PRESSURE_LOW_MAX,
+  };
+
+  return prio != PRIO_High && pressure > thresholds[prio];
+}
+
+static bool
+schedulerUnderPressure (Scheduler *sched, JobPriority prio, time_t now)
+{
+  if (prio == PRIO_High)
+    return false;
+
+  if (sched->pressure_sampled != now)
+    {
+      atomic_store (&sched->pressure, pressureSample ());
+      sched->pressure_sampled = now;
+    }
+
+  return pressureExceeds (prio, atomic_load (&sched->pressure));
+}
+
+/* The reboot thread has nothing else to do, so it waits out pressure with
+   the same backoff a deferred notice would get.  */
 void
-schedulerMoveDummy (Scheduler *sched)
+schedulerAwaitPressure (Scheduler *sched, JobPriority prio)
 {
-  ssize_t new_dummy_idx = (sched->curr_bucket - 1 + sched->num_buckets + 1)
-                          % (sched->num_buckets + 1);
-  EventBucket *b = &sched->buckets[new_dummy_idx];
+  time_t now = time (NULL);
+  time_t deadline = now + DEFER_MAX_DELAY;
+  time_t backoff = DEFER_MIN_BACKOFF;
 
-  EventNotice *cursor = b->anchor.next;
-  while (cursor != &b->anchor)
+  while (now < deadline && pressureExceeds (prio, pressureSample ()))
     {
-      EventNotice *next = cursor->next;
-      noticeListUnlink (cursor);
-      memDeallocSafe (cursor);
-      cursor = next;
+      atomic_fetch_add_explicit (&sched->num_deferrals, 1,
+                                 memory_order_relaxed);
+      sleep (now + backoff < deadline ? backoff : deadline - now);
+      backoff = backoff << 1 < DEFER_MAX_BACKOFF ? backoff << 1
+                                                 : DEFER_MAX_BACKOFF;
+      now = time (NULL);
     }
+}
+
+static void
+schedulerSpawn (Scheduler *sched, CronJob *cj)
+{
+  admissionEnter (sched->admission);
+  cronjobExecute (cj);
+  admissionLeave (sched->admission);
+  atomic_fetch_add_explicit (&sched->num_fires, 1, memory_order_relaxed);
+}
+
+/* A job has at most one deferral pending; ticks that come due while it
+   waits are merged into it.  */
+static void
+schedulerDefer (Scheduler *sched, CronJob *cj, time_t now)
+{
+  atomic_fetch_add_explicit (&sched->num_deferrals, 1, memory_order_relaxed);
+  if (atomic_exchange (&cj->deferred, true))
+    return;
 
-  b->count = 0;
-  b->key = sched->lower_bound + sched->num_buckets * sched->interval_width;
-  b->is_dummy = true;
+  EventNotice *evt = noticeNew (now, cj);
+  evt->backoff = DEFER_MIN_BACKOFF;
+  evt->deadline = now + DEFER_MAX_DELAY;
 
-  sched->lower_bound += sched->interval_width;
-  sched->curr_bucket = (sched->curr_bucket + 1) % (sched->num_buckets + 1);
+  atomic_fetch_add (&cj->tab->refs, 1);
+
+  schedulerHold (sched, evt, evt->backoff);
 }
 
-void
-schedulerAdjust (Scheduler *sched, ssize_t idx)
+static void
+schedulerRunDeferred (Scheduler *sched, EventNotice *evt, time_t now)
 {
-  size_t next_idx = (idx + 1) % (sched->num_buckets + 1);
-  EventBucket *left = &sched->buckets[idx];
-  EventBucket *right = &sched->buckets[next_idx];
+  CronJob *cj = evt->job;
+
+  if (now < evt->deadline && schedulerUnderPressure (sched, cj->priority, now))
+    {
+      evt->backoff = evt->backoff << 1 < DEFER_MAX_BACKOFF
+                         ? evt->backoff << 1
+                         : DEFER_MAX_BACKOFF;
+      evt->time = now;
+      schedulerHold (sched, evt,
+                     now + evt->backoff < evt->deadline
+                         ? evt->backoff
+                         : evt->deadline - now);
+      return;
+    }
 
-  if (left->is_dummy || right->is_dummy)
+  atomic_store (&cj->deferred, false);
+  if (!atomic_load (_job_paused (cj)) && !atomic_load (&cj->tab->paused))
+    schedulerSpawn (sched, cj);
+
+  atomic_fetch_sub (&cj->tab->refs, 1);
+  memDeallocSafe (evt);
+}
+
+/* The checks every non-forced launch goes through: pauses, CLUSTER=once
+   ownership and pressure deferral.  */
+static void
+schedulerLaunch (Scheduler *sched, CronJob *cj, time_t now)
+{
+  if (atomic_load (_job_paused (cj)) || atomic_load (&cj->tab->paused)
+      || (cj->cluster_once && !atomic_load (&cj->owned)))
     return;
 
-  ssize_t move_count = left->num_notices / 2;
-  EventNotice *cursor = left->anchor.prev;
-  while (cursor != &left->anchor && move_count > 0)
+  if (schedulerUnderPressure (sched, cj->priority, now))
+    schedulerDefer (sched, cj, now);
+  else
+    schedulerSpawn (sched, cj);
+}
+
+static void
+schedulerRunPosted (Scheduler *sched)
+{
+  EventNotice *posted = atomic_exchange (&sched->posted, NULL);
+  EventNotice *fifo = NULL;
+  while (posted != NULL)
+    {
+      EventNotice *next = posted->next;
+      posted->next = fifo;
+      fifo = posted;
+      posted = next;
+    }
+
+  time_t now = time (NULL);
+  while (fifo != NULL)
+    {
+      EventNotice *next = fifo->next;
+      if (fifo->forced)
+        schedulerSpawn (sched, fifo->job);
+      else
+        schedulerLaunch (sched, fifo->job, now);
+      atomic_fetch_sub (&fifo->job->tab->refs, 1);
+      memDeallocSafe (fifo);
+      fifo = next;
+    }
+}
+
+static void
+schedulerFanOut (Scheduler *sched, Schedule *sc, time_t fire_time,
+                 time_t now)
+{
+  if (now > fire_time)
+    atomic_fetch_add_explicit (&sched->added_latency,
+                               (now - fire_time) * sc->num_members,
+                               memory_order_relaxed);
+  atomic_fetch_add_explicit (&sched->num_latency_samples, sc->num_members,
+                             memory_order_relaxed);
+
+  for (size_t i = 0; i < sc->num_members; i++)
+    schedulerLaunch (sched, sc->members[i], now);
+}
+
+static void
+schedulePublishNext (Schedule *sc, time_t next_time)
+{
+  atomic_store_explicit (&sc->next_fire, next_time, memory_order_relaxed);
+  for (size_t i = 0; i < sc->num_members; i++)
+    statusRecordNext (sc->members[i], next_time);
+}
+
+static void
+schedulerDispatch (Scheduler *sched, EventNotice *evt, time_t now)
+{
+  Schedule *sc = evt->schedule;
+
+  if (sc == NULL)
+    {
+      schedulerRunDeferred (sched, evt, now);
+      return;
+    }
+
+  schedulerFanOut (sched, sc, evt->time, now);
+
+  time_t next_time = timesetComputeNextOccurence (
+      &sc->timeset, (now > evt->time ? now : evt->time) + 1);
+  schedulePublishNext (sc, next_time);
+
+  if (next_time != TIME_UNSPEC && sc->num_members > 0)
+    {
+      evt->time = next_time;
+      schedulerInsert (sched, evt);
+    }
+}
+
+static void
+schedulerApplySwaps (Scheduler *sched)
+{
+  TabSwap *swaps = atomic_exchange (&sched->swaps, NULL);
+  TabSwap *fifo = NULL;
+  while (swaps != NULL)
+    {
+      TabSwap *next = swaps->next;
+      swaps->next = fifo;
+      fifo = swaps;
+      swaps = next;
+    }
+
+  while (fifo != NULL)
+    {
+      TabSwap *next = fifo->next;
+
+      if (fifo->new_tab != NULL)
+        cronjobScheduleInit (sched, &fifo->new_tab->store);
+
+      if (fifo->old_tab != NULL)
+        for (size_t idx = 0; idx < fifo->old_tab->store.num_jobs; idx++)
+          scheduleLeave (sched, &fifo->old_tab->store.jobs[idx]);
+
+      fifo->next = NULL;
+      atomic_store_explicit (&fifo->done, true, memory_order_release);
+      fifo = next;
+    }
+}
+
+static void
+schedulerRunDue (Scheduler *sched, time_t now)
+{
+  DueSet *ds = sched->dueset;
+  if (now - ds->last_tick > DUESET_MAX_CATCHUP)
+    ds->last_tick = now - DUESET_MAX_CATCHUP;
+
+  /* A schedule that came due several times while the shard was behind
+     fires once, as in queue mode, and its next fire counts from now.  */
+  time_t tick = duesetNextTick (ds);
+  bool *fired = tick != TIME_UNSPEC && tick < now
+                    ? memAllocBlockSafe (ds->num_schedules, sizeof (bool))
+                    : NULL;
+
+  while (tick != TIME_UNSPEC && tick <= now)
     {
-      EventNotice *prev = cursor->prev;
-      if (cursor->time >= right->key)
+      size_t num_due = duesetCollect (ds, tick);
+      for (size_t i = 0; i < num_due; i++)
         {
-          noticeListUnlink (cursor);
-          noticeListLinkAfter (&right->anchor, cursor);
-          cursor->bucket_idx = next_idx;
-          left->num_notices--;
-          right->num_notices++;
-          move_count--;
+          Schedule *sc = ds->due[i];
+          if (fired != NULL && fired[sc->due_bit])
+            continue;
+          if (fired != NULL)
+            fired[sc->due_bit] = true;
+
+          schedulerFanOut (sched, sc, tick, now);
+          schedulePublishNext (
+              sc, timesetComputeNextOccurence (&sc->timeset, now + 1));
         }
-      cursor = prev;
+      ds->last_tick = tick;
+      tick = duesetNextTick (ds);
     }
+
+  if (fired != NULL)
+    memDeallocSafe (fired);
+  ds->last_tick = now;
+}
+
+/* Slack is applied only here, by rounding the wakeup up to a multiple of
+   it, so a fire runs at most slack - 1 seconds late.  */
+static inline time_t
+schedulerCoalesce (Scheduler *sched, time_t deadline)
+{
+  if (sched->slack <= 0)
+    return deadline;
+  return ((deadline + sched->slack - 1) / sched->slack) * sched->slack;
 }
 
 void
 schedulerExecuteLoop (Scheduler *sched)
 {
-  int tfd = timerfd_create (CLOCK_REALTIME, 0);
+  int tfd = timerfd_create (CLOCK_REALTIME, TFD_CLOEXEC);
+
+  struct pollfd pfds[2] = {
+    { .fd = tfd, .events = POLLIN },
+    { .fd = sched->wake_fd, .events = POLLIN },
+  };
+
   while (true)
     {
-      EventNotice *evt = schedulerRemoveMin (sched);
-      time_t now = time (NULL);
+      rcuQuiescent (sched->rcu);
+      schedulerApplySwaps (sched);
+      schedulerRunPosted (sched);
 
-      if (evt->time <= now)
+      time_t now = time (NULL);
+      time_t tick = sched->dueset != NULL ? duesetNextTick (sched->dueset)
+                                          : TIME_UNSPEC;
+      if (tick != TIME_UNSPEC && tick <= now)
         {
-          cronjobExecute (evt->job);
+          schedulerRunDue (sched, now);
+          continue;
+        }
 
-          time_t next_time
-              = timesetComputeNextOccurence (&evt->job->timeset, now + 60);
-          if (next_time != TIME_UNSPEC)
-            {
-              evt->time = next_time;
-              schedulerHold (sched, evt, next_time - sched->lower_bound);
-            }
+      EventNotice *evt = schedulerRemoveMin (sched);
 
+      if (evt != NULL && evt->time <= now)
+        {
+          schedulerDispatch (sched, evt, now);
           continue;
         }
 
+      time_t deadline = evt != NULL ? evt->time : TIME_UNSPEC;
+      if (tick != TIME_UNSPEC && (deadline == TIME_UNSPEC || tick < deadline))
+        deadline = tick;
+
       struct itimerspec its = (struct itimerspec){
-        .it_value.tv_sec = evt->time,
+        .it_value.tv_sec = deadline != TIME_UNSPEC
+                               ? schedulerCoalesce (sched, deadline)
+                               : 0,
         .it_value.tv_nsec = 0,
       };
 
-      timerfd_settime (tfd, TFD_TIME_ABSTIME, &its, NULL);
+      timerfd_settime (tfd, TFD_TIMER_ABSTIME, &its, NULL);
+      if (evt != NULL)
+        schedulerInsert (sched, evt);
 
-      struct pollfd pfd = (struct pollfd){
-        .fd = tfd,
-        .events = POLLIN,
-      };
-      while (poll (&pfd, 1, -1) > 0)
+      rcuOffline (sched->rcu);
+      int n_ready = poll (&pfds[0], 2, -1);
+      rcuOnline (sched->rcu);
+
+      if (n_ready <= 0)
+        continue;
+
+      atomic_fetch_add_explicit (&sched->num_wakeups, 1,
+                                 memory_order_relaxed);
+
+      if (pfds[0].revents & POLLIN)
         {
-          if (pfd.revents & POLLIN)
-            {
-              uint64_t expirations = 0;
-              read (tfd, &expirations, sizeof (expirations));
-
-              now = time (NULL);
-              if (evt->time <= now)
-                {
-                  cronjobExecute (evt->job);
-
-                  time_t next_time = timesetComputeNextOccurence (
-                      &evt->job->timeset, now + 60);
-                  if (next_time != TIME_UNSPEC)
-                    {
-                      evt->time = next_time;
-                      schedulerHold (sched, evt,
-                                     next_time - sched->lower_bound);
-                    }
-
-                  break;
-                }
-            }
+          uint64_t expirations = 0;
+          read (tfd, &expirations, sizeof (expirations));
+        }
+
+      if (pfds[1].revents & POLLIN)
+        {
+          eventfd_t cnt = 0;
+          eventfd_read (sched->wake_fd, &cnt);
         }
     }
 
   close (tfd);
 }
 
-EventNotice *
-noticeNew (time_t time, CronJob *job)
+static void *
+shardsetThread (void *arg)
 {
-  EventNotice *evt = memAllocSafe (sizeof (EventNotice));
-  evt->time = time;
-  evt->job = job;
-  evt->bucket_idx = 0;
-  evt->prev = evt->next = NULL;
-  return evt;
+  schedulerExecuteLoop (arg);
+  return NULL;
+}
+
+/* A shard count of 0 means one per online CPU.  */
+size_t
+shardsetCount (size_t num_shards)
+{
+  if (num_shards == 0)
+    {
+      long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      num_shards = num_cpus > 0 ? num_cpus : 1;
+    }
+  return num_shards;
 }
 
-static inline void
-noticeListInit (EventNotice *anchor)
+ShardSet *
+shardsetNew (size_t num_shards)
 {
-  anchor->next = anchor;
-  anchor->prev = anchor;
+  num_shards = shardsetCount (num_shards);
+
+  ShardSet *ss = memAllocSafe (sizeof (ShardSet));
+  ss->shards = memAllocBlockSafe (num_shards, sizeof (Scheduler *));
+  ss->threads = memAllocBlockSafe (num_shards, sizeof (pthread_t));
+  ss->num_shards = num_shards;
+  admissionInit (&ss->admission, SPAWN_MAX_INFLIGHT);
+
+  for (size_t i = 0; i < num_shards; i++)
+    {
+      ss->shards[i] = schedulerNew ();
+      ss->shards[i]->admission = &ss->admission;
+    }
+
+  return ss;
 }
 
-static inline void
-noticeListLinkAfter (EventNotice *cursor, EventNotice *node)
+ShardSet *
+shardsetGet (void)
 {
-  node->next = cursor->next;
-  node->prev = node;
-  cursor->next->prev = node;
-  cursor->next = node;
+  if (SHARD_SET == NULL)
+    SHARD_SET = shardsetNew (SCHED_NUM_SHARDS);
+  return SHARD_SET;
 }
 
-static inline void
-noticeListUnlink (EventNotice *node)
+Scheduler *
+shardsetPick (ShardSet *ss, const char *key)
+{
+  uint32_t hash = _fnv1a_hash32 ((const uint8_t *)key);
+  return ss->shards[hash % ss->num_shards];
+}
+
+void
+shardsetStart (ShardSet *ss)
+{
+  long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  for (size_t i = 0; i < ss->num_shards; i++)
+    {
+      /* Shards would otherwise queue on the one spawner's round trip.
+         A shard set spawnerStart did not size for forks its own.  */
+      if (ss->num_shards > 1 && ss->shards[i]->spawner == NULL)
+        ss->shards[i]->spawner = spawnerTake (i);
+      if (ss->num_shards > 1 && ss->shards[i]->spawner == NULL)
+        ss->shards[i]->spawner = spawnerNew ();
+
+      if (pthread_create (&ss->threads[i], NULL, shardsetThread,
+                          ss->shards[i])
+          != 0)
+        _err_out ("pthread_create");
+
+      if (num_cpus > 1)
+        {
+          cpu_set_t cpus;
+          CPU_ZERO (&cpus);
+          CPU_SET (i % num_cpus, &cpus);
+          pthread_setaffinity_np (ss->threads[i], sizeof (cpus), &cpus);
+        }
+    }
+}
+
+void
+shardsetReport (ShardSet *ss, FILE *fstream)
 {
-  node->prev->next = node->next;
-  node->next->prev = node->prev;
-  node->prev = node->next = NULL;
+  time_t now = time (NULL);
+
+  for (size_t i = 0; i < ss->num_shards; i++)
+    {
+      Scheduler *sched = ss->shards[i];
+      size_t num_fires = atomic_load (&sched->num_fires);
+      size_t num_wakeups = atomic_load (&sched->num_wakeups);
+      size_t added_latency = atomic_load (&sched->added_latency);
+      size_t num_samples = atomic_load (&sched->num_latency_samples);
+      time_t uptime = now > sched->started ? now - sched->started : 1;
+
+      fprintf (fstream,
+               "shard %zu slack=%lds schedules=%zu fires=%zu wakeups=%zu "
+               "wakeups/s=%.3f added_latency=%.3fs deferrals=%zu "
+               "pressure=%.2f backend=%s\n",
+               i, (long)sched->slack, sched->pool->num_schedules, num_fires,
+               num_wakeups,
+               (double)num_wakeups / uptime,
+               num_samples > 0 ? (double)added_latency / num_samples : 0.0,
+               atomic_load (&sched->num_deferrals),
+               atomic_load (&sched->pressure),
+               sched->dueset != NULL ? "dueset" : "queue");
+    }
+}
+
+size_t
+shardsetFires (ShardSet *ss)
+{
+  size_t num_fires = 0;
+  for (size_t i = 0; i < ss->num_shards; i++)
+    num_fires += atomic_load_explicit (&ss->shards[i]->num_fires,
+                                       memory_order_relaxed);
+  return num_fires;
+}
+
+/* A forced post, such as the control socket's run, spawns regardless of
+   pauses, ownership and pressure.  Otherwise the job is launched as if its
+   schedule had come due.  */
+void
+schedulerPost (Scheduler *sched, CronJob *cj, bool forced)
+{
+  EventNotice *evt = noticeNew (time (NULL), cj);
+  EventNotice *head = atomic_load (&sched->posted);
+
+  evt->forced = forced;
+  atomic_fetch_add (&cj->tab->refs, 1);
+
+  do
+    evt->next = head;
+  while (!atomic_compare_exchange_weak (&sched->posted, &head, evt));
+
+  eventfd_write (sched->wake_fd, 1);
+}
+
+void
+schedulerPublish (Scheduler *sched, TabSwap *swap)
+{
+  TabSwap *head = atomic_load (&sched->swaps);
+
+  do
+    swap->next = head;
+  while (!atomic_compare_exchange_weak (&sched->swaps, &head, swap));
+
+  eventfd_write (sched->wake_fd, 1);
 }
@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+#ifndef IOPRIO_WHO_PROCESS
+#define IOPRIO_WHO_PROCESS 1
+#endif
+
+extern char **environ;
+
+static Spawner *SPAWNER = NULL;
+static Spawner **SHARD_SPAWNERS = NULL;
+static size_t NUM_SHARD_SPAWNERS = 0;
+
+int
+spawnerOpenCapture (void)
+{
+  int fd = open (_get_tmp_dir (), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR))
+    return fd;
+
+  char path[PATH_MAX + 1] = { 0 };
+  snprintf (&path[0], PATH_MAX, "%s/lykron.XXXXXX", _get_tmp_dir ());
+  if ((fd = mkostemp (&path[0], O_CLOEXEC)) >= 0)
+    unlink (&path[0]);
+
+  return fd;
+}
+
+static bool
+spawnerWriteFile (const char *dir, const char *name, const char *val)
+{
+  char path[PATH_MAX + 1] = { 0 };
+  snprintf (&path[0], PATH_MAX, "%s/%s", dir, name);
+
+  int fd = open (&path[0], O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  bool written = write (fd, val, strlen (val)) == (ssize_t)strlen (val);
+  close (fd);
+
+  return written;
+}
+
+bool
+spawnerPrepareCgroup (JobCgroup *cg)
+{
+  char path[PATH_MAX + 1] = { 0 };
+  int path_len
+      = snprintf (&path[0], PATH_MAX, "%s/%s", CGROUP_ROOT, cg->path);
+
+  for (char *sep = &path[strlen (CGROUP_ROOT) + 1]; sep < &path[path_len];
+       sep++)
+    if (*sep == '/')
+      {
+        *sep = '\0';
+        mkdir (&path[0], 0755);
+        *sep = '/';
+      }
+
+  if (mkdir (&path[0], 0755) < 0 && errno != EEXIST)
+    return false;
+
+  if (cg->cpu_max != NULL
+      && !spawnerWriteFile (&path[0], "cpu.max", cg->cpu_max))
+    return false;
+  if (cg->memory_max != NULL
+      && !spawnerWriteFile (&path[0], "memory.max", cg->memory_max))
+    return false;
+
+  return true;
+}
+
+static bool
+spawnerApplyLimits (const JobLimits *lim, const char *cgroup)
+{
+  if (lim->has_cgroup)
+    {
+      char dir[PATH_MAX + 1] = { 0 };
+      snprintf (&dir[0], PATH_MAX, "%s/%s", CGROUP_ROOT, cgroup);
+      if (!spawnerWriteFile (&dir[0], "cgroup.procs", "0"))
+        {
+          perror ("lykron: cgroup.procs");
+          return false;
+        }
+    }
+
+  if (lim->has_cpus)
+    {
+      cpu_set_t cpus;
+      CPU_ZERO (&cpus);
+      for (size_t cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+        if (lim->cpus[cpu / 64] & (1ULL << (cpu % 64)))
+          CPU_SET (cpu, &cpus);
+
+      if (sched_setaffinity (0, sizeof (cpus), &cpus) < 0)
+        {
+          perror ("lykron: sched_setaffinity");
+          return false;
+        }
+    }
+
+  if (lim->has_nice && setpriority (PRIO_PROCESS, 0, lim->nice) < 0)
+    {
+      perror ("lykron: setpriority");
+      return false;
+    }
+
+  if (lim->has_ioprio
+      && syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, lim->ioprio) < 0)
+    {
+      perror ("lykron: ioprio_set");
+      return false;
+    }
+
+  return true;
+}
+
+static void
+spawnerExecChild (const char *user, uid_t uid, gid_t gid, int out_fd,
+                  int err_fd, const JobLimits *lim, const char *cgroup,
+                  char **argv, char **envp)
+{
+  if (dup2 (out_fd, STDOUT_FILENO) < 0 || dup2 (err_fd, STDERR_FILENO) < 0)
+    _exit (EXIT_FAILURE);
+
+  if (!spawnerApplyLimits (lim, cgroup))
+    _exit (126);
+
+  /* Supplementary groups are the user's, not the daemon's.  */
+  if ((geteuid () == 0 && initgroups (user, gid) < 0) || setgid (gid) < 0
+      || setuid (uid) < 0)
+    _exit (EXIT_FAILURE);
+
+  execvpe (argv[0], argv, envp);
+  _exit (127);
+}
+
+static char **
+spawnerUnpackStrings (char **cursor, char *end, size_t num_strings)
+{
+  char **strings = memAllocBlockSafe (num_strings + 1, sizeof (char *));
+
+  for (size_t i = 0; i < num_strings; i++)
+    {
+      char *nul = memchr (*cursor, '\0', end - *cursor);
+      if (nul == NULL)
+        {
+          memDeallocSafe (strings);
+          return NULL;
+        }
+      strings[i] = *cursor;
+      *cursor = nul + 1;
+    }
+  strings[num_strings] = NULL;
+
+  return strings;
+}
+
+static void
+spawnerServe (int sock)
+{
+  static char payload[SPAWN_MAX_PAYLOAD];
+  char cbuf[CMSG_SPACE (2 * sizeof (int))];
+
+  while (true)
+    {
+      SpawnRequest req = { 0 };
+      SpawnReply reply = { .pid = -1, .err = 0 };
+      struct iovec iov[2] = {
+        { .iov_base = &req, .iov_len = sizeof (req) },
+        { .iov_base = &payload[0], .iov_len = sizeof (payload) },
+      };
+      struct msghdr msg = { .msg_iov = &iov[0],
+                            .msg_iovlen = 2,
+                            .msg_control = &cbuf[0],
+                            .msg_controllen = sizeof (cbuf) };
+
+      ssize_t n_recvd = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+      if (n_recvd < 0 && errno == EINTR)
+        continue;
+      if (n_recvd <= 0)
+        _exit (EXIT_SUCCESS);
+      req.user[sizeof (req.user) - 1] = '\0';
+
+      int fds[2] = { -1, -1 };
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+      if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET
+          && cmsg->cmsg_type == SCM_RIGHTS
+          && cmsg->cmsg_len == CMSG_LEN (2 * sizeof (int)))
+        memcpy (&fds[0], CMSG_DATA (cmsg), sizeof (fds));
+
+      char *cursor = &payload[0];
+      char *end = &payload[0] + (n_recvd - (ssize_t)sizeof (req));
+      char **argv = NULL, **envp = NULL, **cgroup = NULL;
+
+      if (n_recvd < (ssize_t)sizeof (req) || req.argc == 0
+          || req.payload_len != (size_t)(end - cursor) || fds[0] < 0
+          || fds[1] < 0
+          || (argv = spawnerUnpackStrings (&cursor, end, req.argc)) == NULL
+          || (envp = spawnerUnpackStrings (&cursor, end, req.envc)) == NULL
+          || (cgroup = spawnerUnpackStrings (&cursor, end,
+                                             req.limits.has_cgroup))
+                 == NULL)
+        reply.err = EINVAL;
+      else
+        {
+          reply.pid = syscall (SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+          if (reply.pid == 0)
+            {
+              close (sock);
+              spawnerExecChild (&req.user[0], req.uid, req.gid, fds[0],
+                                fds[1], &req.limits, cgroup[0], argv, envp);
+            }
+          if (reply.pid < 0)
+            reply.err = errno;
+        }
+
+      memDeallocSafe (argv);
+      memDeallocSafe (envp);
+      memDeallocSafe (cgroup);
+      if (fds[0] >= 0)
+        close (fds[0]);
+      if (fds[1] >= 0)
+        close (fds[1]);
+
+      while (send (sock, &reply, sizeof (reply), MSG_NOSIGNAL) < 0
+             && errno == EINTR)
+        ;
+    }
+}
+
+static bool
+spawnerFork (Spawner *spw)
+{
+  int sv[2];
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    return false;
+
+  pid_t parent = getpid ();
+  pid_t pid = fork ();
+  if (pid < 0)
+    {
+      close (sv[0]);
+      close (sv[1]);
+      return false;
+    }
+
+  if (pid == 0)
+    {
+      sigset_t mask;
+      sigemptyset (&mask);
+      sigprocmask (SIG_SETMASK, &mask, NULL);
+
+      prctl (PR_SET_PDEATHSIG, SIGKILL);
+      if (getppid () != parent)
+        _exit (EXIT_SUCCESS);
+
+      close (sv[0]);
+      close_range (3, sv[1] - 1, 0);
+      close_range (sv[1] + 1, ~0U, 0);
+      prctl (PR_SET_NAME, "lykron-spawner");
+
+      spawnerServe (sv[1]);
+    }
+
+  close (sv[1]);
+  spw->sock = sv[0];
+  spw->pid = pid;
+  return true;
+}
+
+Spawner *
+spawnerNew (void)
+{
+  Spawner *spw = memAllocSafe (sizeof (Spawner));
+  if (!spawnerFork (spw))
+    _err_out ("spawnerNew");
+  pthread_mutex_init (&spw->lock, NULL);
+
+  return spw;
+}
+
+/* Replaces a zygote whose socket failed.  The new one is forked from the
+   daemon as it is now, so it is larger than the one started early.  */
+static void
+spawnerRestart (Spawner *spw)
+{
+  if (spw->sock >= 0)
+    {
+      close (spw->sock);
+      kill (spw->pid, SIGKILL);
+    }
+
+  if (!spawnerFork (spw))
+    spw->sock = -1;
+}
+
+/* The shards' zygotes are forked here too, while the daemon image is
+   still small; shardsetStart takes them later.  */
+Spawner *
+spawnerStart (void)
+{
+  if (SPAWNER != NULL)
+    return SPAWNER;
+
+  SPAWNER = spawnerNew ();
+
+  size_t num_shards = shardsetCount (SCHED_NUM_SHARDS);
+  if (num_shards > 1)
+    {
+      SHARD_SPAWNERS = memAllocBlockSafe (num_shards, sizeof (Spawner *));
+      for (size_t i = 0; i < num_shards; i++)
+        SHARD_SPAWNERS[i] = spawnerNew ();
+      NUM_SHARD_SPAWNERS = num_shards;
+    }
+
+  return SPAWNER;
+}
+
+Spawner *
+spawnerTake (size_t shard_idx)
+{
+  if (shard_idx >= NUM_SHARD_SPAWNERS)
+    return NULL;
+
+  Spawner *spw = SHARD_SPAWNERS[shard_idx];
+  SHARD_SPAWNERS[shard_idx] = NULL;
+  return spw;
+}
+
+Spawner *
+spawnerGet (void)
+{
+  return SPAWNER;
+}
+
+void
+spawnerStop (Spawner *spw)
+{
+  if (spw->sock >= 0)
+    close (spw->sock);
+  pthread_mutex_destroy (&spw->lock);
+  if (spw == SPAWNER)
+    SPAWNER = NULL;
+  memDeallocSafe (spw);
+}
+
+static size_t
+spawnerPackStrings (char *payload, size_t payload_len, char **strings,
+                    uint32_t *num_strings)
+{
+  for (*num_strings = 0; strings[*num_strings] != NULL; (*num_strings)++)
+    {
+      size_t str_len = strlen (strings[*num_strings]) + 1;
+      if (payload_len + str_len > SPAWN_MAX_PAYLOAD)
+        return SIZE_MAX;
+      memcpy (&payload[payload_len], strings[*num_strings], str_len);
+      payload_len += str_len;
+    }
+
+  return payload_len;
+}
+
+pid_t
+spawnerSpawn (Spawner *spw, CronJob *cj, int out_fd, int err_fd)
+{
+  char **envp = cj->tab->envp != NULL ? cj->tab->envp : environ;
+
+  if (spw == NULL)
+    {
+      pid_t pid = fork ();
+      if (pid == 0)
+        spawnerExecChild (&cj->user[0], cj->uid, cj->gid, out_fd, err_fd,
+                          &cj->limits, cj->cgroup.path, cj->argv, envp);
+      return pid;
+    }
+
+  SpawnRequest req = { .uid = cj->uid, .gid = cj->gid, .limits = cj->limits };
+  memcpy (&req.user[0], &cj->user[0], sizeof (req.user));
+  SpawnReply reply = { .pid = -1, .err = EPROTO };
+  char cbuf[CMSG_SPACE (2 * sizeof (int))] = { 0 };
+  int fds[2] = { out_fd, err_fd };
+
+  pthread_mutex_lock (&spw->lock);
+
+  if (spw->sock < 0)
+    spawnerRestart (spw);
+  if (spw->sock < 0)
+    {
+      pthread_mutex_unlock (&spw->lock);
+      errno = EPIPE;
+      return -1;
+    }
+
+  size_t payload_len = spawnerPackStrings (&spw->payload[0], 0, cj->argv,
+                                           &req.argc);
+  if (payload_len != SIZE_MAX)
+    payload_len = spawnerPackStrings (&spw->payload[0], payload_len, envp,
+                                      &req.envc);
+  if (payload_len != SIZE_MAX && cj->limits.has_cgroup)
+    {
+      char *cgroup[] = { cj->cgroup.path, NULL };
+      uint32_t num_cgroup = 0;
+      payload_len = spawnerPackStrings (&spw->payload[0], payload_len,
+                                        &cgroup[0], &num_cgroup);
+    }
+  if (payload_len == SIZE_MAX)
+    {
+      pthread_mutex_unlock (&spw->lock);
+      errno = E2BIG;
+      return -1;
+    }
+  req.payload_len = payload_len;
+
+  struct iovec iov[2] = {
+    { .iov_base = &req, .iov_len = sizeof (req) },
+    { .iov_base = &spw->payload[0], .iov_len = payload_len },
+  };
+  struct msghdr msg = { .msg_iov = &iov[0],
+                        .msg_iovlen = 2,
+                        .msg_control = &cbuf[0],
+                        .msg_controllen = sizeof (cbuf) };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), &fds[0], sizeof (fds));
+
+  ssize_t n_io;
+  while ((n_io = sendmsg (spw->sock, &msg, MSG_NOSIGNAL)) < 0
+         && errno == EINTR)
+    ;
+  if (n_io >= 0)
+    while ((n_io = recv (spw->sock, &reply, sizeof (reply), 0)) < 0
+           && errno == EINTR)
+      ;
+
+  /* EOF or a short reply means the zygote is gone or out of step; this
+     fire fails and the next one gets a fresh zygote.  */
+  if (n_io != sizeof (reply))
+    {
+      spawnerRestart (spw);
+      pthread_mutex_unlock (&spw->lock);
+      errno = EPIPE;
+      return -1;
+    }
+
+  pthread_mutex_unlock (&spw->lock);
+
+  if (reply.pid < 0)
+    errno = reply.err;
+
+  return reply.pid;
+}
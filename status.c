@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#define POSIX_SOURCE
+#define POSIX_C_SOURCE
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* Readers map STATUS_FILE read-only and, per record, load seq, copy the
+   record, then reload seq; the copy is consistent if both loads are equal
+   and even.  last_start and last_duration are in milliseconds.  */
+
+static StatusPage *STATUS_PAGE = NULL;
+static pthread_once_t STATUS_PAGE_ONCE = PTHREAD_ONCE_INIT;
+
+static int64_t
+statusNowMs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+statusStart (void)
+{
+  size_t map_len = sizeof (StatusHeader)
+                   + STATUS_MAX_JOBS * sizeof (StatusRecord);
+
+  char path[PATH_MAX + 1];
+  int fd = open (_instance_path (STATUS_FILE, &path[0]),
+                 O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0640);
+  if (fd < 0)
+    return;
+
+  /* The lock lives as long as the daemon; a second instance pointed at
+     the same file leaves the live page alone and runs without one.  */
+  struct stat st = { 0 };
+  if (flock (fd, LOCK_EX | LOCK_NB) < 0 || fstat (fd, &st) < 0
+      || !S_ISREG (st.st_mode))
+    {
+      close (fd);
+      return;
+    }
+
+  struct group *grp = getgrnam (STATUS_GROUP);
+  if (grp != NULL)
+    fchown (fd, -1, grp->gr_gid);
+  if (fchmod (fd, 0640) < 0 || ftruncate (fd, map_len) < 0)
+    {
+      close (fd);
+      return;
+    }
+
+  void *map = mmap (NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      close (fd);
+      return;
+    }
+  memset (map, 0, map_len);
+
+  StatusPage *page = memAllocSafe (sizeof (StatusPage));
+  page->hdr = map;
+  page->records = (StatusRecord *)&page->hdr[1];
+  page->map_len = map_len;
+  page->fd = fd;
+  page->free_slots = memAllocBlockSafe (STATUS_MAX_JOBS, sizeof (uint32_t));
+  page->num_free = STATUS_MAX_JOBS;
+  pthread_mutex_init (&page->lock, NULL);
+
+  for (size_t i = 0; i < STATUS_MAX_JOBS; i++)
+    {
+      atomic_init (&page->records[i].seq, 0);
+      page->free_slots[i] = STATUS_MAX_JOBS - 1 - i;
+    }
+
+  page->hdr->version = STATUS_VERSION;
+  page->hdr->num_records = STATUS_MAX_JOBS;
+  page->hdr->record_size = sizeof (StatusRecord);
+  page->hdr->started = time (NULL);
+  atomic_thread_fence (memory_order_release);
+  page->hdr->magic = STATUS_MAGIC;
+
+  STATUS_PAGE = page;
+}
+
+StatusPage *
+statusGet (void)
+{
+  pthread_once (&STATUS_PAGE_ONCE, statusStart);
+  return STATUS_PAGE;
+}
+
+static void
+statusWriteBegin (StatusRecord *rec)
+{
+  unsigned seq = atomic_load_explicit (&rec->seq, memory_order_relaxed);
+  do
+    while (seq & 1)
+      seq = atomic_load_explicit (&rec->seq, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit (&rec->seq, &seq, seq + 1,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed));
+  atomic_thread_fence (memory_order_release);
+}
+
+static void
+statusWriteEnd (StatusRecord *rec)
+{
+  atomic_fetch_add_explicit (&rec->seq, 1, memory_order_release);
+}
+
+void
+statusAcquire (CronJob *cj)
+{
+  StatusPage *page = statusGet ();
+  if (page == NULL || cj->status != NULL)
+    return;
+
+  pthread_mutex_lock (&page->lock);
+  if (page->num_free > 0)
+    cj->status = &page->records[page->free_slots[--page->num_free]];
+  else
+    page->hdr->num_dropped++;
+  pthread_mutex_unlock (&page->lock);
+
+  StatusRecord *rec = cj->status;
+  if (rec == NULL)
+    return;
+
+  statusWriteBegin (rec);
+  rec->pid = 0;
+  rec->last_exit = -1;
+  rec->last_start = 0;
+  rec->last_duration = 0;
+  rec->next_fire = TIME_UNSPEC;
+  rec->num_runs = 0;
+  memset (&rec->tab[0], 0, sizeof (rec->tab));
+  memset (&rec->label[0], 0, sizeof (rec->label));
+  memset (&rec->command[0], 0, sizeof (rec->command));
+  strncpy (&rec->tab[0], &cj->tab->path[0], sizeof (rec->tab) - 1);
+  if (cj->label != NULL)
+    strncpy (&rec->label[0], cj->label, sizeof (rec->label) - 1);
+  memcpy (&rec->command[0], cj->command,
+          cj->command_len < sizeof (rec->command) - 1
+              ? cj->command_len
+              : sizeof (rec->command) - 1);
+  rec->in_use = 1;
+  statusWriteEnd (rec);
+}
+
+void
+statusRelease (CronJob *cj)
+{
+  StatusRecord *rec = cj->status;
+  if (rec == NULL)
+    return;
+
+  statusWriteBegin (rec);
+  rec->in_use = 0;
+  statusWriteEnd (rec);
+
+  StatusPage *page = STATUS_PAGE;
+  pthread_mutex_lock (&page->lock);
+  page->free_slots[page->num_free++] = rec - page->records;
+  pthread_mutex_unlock (&page->lock);
+
+  cj->status = NULL;
+}
+
+void
+statusRecordNext (CronJob *cj, time_t next_fire)
+{
+  StatusRecord *rec = cj != NULL ? cj->status : NULL;
+  if (rec == NULL)
+    return;
+
+  statusWriteBegin (rec);
+  rec->next_fire = next_fire;
+  statusWriteEnd (rec);
+}
+
+void
+statusRecordStart (CronJob *cj, pid_t pid)
+{
+  StatusRecord *rec = cj != NULL ? cj->status : NULL;
+  if (rec == NULL)
+    return;
+
+  statusWriteBegin (rec);
+  rec->pid = pid;
+  rec->last_start = statusNowMs ();
+  rec->num_runs++;
+  statusWriteEnd (rec);
+}
+
+void
+statusRecordExit (CronJob *cj, pid_t pid, int exit_stat)
+{
+  StatusRecord *rec = cj != NULL ? cj->status : NULL;
+  if (rec == NULL)
+    return;
+
+  statusWriteBegin (rec);
+  if (rec->pid == pid)
+    rec->pid = 0;
+  rec->last_exit = exit_stat;
+  rec->last_duration = statusNowMs () - rec->last_start;
+  statusWriteEnd (rec);
+}
@@ -4,10 +4,14 @@
 #include <errno.h>
 #include <limits.h>
 #include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "lykron.h"
@@ -32,7 +36,7 @@ symtblDelete (Symtbl *stab)
       if (stab->symbols[i].occupied)
         {
           memDeallocSafe (stab->symbols[i].key);
-          if (stab->symbols[i].value.v_str)
+          if (!stab->symbols[i].numeric)
             memDeallocSafe (stab->symbols[i].value.v_str);
         }
     }
@@ -41,79 +45,99 @@ symtblDelete (Symtbl *stab)
   memDeallocSafe (stab);
 }
 
-void
-symtblSet (Symtbl *stab, const uint8_t *key, size_t key_len, uint8_t *value,
-           size_t value_len)
+static size_t
+symtblProbe (const Symtbl *stab, const uint8_t *key)
 {
-  if (stab->num_symbols + 1 >= stab->max_symbols)
-    {
-      size_t old_max_symbols = stab->max_symbols;
-      stab->max_symbols <<= 1;
-      stab->log2 += 1;
-      stab->symbols
-          = memReallocSafe (stab->symbols, old_max_symbols, stab->max_symbols,
-                            sizeof (struct Symbol));
-    }
+  size_t mask = stab->max_symbols - 1;
+  size_t idx = _knuth_hash32 (key) >> (32 - stab->log2);
 
-  size_t idx = _knuth_hash32 (key, stab->log2);
-  if (stab->symbols[idx].occupied)
+  while (stab->symbols[idx].occupied
+         && strcmp ((const char *)stab->symbols[idx].key, (const char *)key))
+    idx = (idx + 1) & mask;
+
+  return idx;
+}
+
+static void
+symtblGrow (Symtbl *stab)
+{
+  if ((stab->num_symbols + 1) << 1 <= stab->max_symbols)
+    return;
+
+  struct Symbol *old_symbols = stab->symbols;
+  size_t old_max_symbols = stab->max_symbols;
+  stab->max_symbols <<= 1;
+  stab->log2 += 1;
+  stab->symbols
+      = memAllocBlockSafe (stab->max_symbols, sizeof (struct Symbol));
+
+  for (size_t i = 0; i < old_max_symbols; i++)
+    if (old_symbols[i].occupied)
+      stab->symbols[symtblProbe (stab, old_symbols[i].key)] = old_symbols[i];
+
+  memDeallocSafe (old_symbols);
+}
+
+static struct Symbol *
+symtblInsert (Symtbl *stab, const uint8_t *key, size_t key_len)
+{
+  symtblGrow (stab);
+
+  uint8_t *keydup = (uint8_t *)strndup ((const char *)key, key_len);
+  struct Symbol *sym = &stab->symbols[symtblProbe (stab, keydup)];
+  if (sym->occupied)
     {
-      memDeallocSafe (stab->symbols[idx].value);
-      stab->symbols[idx].value = strndup (value, value_len);
+      memDeallocSafe (keydup);
+      if (!sym->numeric)
+        memDeallocSafe (sym->value.v_str);
     }
   else
     {
-      stab->symbols[idx].key = strndup (key, key_len);
-      stab->symbols[idx].value.v_str = strndup (value, value_len);
-      stab->symbols[idx].occupied = true;
+      sym->key = keydup;
+      sym->occupied = true;
       stab->num_symbols++;
     }
+
+  return sym;
 }
 
 void
-symtblSetNumeric (Symtbl *stab, const uint8_t *key, size_t key_len, int value)
+symtblSet (Symtbl *stab, const char *key, size_t key_len, const char *value,
+           size_t value_len)
 {
+  struct Symbol *sym = symtblInsert (stab, (const uint8_t *)key, key_len);
+  sym->value.v_str = (uint8_t *)strndup (value, value_len);
+  sym->numeric = false;
+}
 
-  if (stab->num_symbols + 1 >= stab->max_symbols)
-    {
-      size_t old_max_symbols = stab->max_symbols;
-      stab->max_symbols <<= 1;
-      stab->log2 += 1;
-      stab->symbols
-          = memReallocSafe (stab->symbols, old_max_symbols, stab->max_symbols,
-                            sizeof (struct Symbol));
-    }
-
-  size_t idx = _knuth_hash32 (key, stab->log2);
-  if (stab->symbols[idx].occupied)
-    stab->symbols[idx].value = value;
-  else
-    {
-      stab->symbols[idx].key = strndup (key, key_len);
-      stab->symbols[idx].value.v_num = value;
-      stab->symbols[idx].occupied = true;
-      stab->num_symbols++;
-    }
+void
+symtblSetNumeric (Symtbl *stab, const char *key, size_t key_len, int value)
+{
+  struct Symbol *sym = symtblInsert (stab, (const uint8_t *)key, key_len);
+  sym->value.v_num = value;
+  sym->numeric = true;
 }
 
 char *
-symtblGet (Symtbl *stab, const uint8_t *key)
+symtblGet (Symtbl *stab, const char *key)
 {
-  size_t idx = _knuth_hash32 (key, stab->log2);
-  if (idx >= stab->max_symbols || !stab->symbols[idx].occupied)
+  struct Symbol *sym
+      = &stab->symbols[symtblProbe (stab, (const uint8_t *)key)];
+  if (!sym->occupied || sym->numeric)
     return NULL;
   else
-    return stab->symbols[idx].value.v_str;
+    return (char *)sym->value.v_str;
 }
 
 int
-symtblGetNumeric (Symtbl *stab, const uint8_t *key)
+symtblGetNumeric (Symtbl *stab, const char *key)
 {
-  size_t idx = _knuth_hash32 (key, stab->log2);
-  if (idx >= stab->max_symbols || !stab->symbols[idex].occupied)
+  struct Symbol *sym
+      = &stab->symbols[symtblProbe (stab, (const uint8_t *)key)];
+  if (!sym->occupied || !sym->numeric)
     return -1;
   else
-    return stab->symbols[idx].value.v_num;
+    return sym->value.v_num;
 }
 
 char **
@@ -123,137 +147,375 @@ symtblGetEnvironPointer (Symtbl *stab)
   size_t env_n = 0;
   for (size_t i = 0; i < stab->max_symbols; i++)
     {
-      if (!stab->symbols[i].occupied)
+      if (!stab->symbols[i].occupied || stab->symbols[i].numeric)
         continue;
-      size_t key_len = strlen (stab->symbols[i].key);
-      size_t val_len = strlen (stab->symbols[i].value);
+      const char *key = (const char *)stab->symbols[i].key;
+      const char *value = (const char *)stab->symbols[i].value.v_str;
+      size_t key_len = strlen (key);
+      size_t val_len = strlen (value);
       environ[env_n]
           = memAllocBlockSafe (key_len + val_len + 2, sizeof (char));
-      strncat (environ[env_n], stab->symbols[i].key, key_len);
+      strncat (environ[env_n], key, key_len);
       strncat (environ[env_n], "=", 1);
-      strncat (environ[env_n], stab->symbols[i].value, val_len);
+      strncat (environ[env_n], value, val_len);
       env_n++;
     }
-  environ[stab->num_symbols] = NULL;
+  environ[env_n] = NULL;
   return environ;
 }
 
+/* A detached table has no logger, so parsing one neither opens LOG_FILE
+   nor starts the spawner.  */
 CronTab *
-crontabNew (const char *path, const char *user, bool is_main)
+crontabNewDetached (const char *path, const char *user, bool is_main)
 {
   CronTab *ct = memAllocSafe (sizeof (CronTab));
-  ct->path = strndup (&ct->path[0], path, PATH_MAX);
-  ct->user = strndup (&ct->user[0], user, LOGIN_NAME_MAX);
-  ct->first_job = NULL;
+  strncpy ((char *)&ct->path[0], path, PATH_MAX);
+  if (user != NULL)
+    strncpy ((char *)&ct->user[0], user, LOGIN_NAME_MAX);
+  jobstoreInit (&ct->store);
+  ct->envp = NULL;
   ct->is_main = is_main;
-  ct->sched = schedulerNew ();
-  ct->logger = loggerNew ();
+  ct->sched = shardsetPick (shardsetGet (), path);
+  ct->logger = NULL;
   ct->stab = symtblNew ();
-  ct->next = NULL;
+  atomic_init (&ct->paused, false);
+  atomic_init (&ct->refs, 0);
 
-  struct stat st = { 0 };
-  if (stat (&ct->path[0], &st) < 0)
-    _err_out ("stat");
+  return ct;
+}
+
+CronTab *
+crontabNew (const char *path, const char *user, bool is_main)
+{
+  CronTab *ct = crontabNewDetached (path, user, is_main);
+  ct->logger = loggerNew ();
 
-  ct->mtime = st.st_mtim.tv_sec;
+  return ct;
 }
 
 void
-crontabListDelete (CronTab *ct)
+crontabDelete (CronTab *ct)
 {
-  if (ct == NULL)
-    return;
-
-  CronTab *next = ct->next;
-  schedulerDelete (ct->scheduler);
   loggerDelete (ct->logger);
-  cronjobListDelete (ct->first_job);
+  jobstoreDelete (&ct->store);
+  symtblDelete (ct->stab);
+  for (size_t i = 0; ct->envp != NULL && ct->envp[i] != NULL; i++)
+    memDeallocSafe (ct->envp[i]);
+  memDeallocSafe (ct->envp);
   memDeallocSafe (ct);
-  crontabListDelete (next);
 }
 
-void
-crontabListLink (CronTab *hct, CronTab *nct)
+static inline bool
+_is_tab_name (const char *name)
+{
+  size_t name_len = strlen (name);
+  return name_len > 0 && name[0] != '.' && name[name_len - 1] != '~';
+}
+
+static inline uint64_t
+_monotonic_ms (void)
 {
-  CronTab *tct = NULL;
-  for (tct = hct; tct->next; tct = tct->next)
-    ;
-  tct->next = nct;
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-bool
-crontabIsModifiedMtime (CronTab *ct)
+static void
+crontabDebounce (Reloader *rld, const char *dir, const char *name)
 {
-  struct stat st;
-  if (stat (&ct->path[0], &st) < 0)
-    _err_out ("stat");
+  char path[PATH_MAX + 1] = { 0 };
+  snprintf (&path[0], PATH_MAX, "%s%s", dir, name);
 
-  if (ct->mtime < st.st_mtim.tv_sec)
+  struct Debounce *dbn = rld->debounce;
+  while (dbn != NULL && strncmp (&dbn->path[0], &path[0], PATH_MAX))
+    dbn = dbn->next;
+
+  if (dbn == NULL)
     {
-      ct->mtime = st.st_mtim.tv_sec;
-      return true;
+      dbn = memAllocSafe (sizeof (struct Debounce));
+      strncpy (&dbn->path[0], &path[0], PATH_MAX);
+      dbn->next = rld->debounce;
+      rld->debounce = dbn;
     }
 
-  return false;
+  dbn->deadline = _monotonic_ms () + RELOAD_DEBOUNCE_INTERVAL;
 }
 
-void
-crontabWatchMtime (CronTab *ctlst)
+static void
+crontabDebounceAll (Reloader *rld)
 {
-  for (CronTab *tct = ctlst; tct; tct = tct->next)
-    if (crontabIsModifiedMtime (tct))
-      crontabReload (ctlst, &tct->path[0]);
+  TabSet *set = atomic_load (&rld->current);
+  for (size_t i = 0; i < set->num_tabs; i++)
+    crontabDebounce (rld, "", &set->tabs[i]->path[0]);
+
+  for (size_t i = 0; i < rld->num_watches; i++)
+    {
+      struct WatchDir *wdir = &rld->watches[i];
+      if (wdir->wd < 0)
+        continue;
+      if (wdir->only != NULL)
+        {
+          crontabDebounce (rld, wdir->dir, wdir->only);
+          continue;
+        }
+
+      DIR *dir = opendir (wdir->dir);
+      if (dir == NULL)
+        continue;
+
+      struct dirent *entry;
+      while ((entry = readdir (dir)) != NULL)
+        if (entry->d_type == DT_REG && _is_tab_name (entry->d_name))
+          crontabDebounce (rld, wdir->dir, entry->d_name);
+
+      closedir (dir);
+    }
+}
+
+static void
+crontabAddWatch (Reloader *rld, const char *dir, const char *only, bool dirs)
+{
+  int wd = inotify_add_watch (rld->inotify_fd, dir,
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE
+                                  | IN_MOVED_FROM | IN_ONLYDIR
+                                  | (dirs ? IN_CREATE : 0));
+  if (wd < 0)
+    _err_out ("inotify_add_watch");
+
+  struct WatchDir *wdir = &rld->watches[rld->num_watches++];
+  wdir->wd = wd;
+  wdir->dir = dir;
+  wdir->only = only;
+  wdir->dirs = dirs;
+}
+
+/* The membership list's parent is always watched, so a switch between a
+   file and a directory is seen; the directory itself is watched while the
+   list is one.  */
+static void
+crontabWatchMembers (Reloader *rld)
+{
+  Cluster *cl = clusterGet ();
+  struct WatchDir *wdir = NULL;
+  for (size_t i = 0; i < rld->num_watches; i++)
+    if (rld->watches[i].dir == &cl->members_dir[0])
+      wdir = &rld->watches[i];
+
+  if (!cl->is_dir)
+    {
+      if (wdir != NULL && wdir->wd >= 0)
+        {
+          inotify_rm_watch (rld->inotify_fd, wdir->wd);
+          wdir->wd = -1;
+        }
+      return;
+    }
+
+  if (wdir != NULL && wdir->wd >= 0)
+    return;
+
+  int wd = inotify_add_watch (rld->inotify_fd, &cl->members_dir[0],
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE
+                                  | IN_MOVED_FROM | IN_ONLYDIR);
+  if (wd < 0)
+    return;
+
+  if (wdir == NULL)
+    wdir = &rld->watches[rld->num_watches++];
+  wdir->wd = wd;
+  wdir->dir = &cl->members_dir[0];
+  wdir->only = NULL;
+  wdir->dirs = false;
+}
+
+static int
+crontabFlushDebounced (Reloader *rld)
+{
+  uint64_t now = _monotonic_ms ();
+  uint64_t next_deadline = now + RELOAD_GRACE_INTERVAL;
+
+  for (struct Debounce **dbnp = &rld->debounce; *dbnp != NULL;)
+    {
+      struct Debounce *dbn = *dbnp;
+      if (dbn->deadline <= now)
+        {
+          *dbnp = dbn->next;
+          if (clusterIsMembership (clusterGet (), &dbn->path[0]))
+            {
+              clusterReload (clusterGet (), atomic_load (&rld->current));
+              crontabWatchMembers (rld);
+            }
+          else
+            reloaderReload (rld, &dbn->path[0]);
+          memDeallocSafe (dbn);
+          continue;
+        }
+
+      if (dbn->deadline < next_deadline)
+        next_deadline = dbn->deadline;
+      dbnp = &dbn->next;
+    }
+
+  return next_deadline - now;
 }
 
 void
-crontabWatchInotify (CronTab *ctlst)
+crontabWatchInotify (Reloader *rld)
 {
-  int wd = 0;
-  struct pollfd pfd;
-  int inotfd = inotify_init1 (IN_NONBLOCK);
-  if (inotfd < 0)
+  static char syswide_dir[PATH_MAX + 1] = { 0 };
+  const char *syswide_name = strrchr (TABLE_FILE_SYSWIDE, '/') + 1;
+  strncpy (&syswide_dir[0], TABLE_FILE_SYSWIDE,
+           syswide_name - TABLE_FILE_SYSWIDE);
+
+  size_t num_dirs = 0;
+  while (TABLE_DIRS[num_dirs] != NULL)
+    num_dirs++;
+
+  rld->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (rld->inotify_fd < 0)
     _err_out ("inotify_init");
 
-  for (size_t i = 0; TABLE_DIRS[i] != NULL; i++)
-    wd = inotify_add_watch (inotfd, TABLE_DIRS[i],
-                            IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_FROM
-                                | IN_MOVED_TO);
+  rld->watches = memAllocBlockSafe (num_dirs + 3, sizeof (struct WatchDir));
+  crontabAddWatch (rld, &syswide_dir[0], syswide_name, false);
+  for (size_t i = 0; i < num_dirs; i++)
+    crontabAddWatch (rld, TABLE_DIRS[i], NULL, false);
 
-  if (wd < 0)
-    _err_out ("inotify_add_watch");
+  Cluster *cl = clusterGet ();
+  if (access (&cl->watch_dir[0], F_OK) == 0)
+    crontabAddWatch (rld, &cl->watch_dir[0], cl->watch_only, true);
+  crontabWatchMembers (rld);
+
+  struct pollfd pfd = { .fd = rld->inotify_fd, .events = POLLIN };
+  char buf[MAX_BUF]
+      __attribute__ ((aligned (__alignof__ (struct inotify_event))));
 
-  pfd = (struct pollfd){
-    .fd = inotfd,
-    .events = POLLIN,
-  };
-  if (poll (&pfd, 1, -1) && (pfd.revents & POLLIN))
+  while (true)
     {
-      char buf[MAX_BUF] = { 0 };
-      ssize_t n_read = read (inotfd, buf, sizeof (buf));
+      int timeout = crontabFlushDebounced (rld);
+      reloaderCollect (rld);
+
+      if (poll (&pfd, 1, timeout) <= 0 || !(pfd.revents & POLLIN))
+        continue;
+
+      ssize_t n_read = read (rld->inotify_fd, &buf[0], sizeof (buf));
       if (n_read < 0)
-        _err_out ("read");
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+          _err_out ("read");
+        }
 
-      for (char *ptr = &buf[0]; ptr < buf + n_read;)
+      for (char *ptr = &buf[0]; ptr < &buf[0] + n_read;)
         {
           struct inotify_event *evt = (struct inotify_event *)ptr;
+          ptr += sizeof (struct inotify_event) + evt->len;
+
+          if (evt->mask & IN_Q_OVERFLOW)
+            {
+              crontabDebounceAll (rld);
+              continue;
+            }
 
-          if (evt->mask & IN_MODIFY || evt->mask & IN_CREATE
-              || evt->mask & IN_MOVED_TO)
-            crontabReload (ctlst, evt->name);
+          if (evt->mask & IN_IGNORED)
+            {
+              for (size_t i = 0; i < rld->num_watches; i++)
+                if (rld->watches[i].wd == evt->wd)
+                  rld->watches[i].wd = -1;
+              continue;
+            }
 
-          ptr += sizeof (struct inotify_event) + evt->len;
+          if (evt->len == 0 || !_is_tab_name (evt->name))
+            continue;
+
+          for (size_t i = 0; i < rld->num_watches; i++)
+            {
+              struct WatchDir *wdir = &rld->watches[i];
+              if (wdir->wd == evt->wd
+                  && (!(evt->mask & IN_ISDIR) || wdir->dirs)
+                  && (wdir->only == NULL || !strcmp (wdir->only, evt->name)))
+                crontabDebounce (rld, wdir->dir, evt->name);
+            }
         }
     }
 }
 
-CronTab *
+RcuReader *
+rcuRegister (Reloader *rld)
+{
+  size_t idx = atomic_fetch_add (&rld->num_readers, 1);
+  if (idx >= RCU_MAX_READERS)
+    _err_out ("rcuRegister");
+
+  RcuReader *rdr = &rld->readers[idx];
+  rdr->gp_epoch = &rld->gp_epoch;
+  atomic_store (&rdr->seen, atomic_load (&rld->gp_epoch));
+
+  return rdr;
+}
+
+void
+rcuQuiescent (RcuReader *rdr)
+{
+  if (rdr != NULL)
+    atomic_store (&rdr->seen, atomic_load (rdr->gp_epoch));
+}
+
+void
+rcuOffline (RcuReader *rdr)
+{
+  if (rdr != NULL)
+    atomic_store (&rdr->seen, SIZE_MAX);
+}
+
+void
+rcuOnline (RcuReader *rdr)
+{
+  rcuQuiescent (rdr);
+}
+
+static TabSet *
+tabsetNew (size_t num_tabs, size_t generation)
+{
+  TabSet *set = memAllocSafe (sizeof (TabSet));
+  set->tabs = memAllocBlockSafe (num_tabs + 1, sizeof (CronTab *));
+  set->num_tabs = num_tabs;
+  set->max_tabs = num_tabs + 1;
+  set->generation = generation;
+
+  return set;
+}
+
+static void
+tabsetAppend (TabSet *set, CronTab *ct)
+{
+  if (set->num_tabs == set->max_tabs)
+    {
+      size_t old_max_tabs = set->max_tabs;
+      set->max_tabs <<= 1;
+      set->tabs = memReallocSafe (set->tabs, old_max_tabs, set->max_tabs,
+                                  sizeof (CronTab *));
+    }
+
+  set->tabs[set->num_tabs++] = ct;
+}
+
+static void
+tabsetDelete (TabSet *set)
+{
+  memDeallocSafe (set->tabs);
+  memDeallocSafe (set);
+}
+
+TabSet *
 crontabLoadAll (void)
 {
-  const char *path = NULL;
-  CronTab *ctlst = crontabLoadFromFile (TABLE_FILE_SYSWIDE, true);
+  TabSet *set = tabsetNew (0, 0);
+  tabsetAppend (set, crontabLoadFromFile (TABLE_FILE_SYSWIDE, true));
+
   for (size_t i = 0; TABLE_DIRS[i] != NULL; i++)
     {
-      path = TABLE_DIRS[i];
+      const char *path = TABLE_DIRS[i];
       DIR *dir = opendir (path);
       if (dir == NULL)
         _err_out ("opendir");
@@ -261,11 +523,10 @@ crontabLoadAll (void)
       struct dirent *entry;
       while ((entry = readdir (dir)) != NULL)
         {
-          if (entry->d_type == DT_REG)
+          if (entry->d_type == DT_REG && _is_tab_name (entry->d_name))
             {
               char *joined_path = _path_join (path, entry->d_name);
-              CronTab *ct = crontabLoadFromFile (joined_path, false);
-              crontabListLink (ctlst, ct);
+              tabsetAppend (set, crontabLoadFromFile (joined_path, false));
               memDeallocSafe (joined_path);
             }
         }
@@ -273,15 +534,239 @@ crontabLoadAll (void)
       closedir (dir);
     }
 
-  return ctlst;
+  return set;
+}
+
+Reloader *
+reloaderNew (TabSet *set, ShardSet *ss)
+{
+  Reloader *rld = memAllocSafe (sizeof (Reloader));
+  atomic_init (&rld->gp_epoch, 1);
+  atomic_init (&rld->num_readers, 0);
+  rld->pending = NULL;
+  rld->retired = NULL;
+  rld->inotify_fd = -1;
+  rld->watches = NULL;
+  rld->num_watches = 0;
+  rld->debounce = NULL;
+
+  atomic_init (&rld->current, set);
+
+  for (size_t i = 0; i < ss->num_shards; i++)
+    ss->shards[i]->rcu = rcuRegister (rld);
+
+  handoffAdoptChildren (set);
+
+  return rld;
+}
+
+static void *
+reloaderThread (void *arg)
+{
+  crontabWatchInotify (arg);
+  return NULL;
+}
+
+void
+reloaderStart (Reloader *rld)
+{
+  if (pthread_create (&rld->thread, NULL, reloaderThread, rld) != 0)
+    _err_out ("pthread_create");
+
+  rebootStart (atomic_load (&rld->current));
+}
+
+static void
+reloaderRetire (Reloader *rld, void *ptr, bool is_tabset)
+{
+  struct Retired *ret = memAllocSafe (sizeof (struct Retired));
+  ret->ptr = ptr;
+  ret->is_tabset = is_tabset;
+  ret->epoch = atomic_fetch_add (&rld->gp_epoch, 1) + 1;
+  ret->next = rld->retired;
+  rld->retired = ret;
+}
+
+static const char *
+crontabJobKey (const CronJob *cj)
+{
+  return cj->label != NULL ? cj->label : (const char *)cj->command;
+}
+
+static int
+crontabCompareJobs (const void *a, const void *b)
+{
+  const CronJob *ja = *(CronJob *const *)a, *jb = *(CronJob *const *)b;
+  int cmp = (ja->label != NULL) - (jb->label != NULL);
+  if (cmp == 0)
+    cmp = strcmp (crontabJobKey (ja), crontabJobKey (jb));
+  if (cmp == 0)
+    cmp = strcmp (&ja->user[0], &jb->user[0]);
+  return cmp;
+}
+
+/* A job keeps its pause across a reload if the new table has a job with
+   the same label, or, for unlabeled jobs, the same user and command.  */
+static void
+crontabCarryPaused (CronTab *old_tab, CronTab *new_tab)
+{
+  JobStore *old_store = &old_tab->store, *new_store = &new_tab->store;
+  CronJob **paused
+      = memAllocBlockSafe (old_store->num_jobs + 1, sizeof (CronJob *));
+  size_t num_paused = 0;
+
+  atomic_store (&new_tab->paused, atomic_load (&old_tab->paused));
+
+  for (size_t idx = 0; idx < old_store->num_jobs; idx++)
+    if (atomic_load (&old_store->paused[idx]))
+      paused[num_paused++] = &old_store->jobs[idx];
+
+  if (num_paused > 0)
+    {
+      qsort (paused, num_paused, sizeof (CronJob *), crontabCompareJobs);
+      for (size_t idx = 0; idx < new_store->num_jobs; idx++)
+        {
+          CronJob *keyp = &new_store->jobs[idx];
+          if (bsearch (&keyp, paused, num_paused, sizeof (CronJob *),
+                       crontabCompareJobs)
+              != NULL)
+            atomic_store (&new_store->paused[idx], true);
+        }
+    }
+
+  memDeallocSafe (paused);
+}
+
+void
+reloaderReload (Reloader *rld, const char *path)
+{
+  TabSet *old_set = atomic_load (&rld->current);
+  CronTab *old_tab = NULL;
+  size_t old_idx = 0;
+
+  for (size_t i = 0; i < old_set->num_tabs; i++)
+    if (!strncmp (&old_set->tabs[i]->path[0], path, PATH_MAX))
+      {
+        old_tab = old_set->tabs[i];
+        old_idx = i;
+        break;
+      }
+
+  CronTab *new_tab = NULL;
+  struct stat st = { 0 };
+  if (stat (path, &st) == 0 && S_ISREG (st.st_mode))
+    {
+      jmp_buf env;
+      if (setjmp (env) != 0)
+        {
+          SYNTAX_ERR_JMP = NULL;
+          Logger *lgr = old_tab != NULL ? old_tab->logger : loggerNew ();
+          loggerLogSyntaxErr (lgr, path, &SYNTAX_ERR_MSG[0]);
+          if (old_tab == NULL)
+            loggerDelete (lgr);
+          return;
+        }
+
+      SYNTAX_ERR_JMP = &env;
+      new_tab = crontabLoadFromFile (
+          path, old_tab != NULL ? old_tab->is_main
+                                : !strcmp (path, TABLE_FILE_SYSWIDE));
+      SYNTAX_ERR_JMP = NULL;
+
+      if (old_tab != NULL)
+        crontabCarryPaused (old_tab, new_tab);
+      jobstorePrepareFires (&new_tab->store, time (NULL));
+    }
+
+  if (old_tab == NULL && new_tab == NULL)
+    return;
+
+  size_t num_tabs = old_set->num_tabs;
+  if (old_tab == NULL)
+    num_tabs++;
+  else if (new_tab == NULL)
+    num_tabs--;
+
+  TabSet *new_set = tabsetNew (num_tabs, old_set->generation + 1);
+  for (size_t i = 0, j = 0; i < old_set->num_tabs; i++)
+    {
+      if (old_tab != NULL && i == old_idx)
+        {
+          if (new_tab != NULL)
+            new_set->tabs[j++] = new_tab;
+        }
+      else
+        new_set->tabs[j++] = old_set->tabs[i];
+    }
+  if (old_tab == NULL)
+    new_set->tabs[num_tabs - 1] = new_tab;
+
+  TabSwap *swap = memAllocSafe (sizeof (TabSwap));
+  swap->old_tab = old_tab;
+  swap->new_tab = new_tab;
+  atomic_init (&swap->done, false);
+
+  struct PendingSwap *pend = memAllocSafe (sizeof (struct PendingSwap));
+  pend->swap = swap;
+  pend->next = rld->pending;
+  rld->pending = pend;
+
+  Scheduler *sched = new_tab != NULL ? new_tab->sched : old_tab->sched;
+  schedulerPublish (sched, swap);
+
+  atomic_store (&rld->current, new_set);
+  reloaderRetire (rld, old_set, true);
 }
 
 void
-crontabReload (CronTab *ctlst, const char *path_key)
+reloaderCollect (Reloader *rld)
 {
-  for (CronTab *tct = ctlst; tct; tct = tct->next)
-    if (strncmp (tct->path, path_key, PATH_MAX))
-      tct = crontabLoadFromFile (tct->path, tct->is_main);
+  for (struct PendingSwap **pendp = &rld->pending; *pendp != NULL;)
+    {
+      struct PendingSwap *pend = *pendp;
+      if (!atomic_load_explicit (&pend->swap->done, memory_order_acquire))
+        {
+          pendp = &pend->next;
+          continue;
+        }
+
+      if (pend->swap->old_tab != NULL)
+        reloaderRetire (rld, pend->swap->old_tab, false);
+
+      *pendp = pend->next;
+      memDeallocSafe (pend->swap);
+      memDeallocSafe (pend);
+    }
+
+  size_t min_seen = SIZE_MAX;
+  size_t num_readers = atomic_load (&rld->num_readers);
+  for (size_t i = 0; i < num_readers; i++)
+    {
+      size_t seen = atomic_load (&rld->readers[i].seen);
+      if (seen < min_seen)
+        min_seen = seen;
+    }
+
+  for (struct Retired **retp = &rld->retired; *retp != NULL;)
+    {
+      struct Retired *ret = *retp;
+      CronTab *ct = ret->ptr;
+
+      if (ret->epoch > min_seen
+          || (!ret->is_tabset && atomic_load (&ct->refs) > 0))
+        {
+          retp = &ret->next;
+          continue;
+        }
+
+      if (ret->is_tabset)
+        tabsetDelete (ret->ptr);
+      else
+        crontabDelete (ct);
+
+      *retp = ret->next;
+      memDeallocSafe (ret);
+    }
 }
 
 CronTab *
@@ -298,7 +783,25 @@ crontabLoadFromFile (const char *path, bool is_main)
     }
 
   ct = crontabNew (path, userp, is_main);
+
+  jmp_buf env, *prev = SYNTAX_ERR_JMP;
+  if (setjmp (env) != 0)
+    {
+      SYNTAX_ERR_JMP = prev;
+      crontabDelete (ct);
+      _unwind_syntax_err ();
+    }
+
+  SYNTAX_ERR_JMP = &env;
   parserParseTable (ct);
+  ct->logger->mail_window = parserGetMailWindow (ct->stab);
+  ct->logger->mail_max = parserGetMailMax (ct->stab);
+  SYNTAX_ERR_JMP = prev;
+
+  ct->logger->mail_to = symtblGet (ct->stab, "MAILTO");
+  ct->logger->mail_from = symtblGet (ct->stab, "MAILFROM");
+  ct->envp = symtblGetEnvironPointer (ct->stab);
+  clusterAssignTab (clusterGet (), ct);
 
   return ct;
 }
@@ -0,0 +1,190 @@
+/* cc -g -I. -DCLUSTER_MEMBERS='"/tmp/lykron-cluster-test/members"'
+      -DLOG_FILE='"/tmp/lykron-cluster-test/lykron.log"'
+      -DSTATUS_FILE='"/tmp/lykron-cluster-test/lykron.status"'
+      -DREBOOT_STAMP='"/tmp/lykron-cluster-test/lykron.reboot"'
+      test/cluster_test.c cluster.c control.c dueset.c handoff.c job.c
+      logger.c mail.c parser.c reboot.c scheduler.c spawner.c status.c
+      tab.c -lpthread -lz && ./a.out  */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <libgen.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* Two daemons on one host, told apart by CLUSTER_NODE, share the members
+   list.  Each reports which CLUSTER=once jobs it owns; every job must have
+   exactly one owner, before and after the list turns into a directory.  */
+
+#define TEST_NUM_JOBS 64
+#define TEST_NUM_NODES 2
+
+static const char *const TEST_NODES[TEST_NUM_NODES] = { "node-a", "node-b" };
+
+static size_t NUM_FAILED = 0;
+
+static void
+testFail (const char *what)
+{
+  fprintf (stderr, "FAIL %s\n", what);
+  NUM_FAILED++;
+}
+
+static CronTab *
+testParse (void)
+{
+  char *text = NULL;
+  size_t text_len = 0;
+  FILE *fstream = open_memstream (&text, &text_len);
+  fputs ("CLUSTER=once\n", fstream);
+  for (size_t i = 0; i < TEST_NUM_JOBS; i++)
+    fprintf (fstream, "* * * * * /bin/echo job%zu\n", i);
+  fclose (fstream);
+
+  CronTab *ct = crontabNew ("/cluster-test", getpwuid (getuid ())->pw_name,
+                            false);
+  fstream = fmemopen (text, text_len, "r");
+  parserParseStream (ct, fstream);
+  fclose (fstream);
+  free (text);
+
+  return ct;
+}
+
+static void
+testReport (int fd, CronTab *ct)
+{
+  char owned[TEST_NUM_JOBS];
+  for (size_t i = 0; i < TEST_NUM_JOBS; i++)
+    owned[i] = atomic_load (&ct->store.jobs[i].owned);
+  write (fd, &owned[0], sizeof (owned));
+}
+
+/* One daemon: reports ownership, waits for the list to change, reloads it
+   and reports again.  Its runtime files are opened while the other
+   daemon's are.  */
+static void
+testNode (const char *node, int report_fd, int go_fd)
+{
+  setenv ("CLUSTER_NODE", node, 1);
+
+  CronTab *ct = testParse ();
+  TabSet set = { .tabs = &ct, .num_tabs = 1 };
+  clusterAssignTab (clusterGet (), ct);
+  char has_page = statusGet () != NULL;
+  write (report_fd, &has_page, 1);
+  testReport (report_fd, ct);
+
+  char go = 0;
+  read (go_fd, &go, 1);
+  clusterReload (clusterGet (), &set);
+  testReport (report_fd, ct);
+
+  _exit (EXIT_SUCCESS);
+}
+
+static void
+testWrite (const char *path, const char *text)
+{
+  FILE *fstream = fopen (path, "w");
+  if (fstream == NULL)
+    _err_out ("fopen");
+  fputs (text, fstream);
+  fclose (fstream);
+}
+
+static void
+testCheckOwners (char owned[TEST_NUM_NODES][TEST_NUM_JOBS], int only)
+{
+  size_t num_by[TEST_NUM_NODES] = { 0 };
+  for (size_t i = 0; i < TEST_NUM_JOBS; i++)
+    {
+      int num_owners = 0;
+      for (int n = 0; n < TEST_NUM_NODES; n++)
+        if (owned[n][i])
+          {
+            num_owners++;
+            num_by[n]++;
+          }
+      if (num_owners != 1)
+        testFail ("job without exactly one owner");
+    }
+
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    if ((only < 0 && num_by[n] == 0) || (only >= 0 && n != only && num_by[n]))
+      testFail ("unexpected share of jobs");
+}
+
+int
+main (void)
+{
+  char dir[] = CLUSTER_MEMBERS;
+  dirname (&dir[0]);
+  mkdir (&dir[0], 0755);
+  unlink (CLUSTER_MEMBERS);
+  rmdir (CLUSTER_MEMBERS);
+  testWrite (CLUSTER_MEMBERS, "node-a\nnode-b  # second\n");
+
+  int report[TEST_NUM_NODES][2], go[TEST_NUM_NODES][2];
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    {
+      if (pipe (report[n]) < 0 || pipe (go[n]) < 0)
+        _err_out ("pipe");
+      if (fork () == 0)
+        testNode (TEST_NODES[n], report[n][1], go[n][0]);
+    }
+
+  char owned[TEST_NUM_NODES][TEST_NUM_JOBS];
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    {
+      char has_page = 0;
+      read (report[n][0], &has_page, 1);
+      if (!has_page)
+        testFail ("status page shared between nodes");
+      read (report[n][0], &owned[n][0], TEST_NUM_JOBS);
+    }
+  testCheckOwners (owned, -1);
+
+  /* Switch the list to a directory holding only the second node.  */
+  char path[PATH_MAX + 1];
+  unlink (CLUSTER_MEMBERS);
+  mkdir (CLUSTER_MEMBERS, 0755);
+  snprintf (&path[0], PATH_MAX, "%s/node-b", CLUSTER_MEMBERS);
+  testWrite (&path[0], "");
+
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    write (go[n][1], "", 1);
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    read (report[n][0], &owned[n][0], TEST_NUM_JOBS);
+  testCheckOwners (owned, 1);
+
+  while (wait (NULL) > 0)
+    ;
+
+  for (int n = 0; n < TEST_NUM_NODES; n++)
+    {
+      setenv ("CLUSTER_NODE", TEST_NODES[n], 1);
+      if (unlink (_instance_path (LOG_FILE, &path[0])) < 0)
+        testFail ("per-node log file missing");
+      unlink (_instance_path (STATUS_FILE, &path[0]));
+    }
+
+  snprintf (&path[0], PATH_MAX, "%s/node-b", CLUSTER_MEMBERS);
+  unlink (&path[0]);
+  rmdir (CLUSTER_MEMBERS);
+
+  if (NUM_FAILED > 0)
+    {
+      fprintf (stderr, "%zu failed\n", NUM_FAILED);
+      return EXIT_FAILURE;
+    }
+
+  puts ("cluster: all passed");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/* cc -g -I. -DCLUSTER_MEMBERS='"/tmp/lykron-mail-test/members"'
+      -DLOG_FILE='"/tmp/lykron-mail-test/lykron.log"'
+      -DSTATUS_FILE='"/tmp/lykron-mail-test/lykron.status"'
+      -DREBOOT_STAMP='"/tmp/lykron-mail-test/lykron.reboot"'
+      test/mail_test.c cluster.c control.c dueset.c handoff.c job.c
+      logger.c mail.c parser.c reboot.c scheduler.c spawner.c status.c
+      tab.c -lpthread -lz && ./a.out  */
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+/* Digests go through LYKRON_SENDMAIL into a stub that keeps the last
+   message.  Each table sets its own MAIL_DIGEST_WINDOW and
+   MAIL_DIGEST_MAX; a digest must flush on whichever it reaches, and not
+   before.  */
+
+#define TEST_DIR "/tmp/lykron-mail-test"
+#define TEST_MAIL TEST_DIR "/mail.out"
+#define TEST_STUB                                                             \
+  "cat > " TEST_DIR "/mail.tmp && mv " TEST_DIR "/mail.tmp " TEST_MAIL
+
+static size_t NUM_FAILED = 0;
+
+static void
+testFail (const char *what)
+{
+  fprintf (stderr, "FAIL %s\n", what);
+  NUM_FAILED++;
+}
+
+static CronTab *
+testLoad (const char *name, const char *text)
+{
+  char path[PATH_MAX + 1] = { 0 };
+  snprintf (&path[0], PATH_MAX, "%s/%s", TEST_DIR, name);
+
+  FILE *fstream = fopen (&path[0], "w");
+  if (fstream == NULL)
+    return NULL;
+  fputs (text, fstream);
+  fclose (fstream);
+
+  jmp_buf env;
+  if (setjmp (env) != 0)
+    {
+      SYNTAX_ERR_JMP = NULL;
+      return NULL;
+    }
+
+  SYNTAX_ERR_JMP = &env;
+  CronTab *ct = crontabLoadFromFile (&path[0], true);
+  SYNTAX_ERR_JMP = NULL;
+
+  return ct;
+}
+
+static void
+testAppend (CronTab *ct, const char *text)
+{
+  Logger *lgr = ct->logger;
+  mailerAppend (lgr->mailer, lgr->mail_from, lgr->mail_to, lgr->mail_window,
+                lgr->mail_max, text, strlen (text));
+}
+
+static char *
+testWaitMail (void)
+{
+  for (int i = 0; i < 500; i++)
+    {
+      FILE *fstream = fopen (TEST_MAIL, "r");
+      if (fstream != NULL)
+        {
+          char *mail = NULL;
+          size_t mail_len = 0;
+          getdelim (&mail, &mail_len, '\0', fstream);
+          fclose (fstream);
+          unlink (TEST_MAIL);
+          return mail;
+        }
+      usleep (10000);
+    }
+
+  return NULL;
+}
+
+static bool
+testPending (Mailer *mlr)
+{
+  pthread_mutex_lock (&mlr->lock);
+  bool pending = mlr->digests != NULL;
+  pthread_mutex_unlock (&mlr->lock);
+  return pending;
+}
+
+static void
+testWindow (void)
+{
+  CronTab *ct = testLoad ("window", "MAILTO=window@example\n"
+                                    "MAILFROM=lykron@example\n"
+                                    "MAIL_DIGEST_WINDOW=0\n"
+                                    "* * * * * root /bin/true\n");
+  if (ct == NULL)
+    {
+      testFail ("window table loads");
+      return;
+    }
+  if (ct->logger->mail_window != 0
+      || ct->logger->mail_max != MAIL_DIGEST_MAX)
+    testFail ("window table settings");
+
+  testAppend (ct, "---- (1) /bin/true\nwindow body\n");
+  mailerFlushDue (ct->logger->mailer, time (NULL), false);
+
+  char *mail = testWaitMail ();
+  if (mail == NULL)
+    testFail ("window digest sent");
+  else
+    {
+      if (strstr (mail, "To: window@example\n") == NULL
+          || strstr (mail, "From: lykron@example\n") == NULL)
+        testFail ("window digest headers");
+      if (strstr (mail, ": 1 job run\n") == NULL
+          || strstr (mail, "window body\n") == NULL)
+        testFail ("window digest body");
+      free (mail);
+    }
+
+  crontabDelete (ct);
+}
+
+static void
+testMax (void)
+{
+  CronTab *ct = testLoad ("max", "MAILTO=max@example\n"
+                                 "MAIL_DIGEST_WINDOW=3600\n"
+                                 "MAIL_DIGEST_MAX=1\n"
+                                 "* * * * * root /bin/true\n");
+  if (ct == NULL)
+    {
+      testFail ("max table loads");
+      return;
+    }
+  if (ct->logger->mail_window != 3600 || ct->logger->mail_max != 1024)
+    testFail ("max table settings");
+
+  char run[600];
+  memset (&run[0], 'x', sizeof (run) - 2);
+  run[sizeof (run) - 2] = '\n';
+  run[sizeof (run) - 1] = '\0';
+
+  Mailer *mlr = ct->logger->mailer;
+  testAppend (ct, &run[0]);
+  mailerFlushDue (mlr, time (NULL), false);
+  if (!testPending (mlr))
+    testFail ("max digest held below its size");
+
+  testAppend (ct, &run[0]);
+  mailerFlushDue (mlr, time (NULL), false);
+  if (testPending (mlr))
+    testFail ("max digest flushed at its size");
+
+  char *mail = testWaitMail ();
+  if (mail == NULL)
+    testFail ("max digest sent");
+  else
+    {
+      if (strstr (mail, "To: max@example\n") == NULL
+          || strstr (mail, ": 2 job runs\n") == NULL)
+        testFail ("max digest headers");
+      free (mail);
+    }
+
+  crontabDelete (ct);
+}
+
+static void
+testDefaults (void)
+{
+  CronTab *ct = testLoad ("defaults", "* * * * * root /bin/true\n");
+  if (ct == NULL)
+    testFail ("defaults table loads");
+  else
+    {
+      if (ct->logger->mail_window != MAIL_DIGEST_WINDOW
+          || ct->logger->mail_max != MAIL_DIGEST_MAX)
+        testFail ("defaults settings");
+      crontabDelete (ct);
+    }
+
+  if (testLoad ("bad-window", "MAIL_DIGEST_WINDOW=soon\n") != NULL)
+    testFail ("bad MAIL_DIGEST_WINDOW rejected");
+  if (testLoad ("bad-max", "MAIL_DIGEST_MAX=-\n") != NULL)
+    testFail ("bad MAIL_DIGEST_MAX rejected");
+}
+
+int
+main (void)
+{
+  mkdir (TEST_DIR, 0755);
+  unlink (TEST_MAIL);
+  setenv ("LYKRON_SENDMAIL", TEST_STUB, 1);
+
+  testWindow ();
+  testMax ();
+  testDefaults ();
+
+  if (NUM_FAILED > 0)
+    {
+      fprintf (stderr, "mail: %zu failed\n", NUM_FAILED);
+      return EXIT_FAILURE;
+    }
+
+  puts ("mail: all passed");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/* cc -g -I. test/timeset_test.c cluster.c control.c dueset.c handoff.c
+      job.c logger.c mail.c parser.c reboot.c scheduler.c spawner.c
+      status.c tab.c -lpthread -lz && ./a.out  */
+#define _GNU_SOURCE
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lykron.h"
+
+static size_t NUM_FAILED = 0;
+
+static time_t
+testUtc (int year, int mon, int mday, int hour, int min, int sec)
+{
+  struct tm tm = {
+    .tm_year = year - 1900,
+    .tm_mon = mon - 1,
+    .tm_mday = mday,
+    .tm_hour = hour,
+    .tm_min = min,
+    .tm_sec = sec,
+  };
+  return timegm (&tm);
+}
+
+static CronTab *
+testParse (const char *text)
+{
+  struct passwd *pwd = getpwuid (getuid ());
+  CronTab *ct = crontabNewDetached ("/dev/null", pwd->pw_name, false);
+  FILE *fstream = fmemopen ((void *)text, strlen (text), "r");
+
+  parserParseStream (ct, fstream);
+  fclose (fstream);
+  return ct;
+}
+
+/* Checks the first two occurrences of the table's only job after NOW.  */
+static void
+testNext (const char *text, time_t now, time_t first, time_t second)
+{
+  CronTab *ct = testParse (text);
+  Timeset *ts = &_job_schedule (&ct->store.jobs[0])->timeset;
+  time_t got_first = timesetComputeNextOccurence (ts, now);
+  time_t got_second = got_first == TIME_UNSPEC
+                          ? TIME_UNSPEC
+                          : timesetComputeNextOccurence (ts, got_first + 1);
+
+  if (got_first != first || got_second != second)
+    {
+      fprintf (stderr, "FAIL %.*s: got %ld, %ld want %ld, %ld\n",
+               (int)strcspn (text, "\n"), text, (long)got_first,
+               (long)got_second, (long)first, (long)second);
+      NUM_FAILED++;
+    }
+
+  crontabDelete (ct);
+}
+
+int
+main (void)
+{
+  setenv ("TZ", "UTC0", 1);
+  tzset ();
+
+  /* A Saturday.  */
+  time_t now = testUtc (2026, 3, 14, 10, 17, 23);
+
+  testNext ("@hourly x\n", now, testUtc (2026, 3, 14, 11, 0, 0),
+            testUtc (2026, 3, 14, 12, 0, 0));
+  testNext ("@daily x\n", now, testUtc (2026, 3, 15, 0, 0, 0),
+            testUtc (2026, 3, 16, 0, 0, 0));
+  testNext ("@weekly x\n", now, testUtc (2026, 3, 15, 0, 0, 0),
+            testUtc (2026, 3, 22, 0, 0, 0));
+  testNext ("@monthly x\n", now, testUtc (2026, 4, 1, 0, 0, 0),
+            testUtc (2026, 5, 1, 0, 0, 0));
+  testNext ("@yearly x\n", now, testUtc (2027, 1, 1, 0, 0, 0),
+            testUtc (2028, 1, 1, 0, 0, 0));
+  testNext ("@annually x\n", now, testUtc (2027, 1, 1, 0, 0, 0),
+            testUtc (2028, 1, 1, 0, 0, 0));
+  testNext ("@every 90s x\n", now, testUtc (2026, 3, 14, 10, 18, 0),
+            testUtc (2026, 3, 14, 10, 19, 30));
+  testNext ("@every 1h30m x\n", now, testUtc (2026, 3, 14, 10, 30, 0),
+            testUtc (2026, 3, 14, 12, 0, 0));
+  testNext ("@reboot x\n", now, TIME_UNSPEC, TIME_UNSPEC);
+
+  testNext ("0 3 * * mon-fri x\n", now, testUtc (2026, 3, 16, 3, 0, 0),
+            testUtc (2026, 3, 17, 3, 0, 0));
+  testNext ("0 0 13 * fri x\n", now, testUtc (2026, 3, 20, 0, 0, 0),
+            testUtc (2026, 3, 27, 0, 0, 0));
+  testNext ("30 2 1 * * x\n", now, testUtc (2026, 4, 1, 2, 30, 0),
+            testUtc (2026, 5, 1, 2, 30, 0));
+
+  /* Without SECONDS=1 a sixth field is part of the command.  */
+  testNext ("*/15 * * * * * x\n", now, testUtc (2026, 3, 14, 10, 30, 0),
+            testUtc (2026, 3, 14, 10, 45, 0));
+  testNext ("SECONDS=1\n*/15 * * * * * x\n", now,
+            testUtc (2026, 3, 14, 10, 17, 30),
+            testUtc (2026, 3, 14, 10, 17, 45));
+  testNext ("SECONDS=1\n0 0 12 * * * x\n", now,
+            testUtc (2026, 3, 14, 12, 0, 0), testUtc (2026, 3, 15, 12, 0, 0));
+
+  if (NUM_FAILED > 0)
+    {
+      fprintf (stderr, "%zu failed\n", NUM_FAILED);
+      return EXIT_FAILURE;
+    }
+
+  puts ("timeset: all passed");
+  return EXIT_SUCCESS;
+}